@@ -1,5 +1,6 @@
 #pragma once
 
+#include <map>
 #include <vector>
 
 #include <vulkan/vulkan_core.h>
@@ -10,23 +11,160 @@ namespace spot::gfx
 class Device;
 
 
+/// @brief Range of device memory bound to a buffer or an image
+struct Allocation
+{
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	VkDeviceSize offset = 0;
+	VkDeviceSize size = 0;
+
+	uint32_t memory_type = 0;
+
+	/// Index of the pool and of the block within it, unused for dedicated allocations
+	uint32_t pool = 0;
+	uint32_t block = 0;
+
+	/// Whether this allocation owns the whole device memory
+	bool dedicated = false;
+
+	/// Mapped memory at offset, or null when not host visible
+	uint8_t* data = nullptr;
+};
+
+
+/// @brief How the memory of a buffer is accessed
+enum class MemoryUsage
+{
+	/// Device local memory, filled through transfer commands
+	GPU_ONLY,
+
+	/// Host visible memory written by the CPU and read by the GPU
+	CPU_TO_GPU,
+
+	/// Host visible memory written by the GPU and read back by the CPU
+	GPU_TO_CPU,
+};
+
+
 class Buffer
 {
   public:
-	Buffer( const Device& d, VkDeviceSize size, VkBufferUsageFlags usage );
+	/// @param memory_usage GPU only buffers may still be mappable on devices with unified memory
+	Buffer( const Device& d, VkDeviceSize size, VkBufferUsageFlags usage, MemoryUsage memory_usage = MemoryUsage::CPU_TO_GPU );
 	~Buffer();
 
 	Buffer( Buffer&& o );
 	Buffer& operator=( Buffer&& o );
 
+	/// @return Memory of the buffer, which the device allocator keeps mapped
 	void* map( VkDeviceSize size );
+
+	/// @brief Nothing to do, as memory stays mapped for the whole lifetime of the buffer
 	void unmap();
 
 	void upload( const uint8_t* data, VkDeviceSize size );
 
+	/// @return Whether the CPU can write the memory of this buffer without flushing it
+	bool is_mappable() const
+	{
+		auto flags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		return ( memory_properties & flags ) == flags;
+	}
+
 	const Device& device;
 	VkBuffer handle = VK_NULL_HANDLE;
-	VkDeviceMemory memory = VK_NULL_HANDLE;
+	Allocation memory = {};
+
+	/// Properties of the memory type actually selected
+	VkMemoryPropertyFlags memory_properties = 0;
+};
+
+
+/// @brief Linear allocator of uniform, storage, and indirect draw data for a single frame in flight
+/// Data is copied into a persistently mapped buffer at offsets aligned to both
+/// minUniformBufferOffsetAlignment and minStorageBufferOffsetAlignment, to be bound with dynamic offsets.
+/// Reset it only once the fence of its frame has signaled.
+/// When a frame needs more room, the buffer is replaced by a larger one holding the same data,
+/// which is safe only before the frame binds any descriptor set referring to it.
+class UniformAllocator
+{
+  public:
+	/// @param capacity Size of the underlying buffer in bytes
+	UniformAllocator( const Device& d, VkDeviceSize capacity = 8 * 1024 * 1024 );
+
+	UniformAllocator( UniformAllocator&& o ) = default;
+	UniformAllocator& operator=( UniformAllocator&& o ) = default;
+
+	/// @brief Reserves the next free aligned slot, to be written through data
+	/// The buffer grows when full, so data should be read again after this call
+	/// @return Offset of the slot within the buffer
+	uint32_t allocate( VkDeviceSize size );
+
+	/// @brief Copies data into the next free aligned slot
+	/// @return Offset of the data within the buffer
+	uint32_t upload( const uint8_t* data, VkDeviceSize size );
+
+	template<typename T>
+	uint32_t upload( const T& data ) { return upload( reinterpret_cast<const uint8_t*>( &data ), sizeof( T ) ); }
+
+	/// @brief Releases all sub-allocations at once
+	void reset() { offset = 0; }
+
+	Buffer buffer;
+
+	/// Alignment of each sub-allocation
+	VkDeviceSize alignment = 0;
+	VkDeviceSize capacity = 0;
+
+	/// Offset of the next free byte
+	VkDeviceSize offset = 0;
+
+	/// Persistently mapped memory of the buffer
+	uint8_t* data = nullptr;
+
+	/// Whether the buffer has been replaced since descriptor sets referring to it were written
+	bool grown = false;
+
+  private:
+	/// @brief Replaces the buffer with one of at least the required capacity, copying allocated data
+	void grow( VkDeviceSize required );
+};
+
+
+/// @brief Free-list allocator of ranges within a fixed capacity
+/// Free ranges are kept sorted by offset, and neighbouring ones are merged when freed
+class RangeAllocator
+{
+  public:
+	/// @param capacity Number of elements which can be allocated
+	RangeAllocator( uint32_t capacity );
+
+	/// @brief Finds the first free range large enough
+	/// @param alignment Power of two the offset should be a multiple of
+	/// @return Offset of the range, or invalid when there is no room
+	uint32_t allocate( uint32_t size, uint32_t alignment = 1 );
+
+	/// @brief Makes a range allocated before available again
+	void free( uint32_t offset, uint32_t size );
+
+	/// @return Number of free elements
+	uint32_t get_free_size() const { return free_size; }
+
+	/// @return Size of the largest free range, which is the largest allocation that can succeed
+	uint32_t get_largest_free_range() const;
+
+	/// @return 0 when free space is contiguous, close to 1 when it is scattered among small ranges
+	float get_fragmentation() const;
+
+	static constexpr uint32_t invalid = ~uint32_t( 0 );
+
+	uint32_t capacity = 0;
+
+  private:
+	/// Key is the offset of a free range, value is its size
+	std::map<uint32_t, uint32_t> free_ranges;
+
+	uint32_t free_size = 0;
 };
 
 
@@ -59,7 +197,7 @@ class DynamicBuffer
 	VkBufferUsageFlags usage = 0;
 	VkBuffer handle = VK_NULL_HANDLE;
 	VkDeviceSize offset = 0;
-	VkDeviceMemory memory = VK_NULL_HANDLE;
+	Allocation memory = {};
 
   private:
 	void clear();
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <vector>
 
 #include <vulkan/vulkan_core.h>
@@ -17,40 +18,105 @@ class GraphicsPipeline;
 class PipelineLayout;
 class Image;
 
+/// @brief Command buffer which tracks bound state
+/// Binds of pipelines, buffers, and descriptor sets which did not change are skipped
 class CommandBuffer
 {
   public:
 	CommandBuffer( VkCommandBuffer h = VK_NULL_HANDLE );
 
-	void begin( VkCommandBufferUsageFlags usage_flags = 0 );
+	/// @param inheritance Render pass state inherited by a secondary command buffer
+	void begin( VkCommandBufferUsageFlags usage_flags = 0, const VkCommandBufferInheritanceInfo* inheritance = nullptr );
 
 	void transition( Image& image, VkImageLayout layout );
-	void copy( const Buffer& from, const Image& dest );
+	/// @param offset Offset of the texels within the buffer
+	/// @param level Mip level of the image to copy into
+	void copy( const Buffer& from, const Image& dest, VkDeviceSize offset = 0, uint32_t level = 0 );
+
+	/// @brief Fills every level of an image by blitting the previous one with a linear filter
+	/// All levels should be in transfer dst layout, and they end up in shader read only layout
+	void generate_mipmaps( Image& image );
+	void copy( const Buffer& from, const Buffer& dest, const VkBufferCopy& region );
+
+	/// @brief Makes writes of the source stages available to reads of the destination stages
+	void barrier( VkPipelineStageFlags src_stage, VkAccessFlags src_access, VkPipelineStageFlags dst_stage, VkAccessFlags dst_access );
+
+	/// @brief Records a barrier for a single image, which may transition its layout or transfer its ownership
+	void barrier( VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage, const VkImageMemoryBarrier& image_barrier );
+
+	/// @brief Records a barrier for a range of a single buffer
+	void barrier( VkPipelineStageFlags src_stage, VkPipelineStageFlags dst_stage, const VkBufferMemoryBarrier& buffer_barrier );
 
 	void set_viewport( const VkViewport& vp );
 	void set_scissor( const VkRect2D& scissor );
 
-	void begin_render_pass( RenderPass& rp, Framebuffer& fb );
+	/// @param contents Whether the render pass is recorded inline or by secondary command buffers
+	void begin_render_pass( RenderPass& rp, Framebuffer& fb, VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE );
 
-	void bind_vertex_buffer( Buffer& b, VkDeviceSize offset = 0 );
+	/// @brief Executes secondary command buffers within the current render pass
+	/// @param secondaries Secondary command buffers already ended
+	void execute( const std::vector<CommandBuffer>& secondaries );
+
+	void bind_vertex_buffer( const Buffer& b, VkDeviceSize offset = 0 );
 	void bind_vertex_buffers( DynamicBuffer& db );
 
-	void bind_index_buffer( Buffer& b, VkDeviceSize offset = 0 );
+	void bind_index_buffer( const Buffer& b, VkDeviceSize offset = 0 );
 	void bind_index_buffer( DynamicBuffer& b );
 
 	void bind( GraphicsPipeline& p );
 	void set_line_width( float line_width );
 
-	void bind_descriptor_sets( const PipelineLayout& layout, VkDescriptorSet set );
+	/// @param first Index of the set within the pipeline layout
+	/// @param offset_count Number of dynamic offsets, one for each dynamic binding of the set
+	/// @param offsets Dynamic offsets ordered by binding number
+	void bind_descriptor_sets( const PipelineLayout& layout, VkDescriptorSet set, uint32_t first = 0, uint32_t offset_count = 0, const uint32_t* offsets = nullptr );
+
+	void push_constants( const PipelineLayout& layout, VkShaderStageFlags stages, uint32_t size, const void* data );
 
 	void draw( const uint32_t vertex_count = 1 );
-	void draw_indexed( const uint32_t index_count );
+	/// @param first_index Offset of the first index within the bound index buffer
+	/// @param vertex_offset Value added to each index before reading the vertex buffer
+	void draw_indexed( uint32_t index_count, uint32_t instance_count = 1, uint32_t first_instance = 0, uint32_t first_index = 0, int32_t vertex_offset = 0 );
+
+	/// @brief Draws with parameters read from VkDrawIndexedIndirectCommands
+	/// @param offset Offset of the first command within the buffer
+	/// @param draw_count Number of commands, which must be 1 without the multiDrawIndirect feature
+	void draw_indexed_indirect( const Buffer& buffer, VkDeviceSize offset, uint32_t draw_count = 1 );
 
 	void end_render_pass();
 
 	void end();
 
 	VkCommandBuffer handle = VK_NULL_HANDLE;
+
+  private:
+	/// @brief A descriptor set bound to a set index
+	struct BoundSet
+	{
+		VkPipelineLayout layout = VK_NULL_HANDLE;
+		VkDescriptorSet handle = VK_NULL_HANDLE;
+		uint32_t offset_count = 0;
+		std::array<uint32_t, 4> offsets = {};
+	};
+
+	/// @brief State bound since the command buffer began
+	struct State
+	{
+		VkPipeline pipeline = VK_NULL_HANDLE;
+		float line_width = 0.0f;
+
+		VkBuffer vertex_buffer = VK_NULL_HANDLE;
+		VkDeviceSize vertex_offset = 0;
+
+		VkBuffer index_buffer = VK_NULL_HANDLE;
+		VkDeviceSize index_offset = 0;
+
+		/// Layout of the last descriptor set bound, any other one invalidates every set
+		VkPipelineLayout layout = VK_NULL_HANDLE;
+		std::array<BoundSet, 4> sets = {};
+	};
+
+	State state = {};
 };
 
 
@@ -63,7 +129,7 @@ class CommandPool
 	CommandPool( CommandPool&& o );
 	CommandPool& operator=( CommandPool&& o );
 
-	std::vector<CommandBuffer> allocate_command_buffers( uint32_t count = 1 );
+	std::vector<CommandBuffer> allocate_command_buffers( uint32_t count = 1, VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY );
 
 	Device& device;
 	VkCommandPool handle = VK_NULL_HANDLE;
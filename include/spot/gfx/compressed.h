@@ -0,0 +1,65 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+
+namespace spot::gfx
+{
+
+class MappedFile;
+
+/// @brief Block compressed image read from a KTX2 or DDS container, with every mip level
+/// Supported formats are BC1, BC3, BC4, BC5, and BC7, which the GPU samples without decoding them.
+/// Throws std::runtime_error when the container is truncated, not valid, or of an unsupported format.
+class CompressedImage
+{
+  public:
+	/// @brief Maps a container from file, recognized by its identifier
+	CompressedImage( const std::string& path );
+
+	/// @brief Views a container in memory without copying it
+	/// @param data Should stay alive as long as the image
+	CompressedImage( const uint8_t* data, size_t size );
+
+	/// @return Whether the MIME type, or the extension of the path, names a KTX2 or DDS container
+	static bool is_container( const std::string& path, const std::string& mime_type = {} );
+
+	/// @brief Copies every level into the destination
+	/// @param offsets Offset of each level within the destination, as returned by Image::get_level_offsets()
+	void load( uint8_t* dst, const std::vector<VkDeviceSize>& offsets ) const;
+
+	VkExtent2D extent = {};
+	VkFormat format = VK_FORMAT_UNDEFINED;
+
+	/// @brief Range of a level within the container, from the largest to the smallest one
+	struct Level
+	{
+		size_t offset = 0;
+		size_t size = 0;
+	};
+
+	std::vector<Level> levels;
+
+	/// Content of the container, either mapped or viewed
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+
+  private:
+	/// @brief Parses the header and the level index
+	void parse();
+
+	/// @brief Checks the extent, and that there are no more levels than down to one texel
+	void check_extent( uint32_t level_count ) const;
+
+	/// Mapping of the container, when read from file
+	std::shared_ptr<MappedFile> file;
+	void parse_ktx2();
+	void parse_dds();
+};
+
+
+} // namespace spot::gfx
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <vector>
+
+#include <spot/handle.h>
+#include <spot/math/math.h>
+
+
+namespace spot::gfx
+{
+
+class GraphicsPipeline;
+struct PrimitiveResources;
+struct Material;
+
+
+/// @brief Compact description of a draw, recorded into a command buffer once sorted
+/// Neighbouring packets with the same pipeline, material set and geometry are merged into an instanced draw
+struct DrawPacket
+{
+	/// Pipeline, material set, geometry and depth, from the most to the least significant bits
+	uint64_t key = 0;
+
+	GraphicsPipeline* pipeline = nullptr;
+	Handle<Material> material = {};
+	const PrimitiveResources* resources = nullptr;
+	uint32_t index_count = 0;
+
+	math::Mat4 transform = math::Mat4::identity;
+
+	float line_width = 1.0f;
+
+	/// @return Whether this packet may be drawn as another instance of the other one
+	bool can_merge( const DrawPacket& other ) const;
+};
+
+
+/// @brief Draws collected during a frame, sorted to minimize state changes
+class DrawList
+{
+  public:
+	/// @param pipeline Index of the pipeline
+	/// @param material Identifier of the material set, which is the same for materials without texture
+	/// @param geometry Hash of the primitive geometry
+	/// @param depth Distance from the camera
+	/// @return A sort key which groups draws by pipeline, then material set, then geometry,
+	/// and orders them front to back
+	static uint64_t get_key( uint64_t pipeline, uint64_t material, uint64_t geometry, float depth );
+
+	/// @return Distance of the origin of a transform from the camera
+	float get_depth( const math::Mat4& transform ) const;
+
+	void push( const DrawPacket& packet ) { packets.emplace_back( packet ); }
+
+	/// @brief Radix sorts packets by their key
+	/// @return Packets in sorted order
+	const std::vector<const DrawPacket*>& sort();
+
+	void clear();
+
+	/// View matrix of the frame, used to compute depth
+	math::Mat4 view = math::Mat4::identity;
+
+	std::vector<DrawPacket> packets;
+
+  private:
+	struct Entry
+	{
+		uint64_t key;
+		uint32_t index;
+	};
+
+	std::vector<Entry> entries;
+	std::vector<Entry> scratch;
+	std::vector<const DrawPacket*> sorted;
+};
+
+
+} // namespace spot::gfx
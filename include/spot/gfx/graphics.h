@@ -4,14 +4,19 @@
 #include <filesystem>
 #include <functional>
 #include <array>
+#include <memory>
 
 #include <vulkan/vulkan_core.h>
 #include <spot/gltf/gltf.h>
 
 #include "spot/gfx/glfw.h"
+#include "spot/gfx/memory.h"
+#include "spot/gfx/uploads.h"
+#include "spot/gfx/workers.h"
 #include "spot/gfx/renderer.h"
 #include "spot/gfx/descriptors.h"
 #include "spot/gfx/commands.h"
+#include "spot/gfx/draws.h"
 #include "spot/gfx/images.h"
 #include "spot/gfx/pipelines.h"
 #include "spot/gfx/camera.h"
@@ -40,6 +45,36 @@ struct MvpUbo
 };
 
 
+/// @brief Camera data for set 0, which is uploaded once per frame
+struct ViewUbo
+{
+	math::Mat4 view = math::Mat4::identity;
+	math::Mat4 proj = math::Mat4::identity;
+};
+
+
+/// @brief Data of a single instance, read by vertex shaders through gl_InstanceIndex
+struct alignas(16) InstanceData
+{
+	math::Mat4 model = math::Mat4::identity;
+
+	/// Index of the material within the materials of the frame
+	uint32_t material = 0;
+};
+
+
+/// @brief Push constants of a draw
+/// A single instance gets its data here, while merged instances read it from the instance array
+struct ObjectConstants
+{
+	math::Mat4 model = math::Mat4::identity;
+	uint32_t material = 0;
+
+	/// Whether instance data should be read from the instance array instead
+	uint32_t instanced = 0;
+};
+
+
 struct LightUbo
 {
 	math::Vec3 position = math::Vec3::Zero;
@@ -75,6 +110,12 @@ class PhysicalDevice
 
 	std::vector<VkPresentModeKHR> get_present_modes( VkSurfaceKHR s );
 	uint32_t get_memory_type( uint32_t type_filter, VkMemoryPropertyFlags f );
+
+	/// @return A memory type with both required and preferred properties if any, otherwise with required ones only
+	uint32_t get_memory_type( uint32_t type_filter, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred );
+
+	/// @return Whether the GPU shares memory with the CPU, like integrated and software devices
+	bool has_unified_memory() const;
 	VkFormatProperties get_format_properties( VkFormat f ) const;
 
 	/// @return Whether a format is supported by the GPU
@@ -83,6 +124,7 @@ class PhysicalDevice
 	VkPhysicalDevice handle = VK_NULL_HANDLE;
 	VkPhysicalDeviceProperties properties;
 	VkPhysicalDeviceFeatures features;
+	VkPhysicalDeviceMemoryProperties memory_properties;
 	std::vector<VkQueueFamilyProperties> queue_families;
 	std::vector<VkExtensionProperties> extensions;
 };
@@ -122,12 +164,22 @@ class Device
 	void wait_idle() const;
 	Queue& find_queue( VkQueueFlagBits flags );
 	Queue& find_graphics_queue();
+
+	/// @return A queue of a family dedicated to transfers if any, otherwise the graphics queue
+	Queue& find_transfer_queue();
+
 	Queue& find_present_queue( VkSurfaceKHR surface );
 
 	PhysicalDevice& physical_device;
 	VkSurfaceKHR surface;
 	VkDevice handle = VK_NULL_HANDLE;
 	std::vector<Queue> queues;
+
+	/// @brief Memory of every buffer and image, released before the device is destroyed
+	std::unique_ptr<DeviceAllocator> allocator;
+
+	/// @brief Uploads of buffers and images, submitted to the transfer queue
+	std::unique_ptr<UploadManager> uploads;
 };
 
 
@@ -253,6 +305,10 @@ class Fence
 	Fence& operator=( Fence&& o );
 
 	void wait() const;
+
+	/// @return Whether the fence is signaled, without waiting for it
+	bool is_signaled() const;
+
 	void reset();
 
 	Device& device;
@@ -274,6 +330,11 @@ class Graphics
 	void draw( const Handle<Node>& node, const math::Mat4& transform = math::Mat4::identity );
 	void draw( const Handle<Gltf>& model, const math::Mat4& transform = math::Mat4::identity );
 
+	/// @brief Draws a mesh once for each transform, merging them into instanced draws
+	/// @param transforms Pointer to the first of count transforms
+	void draw_instanced( const Handle<Mesh>& mesh, const math::Mat4* transforms, size_t count );
+	void draw_instanced( const Handle<Mesh>& mesh, const std::vector<math::Mat4>& transforms );
+
 	Glfw glfw;
 	Instance instance;
 	Window window;
@@ -323,17 +384,119 @@ class Graphics
 	Queue& graphics_queue;
 	Queue& present_queue;
 
+	/// @brief Draws of the current frame, recorded at render end
+	DrawList draw_list;
+
+	/// @brief Number of ranges of draws recorded by the worker pool into secondary command buffers
+	/// With a single thread, draws are recorded directly into the primary command buffer
+	uint32_t recording_threads = 1;
+
+	/// @brief Whether draws are issued with a single indirect draw for each pipeline and material set
+	/// It requires the drawIndirectFirstInstance feature, otherwise draws are recorded directly
+	bool indirect_draws = false;
+
 	/// @brief Loads a gltf file
 	/// @return A handle to the gltf model
 	Handle<Gltf> load_model( const std::string& path );
 
+	/// @brief Drops the texture reference of a material, which samples nothing afterwards
+	/// Textures acquired from the shared cache are released here, whether ready or still uploading
+	void release( const Handle<Material>& material );
+
+	/// @brief Drops texture references of every material of a model, to call before dropping the model
+	void release( const Handle<Gltf>& model );
+
 	Animations animations;
 
 	Uvec<Gltf> models;
 
+	/// @brief Textures of every model, loaded once even when shared by different models
+	Images textures;
+
+	/// @brief White texture sampled by materials until their own texture is ready
+	Image placeholder;
+	ImageView placeholder_view;
+
+	/// @brief Threads decoding textures of models being loaded, stopped before models are destroyed
+	WorkerPool workers;
+
 	/// @todo Move into a scene?
 	Ambient ambient = {};
 	Handle<Node> light_node = {};
+
+  private:
+	/// @brief Consecutive packets drawn with a single instanced draw
+	struct Batch
+	{
+		const DrawPacket* packet = nullptr;
+		uint32_t first = 0;
+		uint32_t count = 0;
+		VkDescriptorSet material_set = VK_NULL_HANDLE;
+		ObjectConstants constants = {};
+
+		/// Dynamic offsets of the instance and material arrays of the batch
+		uint32_t instances_offset = 0;
+		uint32_t materials_offset = 0;
+	};
+
+	/// @brief Command pool and secondary command buffer of a recording thread
+	struct Recorder
+	{
+		Recorder( Device& d );
+
+		CommandPool command_pool;
+		CommandBuffer command_buffer;
+	};
+
+	/// @brief Texture of a material which is still being uploaded
+	struct PendingTexture
+	{
+		Handle<Material> material;
+		VkImageView view = VK_NULL_HANDLE;
+	};
+
+	/// @brief Assigns textures whose upload completed to their materials
+	void update_pending_textures();
+
+	/// @brief Uploads view, ambient and light data of set 0
+	void upload_frame_data();
+
+	/// @brief Binds set 0, as secondary command buffers do not inherit descriptor sets
+	void bind_frame_data( CommandBuffer& command_buffer );
+
+	/// @return Resources for a primitive, created if not found
+	const PrimitiveResources& get_resources( const Primitive& primitive );
+
+	/// @brief Appends a draw of the primitive to the draw list
+	void push_draw( const Primitive& primitive, const PrimitiveResources& resources, const math::Mat4& transform );
+
+	/// @brief Sorts the draw list, uploads instance and material data of the frame,
+	/// and merges packets into batches
+	void prepare_batches();
+
+	/// @brief Records batches in the range [begin, end) into a command buffer
+	void record_batches( CommandBuffer& command_buffer, size_t begin, size_t end );
+
+	/// @brief Records indirect batches of the renderer into a command buffer
+	void record_indirect_batches( CommandBuffer& command_buffer );
+
+	/// @brief Begins the render pass and records batches, across recording threads if more than one
+	void record_draws();
+
+	/// Index of each material within the materials of the current frame
+	std::unordered_map<Handle<Material>, uint32_t> material_indices;
+
+	/// Batches of the current frame
+	std::vector<Batch> batches;
+
+	/// Textures of loaded models which are not ready to be sampled yet
+	std::vector<PendingTexture> pending_textures;
+
+	/// Dynamic offsets of set 0 for the current frame
+	std::array<uint32_t, 3> frame_offsets = {};
+
+	/// Recorders of each frame, one for each recording thread, created on demand
+	std::vector<std::vector<Recorder>> recorders;
 };
 
 
@@ -1,10 +1,55 @@
 #pragma once
 
+#include <cstdint>
+#include <cstring>
 #include <spot/gltf/color.h>
 #include <spot/gltf/mesh.h>
 #include <spot/hash.h>
 #include <spot/math/math.h>
 
+namespace spot::gfx
+{
+/// @brief Fast hash of a block of memory, eight bytes at a time (MurmurHash64A)
+/// @param seed Can be used to chain multiple blocks
+inline size_t hash_bytes(const void* data, const size_t size, const size_t seed = 0)
+{
+	constexpr uint64_t m = 0xc6a4a7935bd1e995ULL;
+	constexpr int r = 47;
+
+	uint64_t h = seed ^ (size * m);
+
+	auto bytes = reinterpret_cast<const uint8_t*>(data);
+	auto end = bytes + (size & ~size_t(7));
+	for (; bytes != end; bytes += 8)
+	{
+		uint64_t k;
+		std::memcpy(&k, bytes, sizeof(k));
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+		h ^= k;
+		h *= m;
+	}
+
+	switch (size & 7)
+	{
+		case 7: h ^= uint64_t(bytes[6]) << 48; [[fallthrough]];
+		case 6: h ^= uint64_t(bytes[5]) << 40; [[fallthrough]];
+		case 5: h ^= uint64_t(bytes[4]) << 32; [[fallthrough]];
+		case 4: h ^= uint64_t(bytes[3]) << 24; [[fallthrough]];
+		case 3: h ^= uint64_t(bytes[2]) << 16; [[fallthrough]];
+		case 2: h ^= uint64_t(bytes[1]) << 8; [[fallthrough]];
+		case 1: h ^= uint64_t(bytes[0]); h *= m;
+	}
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	return h;
+}
+
+}  // namespace spot::gfx
+
 namespace std
 {
 template <>
@@ -40,12 +85,7 @@ struct hash<spot::gfx::Vertex>
 template <>
 struct hash<spot::gfx::Primitive>
 {
-	size_t operator()(const spot::gfx::Primitive& pm) const
-	{
-		auto hp = std::hash<std::vector<spot::gfx::Vertex>>()(pm.vertices);
-		auto hi = std::hash<std::vector<spot::gfx::Index>>()(pm.indices);
-		return std::hash_combine(hp, hi);
-	}
+	size_t operator()(const spot::gfx::Primitive& pm) const { return pm.get_hash(); }
 };
 
 }  // namespace std
@@ -1,10 +1,16 @@
 #pragma once
 
+#include <future>
+#include <string>
 #include <unordered_map>
+#include <vector>
 
 #include <vulkan/vulkan_core.h>
 
+#include "spot/gfx/buffers.h"
 #include "spot/gfx/commands.h"
+#include "spot/gfx/uploads.h"
+#include "spot/gfx/workers.h"
 
 
 namespace spot::gfx
@@ -12,14 +18,17 @@ namespace spot::gfx
 
 class Device;
 class Png;
+class CompressedImage;
 class Buffer;
 
 class Image
 {
   public:
-	/// @param p PNG file to load into the Vulkan image
-	Image( Device& d, Png& p );
-	Image( Device& d, VkExtent2D e, VkFormat f );
+	/// @param p PNG file to load into the Vulkan image, converted when the device cannot sample its channels
+	/// @param mip_levels Number of levels, clamped to 1 for images with linear tiling
+	/// @param srgb Whether 8 bit color is sampled as sRGB
+	Image( Device& d, Png& p, uint32_t mip_levels = 1, bool srgb = false );
+	Image( Device& d, VkExtent2D e, VkFormat f, uint32_t mip_levels = 1 );
 	~Image();
 
 	Image( Image&& o );
@@ -28,12 +37,24 @@ class Image
 	void transition( const VkImageLayout l );
 	void upload( Buffer& b );
 
+	/// @return Number of levels of a full mip chain, down to 1x1
+	static uint32_t get_full_mip_levels( VkExtent2D extent );
+
+	/// @return Whether levels can be generated by blitting with a linear filter
+	bool supports_linear_blit() const;
+
+	/// @return Offset of each level when levels are packed in a buffer, followed by their total size
+	/// Offsets are aligned to both 4 bytes and the texel size, as required by buffer to image copies
+	std::vector<VkDeviceSize> get_level_offsets() const;
+
 	Device& device;
 	VkExtent3D extent = {};
 	VkFormat format = VK_FORMAT_UNDEFINED;
+	uint32_t mip_levels = 1;
+	VkImageTiling tiling = VK_IMAGE_TILING_OPTIMAL;
 
 	VkImage handle = VK_NULL_HANDLE;
-	VkDeviceMemory memory = VK_NULL_HANDLE;
+	Allocation memory = {};
 
 	VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
 	CommandPool command_pool;
@@ -68,28 +89,133 @@ class Sampler
 };
 
 
-/// @brief Image repository
+/// @brief Texture cache shared by every model
+/// Images are keyed by canonical path, or by content hash when loaded from memory, so each is loaded once.
+/// Images without references stay cached until the resident size exceeds the budget, then the least
+/// recently released are evicted, and destroyed once no frame in flight may sample them.
 class Images
 {
   public:
-	Images( Device& d );
+	struct Stats
+	{
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+
+		/// Bytes of device memory of cached images
+		VkDeviceSize resident_bytes = 0;
+	};
+
+	/// @param budget Bytes of device memory above which unreferenced images are evicted
+	Images( Device& d, VkDeviceSize budget = 512 * 1024 * 1024 );
 
 	Images( Images&& o );
 	Images& operator=( Images&& o );
 
-	/// @brief Loads an image from file
-	/// @return an image view to that image
-	/// @todo Should I use std::string instead?
-	VkImageView load( const char* path );
+	/// @brief Loads an image from file, acquiring a reference to it
+	/// Blocks until the upload completes, so the view can be sampled right away.
+	/// KTX2 and DDS containers of block compressed levels are uploaded as they are
+	/// @param mime_type Overrides the extension of the path to tell the container
+	/// @return An image view to that image, or null when the device cannot sample its format
+	VkImageView load( const std::string& path, const std::string& mime_type = {} );
 
-	/// @brief Loads an image from memory
+	/// @brief Loads an image from memory, acquiring a reference to it
+	/// Blocks until the upload completes, so the view can be sampled right away
 	/// @return An image view to that image
-	VkImageView load( const char* name, std::vector<uint8_t>& mem );
+	VkImageView load( const std::vector<uint8_t>& mem );
+
+	/// @brief Loads an image from memory, like a buffer view of a binary gltf, acquiring a reference to it
+	/// Blocks until the upload completes, so the view can be sampled right away
+	/// @param data Encoded image, which is only read during the call
+	/// @param mime_type Tells a KTX2 or DDS container from a PNG
+	/// @return An image view to that image, or null when the device cannot sample its format
+	VkImageView load( const uint8_t* data, size_t size, const std::string& mime_type = {} );
+
+	/// @brief Reads the header of an image file, leaving decoding and upload to a worker
+	/// Compressed containers need no decoding, so they are uploaded right away
+	/// @return An image view to that image, which should not be sampled until it is ready,
+	/// or null when the device cannot sample its format
+	VkImageView load_async( const std::string& path, WorkerPool& workers, const std::string& mime_type = {} );
+
+	/// @brief Drops a reference acquired by a load, making the image a candidate for eviction
+	void release( VkImageView view );
 
-	/// Map of paths and Vulkan images and image views
-	std::unordered_map<const char*, std::pair<Image, ImageView>> images = {};
+	/// @return Whether the decode and upload of the image behind this view have completed
+	bool is_ready( VkImageView view );
+
+	/// @brief Destroys images evicted long enough ago, then evicts images while above budget
+	/// @param frame Number of the current frame, increasing every frame
+	/// @param frames_in_flight Number of frames which may still sample an evicted image
+	/// @return Views destroyed by this call, whose descriptor sets should be released as well
+	std::vector<VkImageView> collect( uint64_t frame, uint32_t frames_in_flight );
+
+	Stats get_stats() const;
+
+	VkDeviceSize budget = 0;
+
+	/// Whether loaded images get a full mip chain, generated on the GPU when the format supports linear blits
+	bool mipmaps = true;
+
+	/// Whether color images are sampled as sRGB, which looks right only when rendering to an sRGB target
+	bool srgb = false;
 
 	Device& device;
+
+  private:
+	struct Entry
+	{
+		Image image;
+		ImageView view;
+		uint32_t references = 0;
+
+		/// Frame when the image was last released
+		uint64_t last_used = 0;
+	};
+
+	/// @return Number of levels of an image loaded from this png
+	uint32_t get_mip_levels( const Png& png ) const;
+
+	/// @brief Loads an image from file without waiting for its upload
+	VkImageView request( const std::string& path, const std::string& mime_type );
+
+	/// @brief Loads an image from memory without waiting for its upload
+	VkImageView request( const uint8_t* data, size_t size, const std::string& mime_type );
+
+	/// @brief Waits for the decode and upload of an image, owned by the graphics queue afterwards
+	/// @return The same view
+	VkImageView wait( VkImageView view );
+
+	/// @brief Uploads every level of a KTX2 or DDS container
+	/// @return The view of the new image, or null when the device cannot sample its format
+	VkImageView load_compressed( const std::string& key, const CompressedImage& compressed );
+
+	/// @return The view of a cached image with a new reference to it, or null when missing
+	VkImageView acquire( const std::string& key );
+
+	/// @brief Caches a new image with a reference to it
+	/// @return The cached image, which does not move any longer
+	Image& insert( const std::string& key, Image&& image );
+
+	std::unordered_map<std::string, Entry> entries;
+
+	/// Key of the entry of each view
+	std::unordered_map<VkImageView, std::string> keys;
+
+	/// Upload tickets of images which were not seen ready yet
+	std::unordered_map<VkImageView, UploadTicket> tickets;
+
+	/// Tickets of images still being decoded by a worker
+	std::unordered_map<VkImageView, std::future<UploadTicket>> decodes;
+
+	/// Evicted images and the frame they were evicted at
+	std::vector<std::pair<uint64_t, Entry>> evicted;
+
+	uint64_t frame_number = 0;
+
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t evictions = 0;
+	VkDeviceSize resident_bytes = 0;
 };
 
 
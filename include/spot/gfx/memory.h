@@ -0,0 +1,86 @@
+#pragma once
+
+#include <mutex>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+#include "spot/gfx/buffers.h"
+
+
+namespace spot::gfx
+{
+
+class Device;
+
+
+/// @brief Sub-allocates buffers and images from a few large blocks of device memory
+/// There is a pool of blocks for each memory type, and linear resources, like buffers, never share
+/// a block with optimal images, so that bufferImageGranularity is always respected.
+/// Host visible blocks stay mapped, since the same memory can not be mapped twice at the same time.
+class DeviceAllocator
+{
+  public:
+	/// @brief Memory of a heap
+	struct HeapStats
+	{
+		/// Bytes of device memory allocated from the heap
+		VkDeviceSize allocated = 0;
+
+		/// Bytes bound to resources
+		VkDeviceSize used = 0;
+
+		uint32_t block_count = 0;
+		uint32_t dedicated_count = 0;
+	};
+
+	/// @param block_size Size of each block of device memory
+	DeviceAllocator( const Device& device, VkDeviceSize block_size = 64 * 1024 * 1024 );
+	~DeviceAllocator();
+
+	/// @param linear Whether the resource is a buffer or a linear image, rather than an optimal image
+	/// @return A range of memory which satisfies the requirements
+	Allocation allocate( const VkMemoryRequirements& requirements, uint32_t memory_type, bool linear = true );
+
+	void free( const Allocation& allocation );
+
+	/// @return Statistics for each memory heap
+	std::vector<HeapStats> get_stats() const;
+
+	const Device& device;
+
+	VkDeviceSize block_size = 0;
+
+	/// Allocations of at least this size, like large images, get device memory of their own
+	VkDeviceSize dedicated_size = 0;
+
+  private:
+	struct Block
+	{
+		/// Null when the memory has been released as the block became empty
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		RangeAllocator ranges = { 0 };
+		uint8_t* data = nullptr;
+	};
+
+	struct Pool
+	{
+		uint32_t memory_type = 0;
+		std::vector<Block> blocks;
+	};
+
+	/// @return Device memory of a memory type, mapped when host visible
+	VkDeviceMemory allocate_memory( VkDeviceSize size, uint32_t memory_type, uint8_t** data );
+
+	/// Two pools for each memory type, the first for optimal images and the second for linear resources
+	std::vector<Pool> pools;
+
+	/// Bytes and count of dedicated allocations for each heap
+	std::vector<VkDeviceSize> dedicated_bytes;
+	std::vector<uint32_t> dedicated_counts;
+
+	mutable std::mutex mutex;
+};
+
+
+} // namespace spot::gfx
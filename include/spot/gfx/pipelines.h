@@ -18,11 +18,17 @@ struct Primitive;
 class PipelineLayout
 {
   public:
-	PipelineLayout( Device& d, const std::vector<VkDescriptorSetLayoutBinding>& bindings );
+	/// @param set_bindings Bindings of each descriptor set, in set order
+	/// @param push_constant_ranges Ranges of push constants used by the shaders
+	PipelineLayout( Device& d,
+		const std::vector<std::vector<VkDescriptorSetLayoutBinding>>& set_bindings,
+		const std::vector<VkPushConstantRange>& push_constant_ranges = {} );
 	~PipelineLayout();
 
 	Device& device;
-	DescriptorSetLayout descriptor_set_layout;
+
+	/// One layout for each descriptor set
+	std::vector<DescriptorSetLayout> descriptor_set_layouts;
 
 	VkPipelineLayout handle = VK_NULL_HANDLE;
 };
@@ -13,17 +13,34 @@ class Png
 {
   public:
 	/// @brief Loads a png from file
+	/// Errors of libpng, here and while loading, are thrown as std::runtime_error
 	Png( const std::string& path );
 
-	/// @brief Loads a png from memory consuming that memory
-	Png( std::vector<uint8_t>& mem );
+	/// @brief Loads a png from memory, which is only read and should outlive the png
+	/// @param data Encoded png, not copied
+	/// @param size Size of the encoded png in bytes
+	Png( const uint8_t* data, size_t size );
+
+	/// @brief Loads a png from memory, which is only read and should outlive the png
+	Png( const std::vector<uint8_t>& mem );
 
 	~Png();
 
 	void print_info();
 
+	/// @brief Adds channels or strips 16 bit channels to 8 bits, when the device cannot sample the native layout
+	/// Gray becomes RGB with 3 or 4 channels, and alpha is opaque when added. Call it before loading.
+	/// @param channels Target number of channels, not lower than the current one
+	/// @param bit_depth Target bits per channel, 8 or the current one
+	void convert( png_byte channels, int bit_depth );
+
+	/// @return Bytes of a decoded texel
+	size_t get_texel_size() const;
+
+	/// @return Bytes of the decoded image
 	size_t get_size() const;
 
+	/// @brief Decodes rows straight into the destination, which should be get_size() bytes
 	void load( png_byte* bytes );
 
 	png_struct* png = nullptr;
@@ -32,9 +49,20 @@ class Png
 
 	FILE* file = nullptr;
 
+	/// @brief Encoded png in memory and read cursor, as libpng reads it sequentially
+	struct Source
+	{
+		const uint8_t* data = nullptr;
+		size_t size = 0;
+		size_t cursor = 0;
+	};
+
+	Source source = {};
+
 	uint32_t width;
 	uint32_t height;
 
+	/// Bit depth and color type of decoded rows, which keep their native channels unless converted
 	int bit_depth;
 	int color_type;
 	int interlace_type;
@@ -44,6 +72,13 @@ class Png
 	png_byte channels;
 
 	std::vector<png_byte*> rows;
+
+  private:
+	/// @brief Reads the header and sets up expansion of palettes, low bit depths, and transparency
+	void read_info();
+
+	/// @brief Destroys libpng structs and closes the file
+	void destroy();
 };
 
 } // namespace spot::gfx
@@ -21,111 +21,186 @@ struct Material;
 class Device;
 class Swapchain;
 class Graphics;
+class CommandBuffer;
+struct DrawPacket;
 
 
-/// @todo Is this not used anymore?
-struct DynamicResources
+/// @brief A few large vertex and index buffers shared by every primitive
+/// Each primitive gets a range of vertices and a range of indices within a block,
+/// and it is drawn through its vertex offset and first index, so buffers are rarely rebound.
+/// Blocks live in device local memory, filled through staging copies unless the CPU can map them.
+class GeometryArena
 {
-	DynamicResources( Device& d, Swapchain& s, GraphicsPipeline& pl );
+  public:
+	/// @brief Vertex and index buffers sub-allocated through free lists
+	struct Block
+	{
+		Block( const Device& device, uint32_t vertex_capacity, uint32_t index_capacity );
 
-	// Vertices and indices do not change, hence one is enough
-	DynamicBuffer vertex_buffer;
-	DynamicBuffer index_buffer;
+		Buffer vertex_buffer;
+		Buffer index_buffer;
 
-	// Uniform buffer for each swapchain image
-	std::vector<Buffer> uniform_buffers;
+		RangeAllocator vertex_ranges;
+		RangeAllocator index_ranges;
 
-	uint64_t pipeline = 0;
-	/// Descriptor pool for descriptor sets
-	DescriptorPool descriptor_pool;
-	// Descriptor sets for each swapchain image
-	std::vector<VkDescriptorSet> descriptor_sets;
+		/// Persistently mapped memory of the buffers, or null when they are filled through staging copies
+		Vertex* vertices = nullptr;
+		Index* indices = nullptr;
+	};
+
+	/// @brief Vertices and indices of a primitive within a block
+	struct Range
+	{
+		uint32_t block = 0;
+		uint32_t vertex_offset = 0;
+		uint32_t vertex_count = 0;
+		uint32_t first_index = 0;
+		uint32_t index_count = 0;
+	};
+
+	/// @brief Usage of the arena, in vertices and indices
+	struct Stats
+	{
+		uint32_t block_count = 0;
+
+		uint32_t used_vertices = 0;
+		uint32_t free_vertices = 0;
+		uint32_t used_indices = 0;
+		uint32_t free_indices = 0;
+
+		/// 0 when free space of each block is contiguous, close to 1 when it is scattered among small ranges
+		float vertex_fragmentation = 0.0f;
+		float index_fragmentation = 0.0f;
+	};
+
+	/// @param frame_count Number of frames in flight
+	/// @param vertex_capacity Number of vertices of each block
+	/// @param index_capacity Number of indices of each block
+	GeometryArena( const Device& device, uint32_t frame_count, uint32_t vertex_capacity = 256 * 1024, uint32_t index_capacity = 1024 * 1024 );
+
+	/// @brief Copies vertices and indices of a primitive into the first block with room for them,
+	/// creating a new block when none has
+	Range allocate( const Primitive& primitive );
+
+	/// @brief Makes a range available again, which no frame in flight should read any longer
+	void free( const Range& range );
 
+	Stats get_stats() const;
+
+	/// @brief Records copies of staged geometry into its blocks, outside of a render pass
+	/// @param frame_index Staging memory is kept until the GPU is done with this frame
+	void flush( CommandBuffer& command_buffer, uint32_t frame_index );
+
+	/// @brief Releases staging memory of a frame which the GPU is done with
+	void release_staging( uint32_t frame_index );
+
+	const Device& device;
+
+	uint32_t vertex_capacity = 0;
+	uint32_t index_capacity = 0;
+
+	std::vector<Block> blocks;
+
+  private:
+	/// @brief Copy of a primitive from a staging buffer into a block
+	struct StagedCopy
+	{
+		uint32_t staging = 0;
+		uint32_t block = 0;
+		VkBufferCopy vertices = {};
+		VkBufferCopy indices = {};
+	};
+
+	/// Staging memory of the upload manager waiting to be copied
+	std::vector<Staging> staging;
+	std::vector<StagedCopy> staged_copies;
+
+	/// Staging memory copied by each frame in flight
+	std::vector<std::vector<Staging>> staging_in_flight;
 };
 
 
 /// @brief Vulkan resources for Primitives.
-/// Multiple primitives that are actually equal could use the same vertex and index buffer
+/// Multiple primitives that are actually equal could use the same range of the geometry arena
 /// Those primitives may have different materials and belong to different nodes with different transforms
-/// That is why mvp-bo and material-bo are stored in their own resource set
+/// That is why their uniform data is written per draw into the frame uniform allocator
 struct PrimitiveResources
 {
-	PrimitiveResources( const Device& device, const Primitive& pm );
+	/// @brief Copies vertices and indices of the primitive into the arena
+	PrimitiveResources( GeometryArena& arena, const Primitive& pm );
+
+	/// @brief Releases the range of the primitive
+	~PrimitiveResources();
+
+	PrimitiveResources( PrimitiveResources&& o );
+	PrimitiveResources& operator=( PrimitiveResources&& o );
+
+	GeometryArena* arena = nullptr;
+	GeometryArena::Range range = {};
 
-	Buffer vertex_buffer;
-	Buffer index_buffer;
+	/// Number of the last frame which drew these resources
+	uint64_t last_frame = 0;
 };
 
 
-struct DescriptorResources
+/// @brief Material descriptor sets for a texture, shared by every material sampling it
+struct TextureResources
 {
-	DescriptorResources(
-		const Renderer& renderer,
-		const GraphicsPipeline& gp,
-		const Handle<Node>& node,
-		const Handle<Material>& material = {} );
+	TextureResources( const Renderer& renderer, VkImageView view );
 
-	uint64_t pipeline;
-
-	/// Descriptor pool for descriptor sets
+	/// Descriptor pool for the texture descriptor sets
 	DescriptorPool descriptor_pool;
 
-	// Descriptor sets for each swapchain image
+	/// Material descriptor sets for each swapchain image
 	std::vector<VkDescriptorSet> descriptor_sets;
 };
 
 
-/// @brief Rendering resources for Nodes
-struct NodeResources
+/// @brief Consecutive draws sharing pipeline, material set, and geometry block, issued with a single indirect draw
+struct IndirectBatch
 {
-	NodeResources( const Swapchain& swapchain );
+	GraphicsPipeline* pipeline = nullptr;
 
-	/// MVP uniform buffer objects for each swapchain images
-	std::vector<Buffer> ubos;
-};
+	/// Index of the geometry block within the arena
+	uint32_t block = 0;
 
+	/// Material set of textured and untextured meshes, or null for lines
+	VkDescriptorSet material_set = VK_NULL_HANDLE;
+	float line_width = 1.0f;
 
-/// @brief Rendering resources for Materials
-struct MaterialResources
-{
-	MaterialResources( const Swapchain& swapchain );
+	/// Offset of the first draw command within the frame uniform allocator
+	uint32_t offset = 0;
+	uint32_t draw_count = 0;
 
-	/// Material uniform buffer objects for each swapchain image
-	std::vector<Buffer> ubos;
-
-	/// A sampler for the diffuse texture
-	Sampler sampler;
+	/// Dynamic offsets of the instance and material arrays read by these commands
+	uint32_t instances_offset = 0;
+	uint32_t materials_offset = 0;
 };
 
 
-/// @brief Rendering resources for Ambient light
-struct AmbientResources
-{
-	AmbientResources( const Swapchain& swapchain );
+/// @return The pipeline to use for this material
+uint64_t select_pipeline( const Handle<Material>& material );
 
-	/// Ambient uniform buffer objects for each swapchain image
-	std::vector<Buffer> ubos;
-};
 
+/// Number of instances of an instance array, while a frame may draw more through more arrays
+constexpr uint32_t max_instances = 16384;
 
-/// @brief Rendering resources for lights
-struct LightResources
-{
-	LightResources( const Swapchain& swapchain );
+/// Number of materials of a material array, while a frame may draw more through more arrays
+constexpr uint32_t max_materials = 8192;
 
-	/// Ambient uniform buffer objects for each swapchain image
-	std::vector<Buffer> ubos;
-};
+/// @return Size of the instance array bound to the object set
+VkDeviceSize get_instances_size();
+
+/// @return Size of the material array bound to the material set
+VkDeviceSize get_materials_size();
 
 
-/// @todo Resource cache should be improved in this way:
-/// 1. A resource cache for primitives
-/// 2. A resource cache for mvp-bos
-/// 3. A resource cache for mat-bos
-/// Then, a descriptor set cache will use as indices an hash combine of
-/// both the nodei (for the mvp-bo) and the materiali (for the mat-bo)
-/// Note: An helper method can be created to get a descriptor pool from
-///       a pipeline layout, so the pipeline layout will store these pools.
+/// @brief Uniform data goes through dynamic offsets into the frame uniform allocator.
+/// Descriptor sets are split by update frequency:
+/// - set 0 for frame data: view, ambient and light
+/// - set 1 for material data: array of pbr parameters of the frame, and texture
+/// - set 2 for object data: array of instance data of the frame
+/// Apart from textured materials, one set of each kind for each frame is enough.
 class Renderer
 {
   public:
@@ -134,37 +209,88 @@ class Renderer
 	void recreate_pipelines();
 
 	void add( const Handle<Node>& node );
-	void add( const Handle<Node>& node, const Primitive& prim );
-
-	std::unordered_map<size_t, DescriptorResources>::iterator add_descriptors( const Handle<Node>& node, const Handle<Material>& material );
+	void add( const Primitive& prim );
+
+	/// @brief Advances the frame number, and releases primitive resources
+	/// which were not drawn in the last release_frames frames
+	/// @param frame_index Index of a frame the GPU is done with
+	void begin_frame( uint32_t frame_index );
+
+	std::unordered_map<VkImageView, TextureResources>::iterator add_texture( VkImageView view );
+
+	/// @brief Destroys descriptor sets of a texture, which no frame in flight should use any longer
+	void remove_texture( VkImageView view );
+
+	/// @return The material set of a frame for this material, created if it has a texture not seen before
+	VkDescriptorSet get_material_set( const Handle<Material>& material, uint32_t frame_index );
+
+	/// @brief Points descriptor sets of a frame to its uniform buffer again, if it has grown
+	/// Call it once the frame has allocated its uniform data, before binding any of those sets
+	void update_uniform_sets( uint32_t frame_index );
+
+	/// @brief Writes indirect draw commands for sorted packets in [begin, end) into the frame uniform allocator,
+	/// merging packets which can be drawn as instances of a single command, and appends their batches
+	/// @param packets Sorted packets, each one with its instance data at its index from begin in the instance array
+	/// @param instances_offset Dynamic offset of the instance array of these packets
+	/// @param materials_offset Dynamic offset of the material array of these packets
+	/// @return Batches of consecutive commands sharing pipeline, material set, and arrays
+	const std::vector<IndirectBatch>& build_indirect_batches(
+		const std::vector<const DrawPacket*>& packets,
+		uint32_t begin,
+		uint32_t end,
+		uint32_t instances_offset,
+		uint32_t materials_offset,
+		uint32_t frame_index );
 
 	Graphics& gfx;
 
 	/// @brief Collection of pipelines
 	std::vector<GraphicsPipeline> pipelines;
 
-	/// @brief The key is a hash value of the primitive
+	/// @brief Vertices and indices of every primitive
+	GeometryArena geometry;
+
+	/// @brief The key is the content hash of the primitive geometry
 	/// Meshes with the same primitive will use the same resources
 	std::unordered_map<size_t, PrimitiveResources> primitive_resources;
 
-	/// @brief Key is material handle, value is ubos for material
-	std::unordered_map<Handle<Material>, MaterialResources> material_resources;
+	/// @brief Uniform data for each swapchain image, written while recording
+	/// and bound through dynamic offsets
+	std::vector<UniformAllocator> uniform_allocators;
+
+	/// @brief Descriptor pool for frame, material and object sets
+	DescriptorPool uniform_pool;
 
-	/// @brief Key is node handle, value is ubos for frames
-	std::unordered_map<Handle<Node>, NodeResources> node_resources;
+	/// @brief Frame descriptor sets for each swapchain image
+	std::vector<VkDescriptorSet> frame_sets;
 
-	/// @brief Key is hash of node and material
-	/// Value is descriptor sets for this node and material
-	std::unordered_map<size_t, DescriptorResources> descriptor_resources;
+	/// @brief Material descriptor sets without texture for each swapchain image
+	std::vector<VkDescriptorSet> material_sets;
 
-	AmbientResources ambient_resources;
+	/// @brief Object descriptor sets for each swapchain image
+	std::vector<VkDescriptorSet> object_sets;
+
+	/// @brief A sampler shared by every texture
+	Sampler sampler;
 
-	/// @brief Key is hash of node and light
-	/// The same light may be attached to multiple nodes
-	/// Value is ubos for frames
-	std::unordered_map<size_t, LightResources> light_resources;
+	/// @brief Key is the image view of the texture
+	/// Value is material descriptor sets with that texture
+	std::unordered_map<VkImageView, TextureResources> texture_resources;
+
+	/// @brief Indirect batches of the current frame
+	std::vector<IndirectBatch> indirect_batches;
+
+	/// @brief Number of the current frame
+	uint64_t frame_number = 0;
+
+	/// @brief Frames without draws after which primitive resources are released
+	/// This also covers geometry of primitives marked as dirty, which is found with a new hash
+	uint32_t release_frames = 120;
 
   private:
+	/// @brief Writes frame, material, and object sets of a frame, and its textured material sets
+	void write_uniform_sets( uint32_t frame_index );
+
 	/// @return Find the line pipeline with a specific width
 	uint64_t find_pipeline( float line_width );
 };
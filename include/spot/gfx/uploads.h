@@ -0,0 +1,235 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <vulkan/vulkan_core.h>
+
+#include "spot/gfx/buffers.h"
+#include "spot/gfx/commands.h"
+
+
+namespace spot::gfx
+{
+
+class Device;
+class Queue;
+class Image;
+
+
+/// @brief Identifies an upload, tickets grow monotonically in submission order
+using UploadTicket = uint64_t;
+
+
+/// @brief Persistently mapped buffer whose space is reserved in order, wrapping around at the end
+/// Reservations may be released in any order, but space is recycled only up to the oldest one still in use.
+class StagingRing
+{
+  public:
+	/// @brief Space reserved within the ring
+	struct Region
+	{
+		/// Identifies the reservation when releasing it
+		uint64_t id = 0;
+
+		/// Offset within the buffer, or invalid when there was no room
+		VkDeviceSize offset = 0;
+	};
+
+	/// @param capacity Size of the buffer in bytes
+	StagingRing( const Device& device, VkDeviceSize capacity );
+
+	/// @param alignment Offset of the region is a multiple of it, which needs not be a power of two
+	/// @return A region of the requested size, with an invalid offset when there is no room
+	Region reserve( VkDeviceSize size, VkDeviceSize alignment );
+
+	/// @brief Marks a region as no longer read by the GPU
+	void release( uint64_t id );
+
+	/// @return Number of bytes between the oldest reservation still in use and the newest one
+	VkDeviceSize get_used_size() const;
+
+	static constexpr VkDeviceSize invalid = ~VkDeviceSize( 0 );
+
+	Buffer buffer;
+	VkDeviceSize capacity = 0;
+
+	/// Mapped memory of the buffer
+	uint8_t* data = nullptr;
+
+  private:
+	struct Reservation
+	{
+		VkDeviceSize begin = 0;
+		VkDeviceSize end = 0;
+		bool released = false;
+	};
+
+	/// Reservations in the order they were made
+	std::deque<Reservation> reservations;
+
+	/// Id of the oldest reservation
+	uint64_t first_id = 0;
+
+	/// End of the newest reservation
+	VkDeviceSize head = 0;
+};
+
+
+/// @brief What to do when the staging ring has no room for a reservation
+enum class StagingPolicy
+{
+	/// Wait for submitted uploads to complete, spilling only when none of them would make room
+	BLOCK,
+
+	/// Create a staging buffer of its own right away
+	SPILL,
+};
+
+
+/// @brief Host visible memory where the CPU writes data before it is copied into device local memory
+struct Staging
+{
+	/// Mapped memory of the region
+	uint8_t* data = nullptr;
+	VkDeviceSize size = 0;
+
+	/// Source buffer and offset of the copy
+	const Buffer* buffer = nullptr;
+	VkDeviceSize offset = 0;
+
+	/// Reservation within the staging ring, unless spilled
+	uint64_t reservation = 0;
+
+	/// Buffer of its own when the ring had no room
+	std::unique_ptr<Buffer> spill;
+};
+
+
+/// @brief Records uploads of buffers and images into a single command buffer for the transfer queue
+/// When the device exposes a transfer-only family, ownership of each resource is released by the transfer
+/// queue and acquired by the graphics queue in poll(). The acquire is recorded only once the fence of the
+/// transfer batch has signaled, therefore no semaphore is needed between the two queues.
+/// Staging data of every upload is written into a shared ring, recycled as transfers complete.
+class UploadManager
+{
+  public:
+	/// @brief Staging counters, to tell whether the ring is large enough
+	struct Stats
+	{
+		/// Reservations which waited for transfers to complete
+		uint64_t stall_count = 0;
+
+		/// Reservations which got a buffer of their own
+		uint64_t spill_count = 0;
+
+		VkDeviceSize staging_used = 0;
+		VkDeviceSize staging_capacity = 0;
+	};
+
+	/// @param staging_capacity Size of the staging ring in bytes
+	UploadManager( Device& device, VkDeviceSize staging_capacity = 32 * 1024 * 1024 );
+	~UploadManager();
+
+	/// @brief Reserves staging memory to be written before uploading it, following the staging policy when the ring is full
+	/// @param alignment Offset of the staging memory is a multiple of it, like the texel size of an image
+	Staging reserve( VkDeviceSize size, VkDeviceSize alignment = 16 );
+
+	/// @brief Makes staging memory available again, for staging copied by other command buffers
+	/// Call it only once the GPU is done with the copy
+	void release( Staging& staging );
+
+	/// @brief Copies data into a region of a device local buffer
+	/// @return Ticket of the upload
+	UploadTicket upload( const Buffer& dst, VkDeviceSize offset, const uint8_t* data, VkDeviceSize size );
+
+	/// @brief Copies staging memory into a region of a device local buffer
+	/// @param staging Released once the copy completes
+	UploadTicket upload( Staging&& staging, const Buffer& dst, VkDeviceSize offset );
+
+	/// @brief Copies staging memory into an image
+	/// The image layout becomes shader read only once the upload completes
+	/// @param staging Every level of the image packed as by Image::get_level_offsets(), or only the first one
+	/// when generating mipmaps
+	/// @param image Should stay alive until the upload completes
+	/// @param generate_mipmaps Whether levels are blitted from the first one, on the graphics queue
+	UploadTicket upload( Staging&& staging, Image& image, bool generate_mipmaps = false );
+
+	/// @brief Submits recorded uploads to the transfer queue
+	void flush();
+
+	/// @brief Flushes pending uploads and retires the batches which completed
+	/// Called at the beginning of a frame, as it records acquire barriers into the graphics command buffer
+	/// @param cmd Graphics command buffer being recorded, outside of a render pass
+	void poll( CommandBuffer& cmd );
+
+	/// @return Whether the upload has completed and its resource is owned by the graphics queue
+	bool is_complete( UploadTicket ticket ) const;
+
+	/// @brief Blocks until the upload has completed and its resource is owned by the graphics queue
+	/// Acquire barriers are submitted to the graphics queue right away, instead of waiting for poll().
+	/// Call it from the thread submitting to the graphics queue.
+	void wait( UploadTicket ticket );
+
+	Stats get_stats() const;
+
+	Device& device;
+
+	/// Queue where uploads are submitted, the graphics queue when there is no dedicated transfer family
+	Queue& queue;
+
+	/// Family of the queue which consumes uploaded resources
+	uint32_t graphics_family = 0;
+
+	StagingPolicy policy = StagingPolicy::BLOCK;
+
+  private:
+	struct Batch;
+
+	/// @return The batch being recorded, beginning a new one when needed
+	Batch& get_recording();
+
+	/// @return Whether resources should change ownership from the transfer to the graphics family
+	bool transfers_ownership() const;
+
+	void flush_locked();
+
+	void release_locked( Staging& staging );
+
+	/// @brief Releases staging memory of a batch which the transfer queue is done with
+	void release_staging( Batch& batch );
+
+	/// @brief Records the acquires of the oldest submitted batch, which should have completed, and recycles it
+	void retire_front( CommandBuffer& cmd );
+
+	CommandPool command_pool;
+
+	/// Pool of command buffers recording acquires outside of poll()
+	CommandPool graphics_pool;
+
+	/// Command buffer and fence of the acquires submitted by wait(), reused by every call
+	std::unique_ptr<Batch> acquires;
+
+	StagingRing ring;
+
+	std::unique_ptr<Batch> recording;
+
+	/// Submitted batches in submission order
+	std::deque<std::unique_ptr<Batch>> in_flight;
+
+	/// Completed batches, ready to be recorded again
+	std::vector<std::unique_ptr<Batch>> free_batches;
+
+	UploadTicket next_ticket = 1;
+	UploadTicket completed = 0;
+
+	uint64_t stall_count = 0;
+	uint64_t spill_count = 0;
+
+	mutable std::mutex mutex;
+};
+
+
+} // namespace spot::gfx
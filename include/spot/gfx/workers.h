@@ -0,0 +1,50 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace spot::gfx
+{
+
+
+/// @brief Threads running tasks in the order they were pushed
+/// Tasks still queued when the pool is destroyed are dropped, while running ones complete.
+class WorkerPool
+{
+  public:
+	/// @param count Number of threads, or 0 for one less than the hardware threads
+	WorkerPool( uint32_t count = 0 );
+	~WorkerPool();
+
+	/// @brief Queues a task to be run by the first idle thread
+	void push( std::function<void()> task );
+
+	/// @brief Runs a function for every index, on idle threads and on the calling one
+	/// Indices are claimed one at a time, so the call completes even when every thread is busy.
+	/// When the function throws, indices not started yet are skipped and the first exception
+	/// is rethrown here, once no thread runs the function any longer
+	/// @return Once the function has run for every index
+	void parallel_for( size_t count, std::function<void( size_t )> function );
+
+	/// @return Number of worker threads
+	uint32_t size() const { return threads.size(); }
+
+  private:
+	/// @brief Runs tasks until the pool is stopping
+	void work();
+
+	std::vector<std::thread> threads;
+
+	std::deque<std::function<void()>> tasks;
+	std::mutex mutex;
+	std::condition_variable condition;
+	bool stopping = false;
+};
+
+
+} // namespace spot::gfx
@@ -1,5 +1,11 @@
 #pragma once
 
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
 #include "spot/gltf/buffer.h"
 
 namespace spot::gfx
@@ -35,6 +41,9 @@ struct Accessor
 	/// @return The size of the data pointed by this accessor
 	size_t get_size() const;
 
+	/// @return Bytes of an element, where each column of a byte or short matrix is padded to 4 bytes
+	size_t get_element_size() const;
+
 	/// @return The address of the data pointed by this accessor
 	const uint8_t* get_data() const;
 
@@ -53,6 +62,9 @@ struct Accessor
 	/// Datatype of components in the attribute
 	ComponentType component_type;
 
+	/// Whether integer components are normalized into [0, 1] or [-1, 1]
+	bool normalized = false;
+
 	/// Number of attributes referenced by this accessor
 	size_t count;
 
@@ -67,4 +79,310 @@ struct Accessor
 };
 
 
+/// @return Size in bytes of a component
+size_t size_of( Accessor::ComponentType ct );
+
+/// @return Number of components of an element
+size_t size_of( Accessor::Type tp );
+
+/// @return Number of rows of a matrix, or components of a scalar or vector, stored contiguously
+size_t rows_of( Accessor::Type tp );
+
+/// @return Bytes between columns of an element, which are aligned to 4 bytes for matrices
+size_t column_stride_of( Accessor::ComponentType ct, Accessor::Type tp );
+
+
+/// @brief Widens tightly packed indices, with SSE2 or NEON where available
+void widen( const uint8_t* src, size_t count, uint32_t* dst );
+
+/// @brief Widens tightly packed indices, with SSE2 or NEON where available
+void widen( const uint16_t* src, size_t count, uint32_t* dst );
+
+/// @brief Converts normalized unsigned components into [0, 1], with SSE2 or NEON where available
+/// @param src_stride Bytes between source elements, which may be interleaved with other attributes
+/// @param components Components of each element, at most four
+/// @param dst_stride Bytes between destination elements
+void normalize( const uint8_t* src, size_t src_stride, size_t count, size_t components, float* dst, size_t dst_stride );
+
+/// @brief Converts normalized unsigned components into [0, 1], with SSE2 or NEON where available
+void normalize( const uint16_t* src, size_t src_stride, size_t count, size_t components, float* dst, size_t dst_stride );
+
+
+/// @brief Typed, stride-aware view over the elements of an accessor
+/// Components of any type are converted to T, normalized integers into [0, 1] or [-1, 1] when T is floating point.
+/// Columns of byte and short matrices skip their padding. Accessors without a buffer view read as zeros.
+template <typename T>
+class AccessorView
+{
+  public:
+	AccessorView( const Accessor& a );
+
+	/// @return A component of an element, converted to T
+	T get( size_t element, size_t component ) const;
+
+	/// @brief Converts every element in one pass, selecting the kernel once for the whole accessor
+	/// @param dst First component of the first destination element
+	/// @param dst_stride Bytes between destination elements
+	/// @param count Components written for each element, at most the components of the accessor
+	void read( T* dst, size_t dst_stride, size_t count ) const;
+
+	const Accessor& accessor;
+
+	/// First element, or null without a buffer view
+	const uint8_t* data = nullptr;
+
+	/// Bytes between elements, which are tightly packed when the buffer view has no stride
+	size_t stride = 0;
+
+	/// Components of an element
+	size_t components = 0;
+
+	/// Components of a column, and bytes between columns, which differ from a tight layout for padded matrices
+	size_t rows = 0;
+	size_t column_stride = 0;
+
+  private:
+	/// @return Byte offset of a component within an element
+	size_t get_offset( size_t component ) const;
+
+	/// @return A component converted to T
+	template <typename C>
+	T convert( C value ) const;
+
+	/// @return A component of type C read from unaligned memory, converted to T
+	template <typename C>
+	T load( const uint8_t* src ) const;
+
+	/// @brief Converts every element with components of type C
+	template <typename C>
+	void read_as( T* dst, size_t dst_stride, size_t count ) const;
+
+	/// @brief Converts N components of every element, a count known at compile time so that loops unroll
+	template <typename C, size_t N>
+	void read_elements( T* dst, size_t dst_stride ) const;
+};
+
+
+template <typename T>
+AccessorView<T>::AccessorView( const Accessor& a )
+: accessor { a }
+, components { size_of( a.type ) }
+, rows { rows_of( a.type ) }
+, column_stride { column_stride_of( a.component_type, a.type ) }
+{
+	if ( accessor.buffer_view )
+	{
+		data = accessor.get_data();
+		stride = accessor.get_stride();
+	}
+
+	if ( stride == 0 )
+	{
+		stride = accessor.get_element_size();
+	}
+}
+
+
+template <typename T>
+size_t AccessorView<T>::get_offset( const size_t component ) const
+{
+	return ( component / rows ) * column_stride + ( component % rows ) * size_of( accessor.component_type );
+}
+
+
+template <typename T>
+template <typename C>
+T AccessorView<T>::convert( const C value ) const
+{
+	if constexpr ( std::is_floating_point_v<T> && std::is_integral_v<C> )
+	{
+		if ( accessor.normalized )
+		{
+			// Both the minimum and the one above it map to -1 for signed components
+			return std::max( T( value ) / T( std::numeric_limits<C>::max() ), T( -1 ) );
+		}
+	}
+
+	return T( value );
+}
+
+
+template <typename T>
+template <typename C>
+T AccessorView<T>::load( const uint8_t* src ) const
+{
+	C value;
+	std::memcpy( &value, src, sizeof( C ) );
+	return convert( value );
+}
+
+
+template <typename T>
+template <typename C>
+void AccessorView<T>::read_as( T* dst, const size_t dst_stride, const size_t count ) const
+{
+	auto out = reinterpret_cast<uint8_t*>( dst );
+
+	if ( !data )
+	{
+		for ( size_t i = 0; i < accessor.count; ++i, out += dst_stride )
+		{
+			std::fill_n( reinterpret_cast<T*>( out ), count, T( 0 ) );
+		}
+		return;
+	}
+
+	if ( column_stride != rows * sizeof( C ) )
+	{
+		// Padded matrices are read one component at a time
+		auto src = data;
+		for ( size_t i = 0; i < accessor.count; ++i, src += stride, out += dst_stride )
+		{
+			for ( size_t c = 0; c < count; ++c )
+			{
+				reinterpret_cast<T*>( out )[c] = load<C>( src + get_offset( c ) );
+			}
+		}
+		return;
+	}
+
+	if constexpr ( std::is_same_v<T, uint32_t> && ( std::is_same_v<C, uint16_t> || std::is_same_v<C, uint8_t> ) )
+	{
+		if ( count == 1 && stride == sizeof( C ) && dst_stride == sizeof( T ) )
+		{
+			// Tightly packed indices
+			return widen( reinterpret_cast<const C*>( data ), accessor.count, dst );
+		}
+	}
+
+	if constexpr ( std::is_same_v<T, float> && ( std::is_same_v<C, uint16_t> || std::is_same_v<C, uint8_t> ) )
+	{
+		if ( accessor.normalized && count <= 4 )
+		{
+			// Colors and texture coordinates
+			return normalize( reinterpret_cast<const C*>( data ), stride, accessor.count, count, dst, dst_stride );
+		}
+	}
+
+	if constexpr ( std::is_same_v<C, T> )
+	{
+		if ( stride == count * sizeof( T ) && dst_stride == stride )
+		{
+			// Tightly packed on both sides
+			std::memcpy( dst, data, accessor.count * stride );
+			return;
+		}
+	}
+
+	switch ( count )
+	{
+	case 1: return read_elements<C, 1>( dst, dst_stride );
+	case 2: return read_elements<C, 2>( dst, dst_stride );
+	case 3: return read_elements<C, 3>( dst, dst_stride );
+	case 4: return read_elements<C, 4>( dst, dst_stride );
+	default: break;
+	}
+
+	// Matrices without padding
+	auto src = data;
+	for ( size_t i = 0; i < accessor.count; ++i, src += stride, out += dst_stride )
+	{
+		C values[16];
+		std::memcpy( values, src, count * sizeof( C ) );
+		for ( size_t c = 0; c < count; ++c )
+		{
+			reinterpret_cast<T*>( out )[c] = convert( values[c] );
+		}
+	}
+}
+
+
+template <typename T>
+template <typename C, size_t N>
+void AccessorView<T>::read_elements( T* dst, const size_t dst_stride ) const
+{
+	auto src = data;
+	auto out = reinterpret_cast<uint8_t*>( dst );
+
+	if constexpr ( std::is_floating_point_v<T> && std::is_integral_v<C> )
+	{
+		if ( accessor.normalized )
+		{
+			// Checked once for the whole accessor, so the loop below is free of branches
+			constexpr auto max = T( std::numeric_limits<C>::max() );
+			for ( size_t i = 0; i < accessor.count; ++i, src += stride, out += dst_stride )
+			{
+				C values[N];
+				std::memcpy( values, src, sizeof( values ) );
+				T converted[N];
+				for ( size_t c = 0; c < N; ++c )
+				{
+					converted[c] = std::max( T( values[c] ) / max, T( -1 ) );
+				}
+				std::memcpy( out, converted, sizeof( converted ) );
+			}
+			return;
+		}
+	}
+
+	for ( size_t i = 0; i < accessor.count; ++i, src += stride, out += dst_stride )
+	{
+		// Fixed size copies compile into plain moves
+		C values[N];
+		std::memcpy( values, src, sizeof( values ) );
+		T converted[N];
+		for ( size_t c = 0; c < N; ++c )
+		{
+			converted[c] = T( values[c] );
+		}
+		std::memcpy( out, converted, sizeof( converted ) );
+	}
+}
+
+
+template <typename T>
+void AccessorView<T>::read( T* dst, const size_t dst_stride, const size_t count ) const
+{
+	assert( count <= components && "Cannot read more components than an element has" );
+
+	switch ( accessor.component_type )
+	{
+	case Accessor::ComponentType::BYTE: return read_as<int8_t>( dst, dst_stride, count );
+	case Accessor::ComponentType::UNSIGNED_BYTE: return read_as<uint8_t>( dst, dst_stride, count );
+	case Accessor::ComponentType::SHORT: return read_as<int16_t>( dst, dst_stride, count );
+	case Accessor::ComponentType::UNSIGNED_SHORT: return read_as<uint16_t>( dst, dst_stride, count );
+	case Accessor::ComponentType::UNSIGNED_INT: return read_as<uint32_t>( dst, dst_stride, count );
+	case Accessor::ComponentType::FLOAT: return read_as<float>( dst, dst_stride, count );
+	default: assert( false && "Invalid accessor component type" );
+	}
+}
+
+
+template <typename T>
+T AccessorView<T>::get( const size_t element, const size_t component ) const
+{
+	assert( element < accessor.count && component < components && "Accessor element out of bounds" );
+
+	if ( !data )
+	{
+		return T( 0 );
+	}
+
+	auto src = data + element * stride + get_offset( component );
+
+	switch ( accessor.component_type )
+	{
+	case Accessor::ComponentType::BYTE: return load<int8_t>( src );
+	case Accessor::ComponentType::UNSIGNED_BYTE: return load<uint8_t>( src );
+	case Accessor::ComponentType::SHORT: return load<int16_t>( src );
+	case Accessor::ComponentType::UNSIGNED_SHORT: return load<uint16_t>( src );
+	case Accessor::ComponentType::UNSIGNED_INT: return load<uint32_t>( src );
+	case Accessor::ComponentType::FLOAT: return load<float>( src );
+	default: assert( false && "Invalid accessor component type" );
+	}
+
+	return T( 0 );
+}
+
+
 } // namespace spot::gfx
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -10,13 +11,65 @@ namespace spot::gfx
 {
 
 
+/// @brief How base64 is decoded, which only matters for measuring the vector instructions
+enum class Base64Decoder
+{
+	/// Only the table lookup of one character at a time
+	SCALAR,
+
+	/// Vector instructions selected for the running CPU, if any, followed by the table lookup
+	SIMD,
+};
+
+
+/// @brief Decodes base64 four characters into three bytes at a time,
+/// with SSSE3 or AVX2 selected at runtime on x86-64, and NEON on AArch64
+/// Padding is only allowed at the end, and any other character outside of the alphabet is an error
+/// @return Decoded bytes, written into an output sized upfront
+std::vector<char> base64_decode( const char* encoded, size_t size, Base64Decoder decoder = Base64Decoder::SIMD );
+
+/// @return Name of the vector instructions used by base64_decode on the running CPU, or "none"
+const char* get_base64_simd_name();
+
+
+/// Read-only memory mapping of a whole file, shared by the buffers viewing it
+class MappedFile
+{
+  public:
+	/// @param path File to map, which pages are read on first access
+	/// Throws std::runtime_error when the file cannot be opened, queried, or mapped
+	MappedFile( const std::string& path );
+	~MappedFile();
+
+	MappedFile( const MappedFile& ) = delete;
+	MappedFile& operator=( const MappedFile& ) = delete;
+
+	/// Mapped content of the file
+	const char* data = nullptr;
+
+	/// Size of the file in bytes
+	size_t size = 0;
+};
+
+
 /// Buffer pointing to binary geometry, animation, or skins
 struct ByteBuffer : public Handled<ByteBuffer>
 {
 	ByteBuffer() = default;
 
+	/// @brief Decodes a data uri, or maps the file of any other uri without copying it
 	ByteBuffer( std::string uri, size_t byte_length );
 
+	/// @brief Decodes the data uri, or maps the file of any other uri
+	/// Buffers are independent, so they can be loaded concurrently
+	void load();
+
+	/// @brief Views a region of a mapped file, like the binary chunk of a .glb file
+	ByteBuffer( std::shared_ptr<MappedFile> file, size_t offset, size_t byte_length );
+
+	/// @return Bytes of the buffer, either mapped or owned
+	const char* get_data() const;
+
 	Handle<ByteBuffer> handle = {};
 
 	/// Uri of the buffer
@@ -25,8 +78,14 @@ struct ByteBuffer : public Handled<ByteBuffer>
 	/// Length of the buffer in bytes
 	size_t byte_length = 0;
 
-	/// Bytes lazily loaded
+	/// Bytes owned by the buffer, empty when it views a mapped file
 	std::vector<char> data;
+
+	/// Mapped file backing the buffer, if any
+	std::shared_ptr<MappedFile> file;
+
+	/// Bytes of the buffer within the mapped file
+	const char* view = nullptr;
 };
 
 
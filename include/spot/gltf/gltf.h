@@ -4,8 +4,6 @@
 #include <spot/math/shape.h>
 #include <nlohmann/json.hpp>
 
-#include "spot/gfx/images.h"
-
 #include "spot/gltf/buffer.h"
 #include "spot/gltf/camera.h"
 #include "spot/gltf/image.h"
@@ -22,7 +20,8 @@
 namespace spot::gfx
 {
 
-class Images;
+class Device;
+class WorkerPool;
 class Gltf;
 
 /// Root nodes of a scene
@@ -61,12 +60,15 @@ class Gltf : public Handled<Gltf>
 	friend class Node;
 	friend class Scene;
 
-	Gltf( Device& d ) : images { d } {}
+	/// Textures of a model go in the shared Graphics::textures cache, therefore the device is not kept
+	Gltf( Device& ) {}
 
-	/// Loads a GLtf model from path
+	/// Loads a GLtf model from path, either .gltf or binary .glb
+	/// The file is memory mapped, and the binary chunk of a .glb backs its buffer without copying
 	/// @param path Gltf file path
+	/// @param workers Pool loading buffers concurrently, if any
 	/// @return A Gltf model
-	Gltf( Device& d, const std::string& path );
+	Gltf( Device& d, const std::string& path, WorkerPool* workers = nullptr );
 
 	/// Constructs a Gltf object
 	/// @param j Json object describing the model
@@ -99,6 +101,33 @@ class Gltf : public Handled<Gltf>
 	/// glTF asset
 	Asset asset;
 
+	/// Parses a gltf document, initializing accessors, buffer views, and nodes while they are read
+	/// Their elements are dropped from the returned json, so it never holds the largest arrays
+	/// @param begin First character of the document
+	/// @param end One past the last character of the document
+	/// @return Json object describing the rest of the model
+	nlohmann::json parse( const char* begin, const char* end );
+
+	/// Initializes every object of the model
+	/// @param j Json object describing the model
+	/// @param path Gltf file path
+	void init( const nlohmann::json& j, const std::string& path );
+
+	/// Reserves accessors and their references
+	/// @param count Number of accessors about to be initialized
+	void reserve_accessors( size_t count );
+
+	/// Reserves buffer views and their references
+	/// @param count Number of buffer views about to be initialized
+	void reserve_buffer_views( size_t count );
+
+	/// Reserves nodes and their references
+	/// @param count Number of nodes about to be initialized
+	void reserve_nodes( size_t count );
+
+	/// Resolves references of accessors, buffer views, and nodes, once every array is initialized
+	void link();
+
 	/// Initializes asset
 	/// @param j Json object describing the asset
 	void init_asset( const nlohmann::json& j );
@@ -111,6 +140,10 @@ class Gltf : public Handled<Gltf>
 	/// @param j Json object describing the bufferViews
 	void init_buffer_views( const nlohmann::json& j );
 
+	/// Initializes a bufferView
+	/// @param v Json object describing the bufferView
+	void init_buffer_view( const nlohmann::json& v );
+
 	/// Initializes cameras
 	/// @param j Json object describing the cameras
 	void init_cameras( const nlohmann::json& j );
@@ -131,6 +164,10 @@ class Gltf : public Handled<Gltf>
 	/// @param j Json object describing the accessors
 	void init_accessors( const nlohmann::json& j );
 
+	/// Initializes an accessor
+	/// @param a Json object describing the accessor
+	void init_accessor( const nlohmann::json& a );
+
 	/// Initializes materials
 	/// @param j Json object describing the materials
 	void init_materials( const nlohmann::json& j );
@@ -147,6 +184,10 @@ class Gltf : public Handled<Gltf>
 	/// @param j Json object describing the nodes
 	void init_nodes( const nlohmann::json& j );
 
+	/// Initializes a node, leaving its references to be resolved by link()
+	/// @param n Json object describing the node
+	void init_node( const nlohmann::json& n );
+
 	/// Initializes animations
 	/// @param j Json object describing the animations
 	void init_animations( const nlohmann::json& j );
@@ -172,6 +213,18 @@ class Gltf : public Handled<Gltf>
 	/// Cache of buffers
 	std::map<const size_t, std::vector<char>> buffers_cache;
 
+	/// Pool loading buffers while constructing, null afterwards
+	WorkerPool* workers = nullptr;
+
+	/// Mapped .glb file, whose binary chunk backs the first buffer
+	std::shared_ptr<MappedFile> glb;
+
+	/// Offset of the binary chunk data within the .glb file
+	size_t glb_bin_offset = 0;
+
+	/// Length of the binary chunk data, which the first buffer cannot exceed
+	size_t glb_bin_length = 0;
+
 	/// List of buffer views
 	Uvec<BufferView> buffer_views;
 
@@ -184,9 +237,6 @@ class Gltf : public Handled<Gltf>
 	/// List of images
 	Uvec<GltfImage> gltf_images;
 
-	/// Images manager
-	Images images;
-
 	/// List of textures
 	Uvec<GltfTexture> textures;
 
@@ -205,6 +255,23 @@ class Gltf : public Handled<Gltf>
 	/// List of nodes
 	Uvec<Node> nodes;
 
+	/// Indices referenced by accessors, buffer views, and nodes, which may be read before what they reference
+	struct Links
+	{
+		std::vector<std::pair<Handle<BufferView>, size_t>> buffers;
+		std::vector<std::pair<Handle<Accessor>, size_t>> buffer_views;
+		std::vector<std::pair<Handle<Node>, size_t>> cameras;
+		std::vector<std::pair<Handle<Node>, size_t>> meshes;
+		std::vector<std::pair<Handle<Node>, size_t>> lights;
+		std::vector<std::pair<Handle<Node>, size_t>> bounds;
+
+		/// One entry for each child, in order
+		std::vector<std::pair<Handle<Node>, size_t>> children;
+	};
+
+	/// References waiting for every array to be initialized
+	Links links;
+
 	/// List of animations
 	Uvec<Animation> animations;
 
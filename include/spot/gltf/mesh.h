@@ -28,8 +28,9 @@ struct alignas(16) Vertex
 };
 
 
-/// @todo Change this, as indices can be of different sizes
-using Index = uint16_t;
+/// Indices are 32 bits, so that primitives of any size can be drawn
+/// Smaller component types of gltf are widened when converted
+using Index = uint32_t;
 
 
 /// @brief Geometry to be rendered with the given material
@@ -61,7 +62,7 @@ struct Primitive
 		TRIANGLE_FAN
 	};
 
-	Primitive() = default;
+	Primitive();
 
 	Primitive(
 		std::vector<Vertex> vertices,
@@ -69,6 +70,18 @@ struct Primitive
 		const Handle<Material>& material
 	);
 
+	/// @brief Replaces the geometry, so the next draw picks it up
+	void set_geometry( std::vector<Vertex> vertices, std::vector<Index> indices );
+
+	/// @brief Replaces the vertices, keeping the indices
+	void set_vertices( std::vector<Vertex> vertices );
+
+	const std::vector<Vertex>& get_vertices() const { return vertices; }
+	const std::vector<Index>& get_indices() const { return indices; }
+
+	/// @return A content hash of vertices and indices, computed whenever they are set
+	size_t get_hash() const { return hash; }
+
 	/// Dictionary object, where each key corresponds to mesh attribute semantic and
 	/// each value is a handle to the accessor containing attribute's data (required)
 	std::unordered_map<Semantic, Handle<Accessor>> attributes;
@@ -90,8 +103,15 @@ struct Primitive
 	/// extension-specific objects Application-specific data
 	void* extras;
 
+  private:
+	void update_hash();
+
+	/// Geometry is only set through setters, which keep its hash up to date
 	std::vector<Vertex> vertices;
 	std::vector<Index> indices;
+
+	/// Content hash of the geometry
+	size_t hash = 0;
 };
 
 
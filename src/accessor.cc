@@ -0,0 +1,163 @@
+#include "spot/gltf/accessor.h"
+
+#include <cassert>
+#include <cstring>
+#include <limits>
+
+#if defined( __SSE2__ )
+#include <emmintrin.h>
+#elif defined( __ARM_NEON )
+#include <arm_neon.h>
+#endif
+
+
+namespace spot::gfx
+{
+
+
+// SSE2 and NEON are part of x86-64 and AArch64, therefore no runtime dispatch is needed
+
+
+void widen( const uint8_t* src, const size_t count, uint32_t* dst )
+{
+	size_t i = 0;
+
+#if defined( __SSE2__ )
+	auto zero = _mm_setzero_si128();
+	for ( ; i + 16 <= count; i += 16 )
+	{
+		auto bytes = _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + i ) );
+		auto lo = _mm_unpacklo_epi8( bytes, zero );
+		auto hi = _mm_unpackhi_epi8( bytes, zero );
+		auto out = reinterpret_cast<__m128i*>( dst + i );
+		_mm_storeu_si128( out, _mm_unpacklo_epi16( lo, zero ) );
+		_mm_storeu_si128( out + 1, _mm_unpackhi_epi16( lo, zero ) );
+		_mm_storeu_si128( out + 2, _mm_unpacklo_epi16( hi, zero ) );
+		_mm_storeu_si128( out + 3, _mm_unpackhi_epi16( hi, zero ) );
+	}
+#elif defined( __ARM_NEON )
+	for ( ; i + 16 <= count; i += 16 )
+	{
+		auto bytes = vld1q_u8( src + i );
+		auto lo = vmovl_u8( vget_low_u8( bytes ) );
+		auto hi = vmovl_u8( vget_high_u8( bytes ) );
+		vst1q_u32( dst + i, vmovl_u16( vget_low_u16( lo ) ) );
+		vst1q_u32( dst + i + 4, vmovl_u16( vget_high_u16( lo ) ) );
+		vst1q_u32( dst + i + 8, vmovl_u16( vget_low_u16( hi ) ) );
+		vst1q_u32( dst + i + 12, vmovl_u16( vget_high_u16( hi ) ) );
+	}
+#endif
+
+	for ( ; i < count; ++i )
+	{
+		dst[i] = src[i];
+	}
+}
+
+
+void widen( const uint16_t* src, const size_t count, uint32_t* dst )
+{
+	size_t i = 0;
+
+#if defined( __SSE2__ )
+	auto zero = _mm_setzero_si128();
+	for ( ; i + 8 <= count; i += 8 )
+	{
+		auto shorts = _mm_loadu_si128( reinterpret_cast<const __m128i*>( src + i ) );
+		auto out = reinterpret_cast<__m128i*>( dst + i );
+		_mm_storeu_si128( out, _mm_unpacklo_epi16( shorts, zero ) );
+		_mm_storeu_si128( out + 1, _mm_unpackhi_epi16( shorts, zero ) );
+	}
+#elif defined( __ARM_NEON )
+	for ( ; i + 8 <= count; i += 8 )
+	{
+		auto shorts = vld1q_u16( src + i );
+		vst1q_u32( dst + i, vmovl_u16( vget_low_u16( shorts ) ) );
+		vst1q_u32( dst + i + 4, vmovl_u16( vget_high_u16( shorts ) ) );
+	}
+#endif
+
+	for ( ; i < count; ++i )
+	{
+		dst[i] = src[i];
+	}
+}
+
+
+/// @brief Converts N unsigned components of every element, widened in the lanes of a vector
+/// Division by the maximum is kept, so results match the scalar conversion exactly
+template <typename C, size_t N>
+void normalize_elements( const uint8_t* src, const size_t src_stride, const size_t count, uint8_t* dst, const size_t dst_stride )
+{
+	constexpr auto max = float( std::numeric_limits<C>::max() );
+
+	for ( size_t i = 0; i < count; ++i, src += src_stride, dst += dst_stride )
+	{
+		float values[4];
+
+#if defined( __SSE2__ )
+		uint64_t bits = 0;
+		std::memcpy( &bits, src, N * sizeof( C ) );
+		auto lanes = _mm_loadl_epi64( reinterpret_cast<const __m128i*>( &bits ) );
+		auto zero = _mm_setzero_si128();
+		if constexpr ( sizeof( C ) == 1 )
+		{
+			lanes = _mm_unpacklo_epi8( lanes, zero );
+		}
+		lanes = _mm_unpacklo_epi16( lanes, zero );
+		_mm_storeu_ps( values, _mm_div_ps( _mm_cvtepi32_ps( lanes ), _mm_set1_ps( max ) ) );
+#elif defined( __aarch64__ )
+		uint64_t bits = 0;
+		std::memcpy( &bits, src, N * sizeof( C ) );
+		uint16x4_t halves;
+		if constexpr ( sizeof( C ) == 1 )
+		{
+			halves = vget_low_u16( vmovl_u8( vcreate_u8( bits ) ) );
+		}
+		else
+		{
+			halves = vcreate_u16( bits );
+		}
+		vst1q_f32( values, vdivq_f32( vcvtq_f32_u32( vmovl_u16( halves ) ), vdupq_n_f32( max ) ) );
+#else
+		C components[N];
+		std::memcpy( components, src, sizeof( components ) );
+		for ( size_t c = 0; c < N; ++c )
+		{
+			values[c] = float( components[c] ) / max;
+		}
+#endif
+
+		std::memcpy( dst, values, N * sizeof( float ) );
+	}
+}
+
+
+template <typename C>
+void normalize_components( const uint8_t* src, const size_t src_stride, const size_t count, const size_t components, float* dst, const size_t dst_stride )
+{
+	auto out = reinterpret_cast<uint8_t*>( dst );
+	switch ( components )
+	{
+	case 1: return normalize_elements<C, 1>( src, src_stride, count, out, dst_stride );
+	case 2: return normalize_elements<C, 2>( src, src_stride, count, out, dst_stride );
+	case 3: return normalize_elements<C, 3>( src, src_stride, count, out, dst_stride );
+	case 4: return normalize_elements<C, 4>( src, src_stride, count, out, dst_stride );
+	default: assert( false && "Cannot normalize more than four components" );
+	}
+}
+
+
+void normalize( const uint8_t* src, const size_t src_stride, const size_t count, const size_t components, float* dst, const size_t dst_stride )
+{
+	normalize_components<uint8_t>( src, src_stride, count, components, dst, dst_stride );
+}
+
+
+void normalize( const uint16_t* src, const size_t src_stride, const size_t count, const size_t components, float* dst, const size_t dst_stride )
+{
+	normalize_components<uint16_t>( reinterpret_cast<const uint8_t*>( src ), src_stride, count, components, dst, dst_stride );
+}
+
+
+} // namespace spot::gfx
@@ -1,74 +1,321 @@
 #include "spot/gltf/buffer.h"
 
-#include <spot/file/ifstream.h>
+#include <array>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined( __x86_64__ ) && defined( __GNUC__ )
+#include <immintrin.h>
+#elif defined( __aarch64__ )
+#include <arm_neon.h>
+#endif
 
 namespace spot::gfx
 {
 
 
-const std::string base64_chars =
-    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-    "abcdefghijklmnopqrstuvwxyz"
-    "0123456789+/";
+/// Marks characters outside of the base64 alphabet
+constexpr uint8_t base64_invalid = 0xFF;
+
+
+/// @return The value of every character of the base64 alphabet, indexed by character
+constexpr std::array<uint8_t, 256> make_base64_values()
+{
+	constexpr char alphabet[] =
+	    "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+	    "abcdefghijklmnopqrstuvwxyz"
+	    "0123456789+/";
+
+	std::array<uint8_t, 256> values = {};
+	for ( auto& value : values )
+	{
+		value = base64_invalid;
+	}
+	for ( uint8_t i = 0; i < 64; ++i )
+	{
+		values[uint8_t( alphabet[i] )] = i;
+	}
+	return values;
+}
+
+
+constexpr auto base64_values = make_base64_values();
+
+
+/// @brief Decodes whole blocks of characters with vector instructions
+/// Blocks with characters outside of the alphabet are left to the scalar loop, which reports them
+/// @param size Number of characters, a multiple of four without padding
+/// @return Number of characters decoded, whose bytes are written into out
+using Base64Kernel = size_t (*)( const uint8_t* in, size_t size, char* out );
+
+
+/// @brief Kernel selected for the running CPU
+struct Base64Simd
+{
+	Base64Kernel kernel;
+
+	/// Name of the instructions, for reporting
+	const char* name;
+};
 
 
-inline bool is_base64( const char c )
+size_t base64_decode_none( const uint8_t*, size_t, char* )
 {
-	return ( isalnum( c ) || ( c == '+' ) || ( c == '/' ) );
+	return 0;
 }
 
 
-std::vector<char> base64_decode( const std::string& encoded_string )
+#if defined( __x86_64__ ) && defined( __GNUC__ )
+
+// Characters are mapped to their values through nibble lookups, as in the decoder of Muła and Lemire,
+// then the four values of every 32 bits are packed into three bytes with multiply-adds
+
+__attribute__(( target( "ssse3" ) ))
+size_t base64_decode_ssse3( const uint8_t* in, const size_t size, char* out )
 {
-	auto              in_len = encoded_string.size();
-	int               i      = 0;
-	int               j      = 0;
-	int               in_    = 0;
-	char              char_array_4[4], char_array_3[3];
-	std::vector<char> ret;
+	const auto lut_lo = _mm_setr_epi8( 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A );
+	const auto lut_hi = _mm_setr_epi8( 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 );
+	const auto lut_roll = _mm_setr_epi8( 0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0 );
+	const auto mask_2f = _mm_set1_epi8( 0x2F );
+	const auto pack = _mm_setr_epi8( 2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1 );
 
-	while ( in_len-- && ( encoded_string[in_] != '=' ) && is_base64( encoded_string[in_] ) )
+	// Sixteen bytes are stored for twelve, so eight more characters make room for the four in excess
+	size_t decoded = 0;
+	for ( ; size - decoded >= 24; decoded += 16, out += 12 )
 	{
-		char_array_4[i++] = encoded_string[in_];
-		in_++;
-		if ( i == 4 )
+		auto chars = _mm_loadu_si128( reinterpret_cast<const __m128i*>( in + decoded ) );
+
+		auto hi_nibbles = _mm_and_si128( _mm_srli_epi32( chars, 4 ), mask_2f );
+		auto lo_nibbles = _mm_and_si128( chars, mask_2f );
+		auto hi = _mm_shuffle_epi8( lut_hi, hi_nibbles );
+		auto lo = _mm_shuffle_epi8( lut_lo, lo_nibbles );
+		if ( _mm_movemask_epi8( _mm_cmpgt_epi8( _mm_and_si128( lo, hi ), _mm_setzero_si128() ) ) )
 		{
-			for ( i = 0; i < 4; i++ )
-			{
-				char_array_4[i] = base64_chars.find( char_array_4[i] );
-			}
+			break;
+		}
 
-			char_array_3[0] = ( char_array_4[0] << 2 ) + ( ( char_array_4[1] & 0x30 ) >> 4 );
-			char_array_3[1] = ( ( char_array_4[1] & 0xf ) << 4 ) + ( ( char_array_4[2] & 0x3c ) >> 2 );
-			char_array_3[2] = ( ( char_array_4[2] & 0x3 ) << 6 ) + char_array_4[3];
+		auto eq_2f = _mm_cmpeq_epi8( chars, mask_2f );
+		auto roll = _mm_shuffle_epi8( lut_roll, _mm_add_epi8( eq_2f, hi_nibbles ) );
+		auto values = _mm_add_epi8( chars, roll );
 
-			for ( i = 0; ( i < 3 ); i++ )
-			{
-				ret.push_back( char_array_3[i] );
-			}
-			i = 0;
+		auto pairs = _mm_maddubs_epi16( values, _mm_set1_epi32( 0x01400140 ) );
+		auto triples = _mm_madd_epi16( pairs, _mm_set1_epi32( 0x00011000 ) );
+		_mm_storeu_si128( reinterpret_cast<__m128i*>( out ), _mm_shuffle_epi8( triples, pack ) );
+	}
+
+	return decoded;
+}
+
+
+__attribute__(( target( "avx2" ) ))
+size_t base64_decode_avx2( const uint8_t* in, const size_t size, char* out )
+{
+	const auto lut_lo = _mm256_setr_epi8(
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A );
+	const auto lut_hi = _mm256_setr_epi8(
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10 );
+	const auto lut_roll = _mm256_setr_epi8(
+		0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+		0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0 );
+	const auto mask_2f = _mm256_set1_epi8( 0x2F );
+	const auto pack = _mm256_setr_epi8(
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+		2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1 );
+	const auto lanes = _mm256_setr_epi32( 0, 1, 2, 4, 5, 6, -1, -1 );
+
+	// Thirty-two bytes are stored for twenty-four, so twelve more characters make room for the eight in excess
+	size_t decoded = 0;
+	for ( ; size - decoded >= 44; decoded += 32, out += 24 )
+	{
+		auto chars = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( in + decoded ) );
+
+		auto hi_nibbles = _mm256_and_si256( _mm256_srli_epi32( chars, 4 ), mask_2f );
+		auto lo_nibbles = _mm256_and_si256( chars, mask_2f );
+		auto hi = _mm256_shuffle_epi8( lut_hi, hi_nibbles );
+		auto lo = _mm256_shuffle_epi8( lut_lo, lo_nibbles );
+		if ( !_mm256_testz_si256( lo, hi ) )
+		{
+			break;
 		}
+
+		auto eq_2f = _mm256_cmpeq_epi8( chars, mask_2f );
+		auto roll = _mm256_shuffle_epi8( lut_roll, _mm256_add_epi8( eq_2f, hi_nibbles ) );
+		auto values = _mm256_add_epi8( chars, roll );
+
+		auto pairs = _mm256_maddubs_epi16( values, _mm256_set1_epi32( 0x01400140 ) );
+		auto triples = _mm256_madd_epi16( pairs, _mm256_set1_epi32( 0x00011000 ) );
+		auto packed = _mm256_permutevar8x32_epi32( _mm256_shuffle_epi8( triples, pack ), lanes );
+		_mm256_storeu_si256( reinterpret_cast<__m256i*>( out ), packed );
 	}
 
-	if ( i )
+	// A tail too short for a 32 byte store may still fill a 16 byte one
+	return decoded + base64_decode_ssse3( in + decoded, size - decoded, out );
+}
+
+
+/// @return The widest kernel supported by the running CPU
+Base64Simd select_base64_kernel()
+{
+	if ( __builtin_cpu_supports( "avx2" ) )
 	{
-		for ( j = i; j < 4; j++ )
+		return { base64_decode_avx2, "AVX2" };
+	}
+	if ( __builtin_cpu_supports( "ssse3" ) )
+	{
+		return { base64_decode_ssse3, "SSSE3" };
+	}
+	return { base64_decode_none, "none" };
+}
+
+#elif defined( __aarch64__ )
+
+/// @return Values of sixteen characters, with the top bit set for characters outside of the alphabet
+uint8x16_t base64_lookup( const uint8x16_t chars, const uint8x16x4_t& lo_table, const uint8x16x4_t& hi_table )
+{
+	// Lookups out of a table give zero, therefore characters above 127 are marked by their own top bit
+	auto lo = vqtbl4q_u8( lo_table, chars );
+	auto hi = vqtbl4q_u8( hi_table, vsubq_u8( chars, vdupq_n_u8( 64 ) ) );
+	return vorrq_u8( vorrq_u8( lo, hi ), vandq_u8( chars, vdupq_n_u8( 0x80 ) ) );
+}
+
+
+size_t base64_decode_neon( const uint8_t* in, const size_t size, char* out )
+{
+	uint8x16x4_t lo_table;
+	uint8x16x4_t hi_table;
+	for ( int i = 0; i < 4; ++i )
+	{
+		lo_table.val[i] = vld1q_u8( base64_values.data() + 16 * i );
+		hi_table.val[i] = vld1q_u8( base64_values.data() + 64 + 16 * i );
+	}
+
+	// Sixty-four characters are deinterleaved, so that each register holds the same character of sixteen quads
+	size_t decoded = 0;
+	for ( ; size - decoded >= 64; decoded += 64, out += 48 )
+	{
+		auto chars = vld4q_u8( in + decoded );
+		auto a = base64_lookup( chars.val[0], lo_table, hi_table );
+		auto b = base64_lookup( chars.val[1], lo_table, hi_table );
+		auto c = base64_lookup( chars.val[2], lo_table, hi_table );
+		auto d = base64_lookup( chars.val[3], lo_table, hi_table );
+		if ( vmaxvq_u8( vorrq_u8( vorrq_u8( a, b ), vorrq_u8( c, d ) ) ) > 63 )
 		{
-			char_array_4[j] = 0;
+			break;
 		}
 
-		for ( j = 0; j < 4; j++ )
+		uint8x16x3_t bytes;
+		bytes.val[0] = vorrq_u8( vshlq_n_u8( a, 2 ), vshrq_n_u8( b, 4 ) );
+		bytes.val[1] = vorrq_u8( vshlq_n_u8( b, 4 ), vshrq_n_u8( c, 2 ) );
+		bytes.val[2] = vorrq_u8( vshlq_n_u8( c, 6 ), d );
+		vst3q_u8( reinterpret_cast<uint8_t*>( out ), bytes );
+	}
+
+	return decoded;
+}
+
+
+/// @return NEON kernel, as NEON is part of AArch64
+Base64Simd select_base64_kernel()
+{
+	return { base64_decode_neon, "NEON" };
+}
+
+#else
+
+Base64Simd select_base64_kernel()
+{
+	return { base64_decode_none, "none" };
+}
+
+#endif
+
+
+/// @return The kernel selected once, for the CPU running the process
+const Base64Simd& get_base64_simd()
+{
+	static const auto simd = select_base64_kernel();
+	return simd;
+}
+
+
+const char* get_base64_simd_name()
+{
+	return get_base64_simd().name;
+}
+
+
+
+std::vector<char> base64_decode( const char* encoded, size_t size, const Base64Decoder decoder )
+{
+	// Trailing padding, which may also be omitted
+	if ( size % 4 == 0 && size > 0 && encoded[size - 1] == '=' )
+	{
+		size -= ( encoded[size - 2] == '=' ) ? 2 : 1;
+	}
+
+	auto remainder = size % 4;
+	if ( remainder == 1 )
+	{
+		throw std::runtime_error{ "Base64 length not valid" };
+	}
+
+	std::vector<char> ret( size / 4 * 3 + ( remainder ? remainder - 1 : 0 ) );
+
+	auto in = reinterpret_cast<const uint8_t*>( encoded );
+	auto out = ret.data();
+
+	auto end = in + ( size - remainder );
+
+	auto kernel = decoder == Base64Decoder::SIMD ? get_base64_simd().kernel : base64_decode_none;
+	auto decoded = kernel( in, end - in, out );
+	in += decoded;
+	out += decoded / 4 * 3;
+
+	// Characters left by the kernel, including any block it found not valid
+	for ( ; in != end; in += 4 )
+	{
+		uint32_t a = base64_values[in[0]];
+		uint32_t b = base64_values[in[1]];
+		uint32_t c = base64_values[in[2]];
+		uint32_t d = base64_values[in[3]];
+		if ( ( a | b | c | d ) > 63 )
 		{
-			char_array_4[j] = base64_chars.find( char_array_4[j] );
+			throw std::runtime_error{ "Base64 character not valid" };
 		}
 
-		char_array_3[0] = ( char_array_4[0] << 2 ) + ( ( char_array_4[1] & 0x30 ) >> 4 );
-		char_array_3[1] = ( ( char_array_4[1] & 0xf ) << 4 ) + ( ( char_array_4[2] & 0x3c ) >> 2 );
-		char_array_3[2] = ( ( char_array_4[2] & 0x3 ) << 6 ) + char_array_4[3];
+		auto triple = a << 18 | b << 12 | c << 6 | d;
+		out[0] = char( triple >> 16 );
+		out[1] = char( triple >> 8 );
+		out[2] = char( triple );
+		out += 3;
+	}
+
+	// Last two or three characters make one or two bytes
+	if ( remainder )
+	{
+		uint32_t triple = 0;
+		for ( size_t i = 0; i < remainder; ++i )
+		{
+			uint32_t value = base64_values[in[i]];
+			if ( value > 63 )
+			{
+				throw std::runtime_error{ "Base64 character not valid" };
+			}
+			triple |= value << ( 18 - 6 * i );
+		}
 
-		for ( j = 0; ( j < i - 1 ); j++ )
+		out[0] = char( triple >> 16 );
+		if ( remainder == 3 )
 		{
-			ret.push_back( char_array_3[j] );
+			out[1] = char( triple >> 8 );
 		}
 	}
 
@@ -76,10 +323,60 @@ std::vector<char> base64_decode( const std::string& encoded_string )
 }
 
 
-std::vector<char> load( const std::string& uri, const size_t byte_length )
+MappedFile::MappedFile( const std::string& path )
+{
+	auto fd = open( path.c_str(), O_RDONLY );
+	if ( fd < 0 )
+	{
+		throw std::runtime_error{ "Cannot open " + path + ": " + std::strerror( errno ) };
+	}
+
+	struct stat st;
+	if ( fstat( fd, &st ) != 0 )
+	{
+		auto error = errno;
+		close( fd );
+		throw std::runtime_error{ "Cannot stat " + path + ": " + std::strerror( error ) };
+	}
+	size = st.st_size;
+
+	// Empty files cannot be mapped
+	if ( size > 0 )
+	{
+		auto mapped = mmap( nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+		if ( mapped == MAP_FAILED )
+		{
+			auto error = errno;
+			close( fd );
+			throw std::runtime_error{ "Cannot map " + path + ": " + std::strerror( error ) };
+		}
+		data = reinterpret_cast<const char*>( mapped );
+	}
+
+	// The mapping stays valid after closing the descriptor
+	close( fd );
+}
+
+
+MappedFile::~MappedFile()
 {
-	std::vector<char> data;
+	if ( data )
+	{
+		munmap( const_cast<char*>( data ), size );
+	}
+}
 
+
+ByteBuffer::ByteBuffer( std::string u, const size_t len )
+: uri { std::move( u ) }
+, byte_length { len }
+{
+	load();
+}
+
+
+void ByteBuffer::load()
+{
 	// Check if it is data
 	if ( uri.rfind( "data:", 0 ) == 0 )
 	{
@@ -92,26 +389,30 @@ std::vector<char> load( const std::string& uri, const size_t byte_length )
 		}
 
 		// Assume it is base64
-		data = base64_decode( uri.substr( comma_pos + 1 ) );
+		data = base64_decode( uri.data() + comma_pos + 1, uri.size() - comma_pos - 1 );
 	}
 	else
 	{
-		auto file = file::Ifstream( uri, std::ios::binary );
-		assert( file.is_open() && "Could not open the file" );
-		data = file.read( byte_length );
+		file = std::make_shared<MappedFile>( uri );
+		assert( file->size >= byte_length && "Buffer file is shorter than its length" );
+		view = file->data;
 	}
-
-	return data;
 }
 
 
-ByteBuffer::ByteBuffer( std::string u, const size_t len )
-: uri { std::move( u ) }
-, byte_length { len }
-, data { load( uri, len ) }
+ByteBuffer::ByteBuffer( std::shared_ptr<MappedFile> f, const size_t offset, const size_t len )
+: byte_length { len }
+, file { std::move( f ) }
 {
+	assert( offset + byte_length <= file->size && "Buffer out of mapped file bounds" );
+	view = file->data + offset;
 }
 
 
+const char* ByteBuffer::get_data() const
+{
+	return view ? view : data.data();
+}
+
 
 } // namespace
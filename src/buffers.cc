@@ -1,7 +1,9 @@
 #include "spot/gfx/buffers.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cstring>
+#include <limits>
 
 #include "spot/gfx/graphics.h"
 
@@ -9,7 +11,36 @@ namespace spot::gfx
 {
 
 
-Buffer::Buffer( const Device& d, const VkDeviceSize size, const VkBufferUsageFlags usage )
+/// @return Index of the memory type to use for this kind of access
+uint32_t get_memory_type( PhysicalDevice& device, const uint32_t type_filter, const MemoryUsage usage )
+{
+	switch ( usage )
+	{
+	case MemoryUsage::GPU_ONLY:
+	{
+		if ( device.has_unified_memory() )
+		{
+			// Device local memory which the CPU can write directly avoids staging copies
+			return device.get_memory_type( type_filter, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+				VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
+		}
+		// Software devices may have no device local memory at all
+		return device.get_memory_type( type_filter, 0, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT );
+	}
+	case MemoryUsage::CPU_TO_GPU:
+		return device.get_memory_type( type_filter, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
+	case MemoryUsage::GPU_TO_CPU:
+		return device.get_memory_type( type_filter, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			VK_MEMORY_PROPERTY_HOST_CACHED_BIT );
+	default:
+		assert( false && "Memory usage not supported" );
+	}
+
+	return 0;
+}
+
+
+Buffer::Buffer( const Device& d, const VkDeviceSize size, const VkBufferUsageFlags usage, const MemoryUsage memory_usage )
 : device { d }
 {
 	assert( size > 0 && "Cannot create buffer of size 0" );
@@ -28,17 +59,11 @@ Buffer::Buffer( const Device& d, const VkDeviceSize size, const VkBufferUsageFla
 	VkMemoryRequirements requirements;
 	vkGetBufferMemoryRequirements( device.handle, handle, &requirements );
 
-	VkMemoryAllocateInfo meminfo = {};
-	meminfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	meminfo.allocationSize = requirements.size;
-	auto memory_type = device.physical_device.get_memory_type( requirements.memoryTypeBits,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
-	meminfo.memoryTypeIndex = memory_type;
-
-	res = vkAllocateMemory( device.handle, &meminfo, nullptr, &memory );
-	assert( res == VK_SUCCESS && "Cannot allocate memory" );
+	auto memory_type = get_memory_type( device.physical_device, requirements.memoryTypeBits, memory_usage );
+	memory_properties = device.physical_device.memory_properties.memoryTypes[memory_type].propertyFlags;
+	memory = device.allocator->allocate( requirements, memory_type );
 
-	res = vkBindBufferMemory( device.handle, handle, memory, /* offset */ 0 );
+	res = vkBindBufferMemory( device.handle, handle, memory.memory, memory.offset );
 	assert( res == VK_SUCCESS && "Cannot bind memory to buffer" );
 }
 
@@ -50,9 +75,9 @@ Buffer::~Buffer()
 		vkDestroyBuffer( device.handle, handle, nullptr );
 	}
 
-	if ( memory != VK_NULL_HANDLE )
+	if ( memory.memory != VK_NULL_HANDLE )
 	{
-		vkFreeMemory( device.handle, memory, nullptr );
+		device.allocator->free( memory );
 	}
 }
 
@@ -61,9 +86,10 @@ Buffer::Buffer( Buffer&& o )
 : device { o.device }
 , handle { o.handle }
 , memory { o.memory }
+, memory_properties { o.memory_properties }
 {
 	o.handle = VK_NULL_HANDLE;
-	o.memory = VK_NULL_HANDLE;
+	o.memory = {};
 }
 
 
@@ -72,6 +98,7 @@ Buffer& Buffer::operator=( Buffer&& o )
 	assert( device.handle == o.device.handle && "Cannot move assign buffer from different device" );
 	std::swap( handle, o.handle );
 	std::swap( memory, o.memory );
+	std::swap( memory_properties, o.memory_properties );
 
 	return *this;
 }
@@ -79,17 +106,14 @@ Buffer& Buffer::operator=( Buffer&& o )
 
 void* Buffer::map( const VkDeviceSize size )
 {
-	void* mem;
-	auto res = vkMapMemory( device.handle, memory, 0, size, 0, &mem);
-	assert( res == VK_SUCCESS && "Cannot map buffer memory" );
-	return mem;
+	assert( is_mappable() && "Cannot map buffer memory which is not host visible" );
+	assert( size <= memory.size && "Cannot map more than buffer memory" );
+	return memory.data;
 }
 
 
 void Buffer::unmap()
-{
-	vkUnmapMemory( device.handle, memory );
-}
+{}
 
 
 void Buffer::upload( const uint8_t* data, const VkDeviceSize size )
@@ -100,6 +124,157 @@ void Buffer::upload( const uint8_t* data, const VkDeviceSize size )
 }
 
 
+/// Usage of uniform allocator buffers: uniforms, instance and material arrays, and indirect commands
+constexpr VkBufferUsageFlags uniform_allocator_usage =
+	VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT;
+
+
+UniformAllocator::UniformAllocator( const Device& d, const VkDeviceSize cap )
+: buffer { d, cap, uniform_allocator_usage }
+, alignment { std::max(
+		d.physical_device.properties.limits.minUniformBufferOffsetAlignment,
+		d.physical_device.properties.limits.minStorageBufferOffsetAlignment ) }
+, capacity { cap }
+{
+	// The memory stays mapped for the whole lifetime of the buffer
+	// and it is implicitly unmapped when freed
+	data = reinterpret_cast<uint8_t*>( buffer.map( capacity ) );
+}
+
+
+uint32_t UniformAllocator::allocate( const VkDeviceSize size )
+{
+	// Alignment is guaranteed to be a power of two
+	VkDeviceSize aligned = ( offset + alignment - 1 ) & ~( alignment - 1 );
+	if ( aligned + size > capacity )
+	{
+		grow( aligned + size );
+	}
+
+	offset = aligned + size;
+	return uint32_t( aligned );
+}
+
+
+void UniformAllocator::grow( const VkDeviceSize required )
+{
+	auto new_capacity = std::max( capacity * 2, required );
+	assert( new_capacity <= std::numeric_limits<uint32_t>::max() && "Cannot grow uniform data beyond 32 bit offsets" );
+
+	auto larger = Buffer( buffer.device, new_capacity, uniform_allocator_usage );
+	auto larger_data = reinterpret_cast<uint8_t*>( larger.map( new_capacity ) );
+	std::memcpy( larger_data, data, offset );
+
+	// The old buffer is destroyed here, as the GPU is done with this frame
+	buffer = std::move( larger );
+	data = larger_data;
+	capacity = new_capacity;
+	grown = true;
+}
+
+
+uint32_t UniformAllocator::upload( const uint8_t* src, const VkDeviceSize size )
+{
+	auto ret = allocate( size );
+	std::memcpy( data + ret, src, size );
+	return ret;
+}
+
+
+RangeAllocator::RangeAllocator( const uint32_t cap )
+: capacity { cap }
+, free_size { cap }
+{
+	if ( capacity > 0 )
+	{
+		free_ranges.emplace( 0, capacity );
+	}
+}
+
+
+uint32_t RangeAllocator::allocate( const uint32_t size, const uint32_t alignment )
+{
+	assert( size > 0 && "Cannot allocate an empty range" );
+
+	for ( auto it = std::begin( free_ranges ); it != std::end( free_ranges ); ++it )
+	{
+		auto [offset, range_size] = *it;
+		uint32_t aligned = ( offset + alignment - 1 ) & ~( alignment - 1 );
+		uint32_t padding = aligned - offset;
+		if ( range_size < padding + size )
+		{
+			continue;
+		}
+
+		// Padding stays free before the allocated range, and whatever is left after it
+		free_ranges.erase( it );
+		if ( padding > 0 )
+		{
+			free_ranges.emplace( offset, padding );
+		}
+		if ( range_size > padding + size )
+		{
+			free_ranges.emplace( aligned + size, range_size - padding - size );
+		}
+
+		free_size -= size;
+		return aligned;
+	}
+
+	return invalid;
+}
+
+
+void RangeAllocator::free( const uint32_t offset, const uint32_t size )
+{
+	assert( offset + size <= capacity && "Cannot free a range out of capacity" );
+
+	auto [it, inserted] = free_ranges.emplace( offset, size );
+	assert( inserted && "Cannot free a range twice" );
+	free_size += size;
+
+	// Merge with the following range
+	auto next = std::next( it );
+	if ( next != std::end( free_ranges ) && it->first + it->second == next->first )
+	{
+		it->second += next->second;
+		free_ranges.erase( next );
+	}
+
+	// Merge with the previous range
+	if ( it != std::begin( free_ranges ) )
+	{
+		auto prev = std::prev( it );
+		if ( prev->first + prev->second == it->first )
+		{
+			prev->second += it->second;
+			free_ranges.erase( it );
+		}
+	}
+}
+
+
+uint32_t RangeAllocator::get_largest_free_range() const
+{
+	uint32_t largest = 0;
+	for ( auto& [offset, size] : free_ranges )
+	{
+		largest = std::max( largest, size );
+	}
+	return largest;
+}
+
+
+float RangeAllocator::get_fragmentation() const
+{
+	if ( free_size == 0 )
+	{
+		return 0.0f;
+	}
+	return 1.0f - float( get_largest_free_range() ) / float( free_size );
+}
+
+
 void DynamicBuffer::create_buffers( const uint32_t count )
 {
 	assert( count > 0 && "Cannot create 0 buffers" );
@@ -119,24 +294,10 @@ void DynamicBuffer::create_buffers( const uint32_t count )
 	VkMemoryRequirements requirements;
 	vkGetBufferMemoryRequirements( device.handle, handle, &requirements );
 
-	VkMemoryAllocateInfo meminfo = {};
-	meminfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	// Allocate enough memory for each buffer
-	meminfo.allocationSize = requirements.size * count;
-	auto memory_type = device.physical_device.get_memory_type( requirements.memoryTypeBits,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT );
-	meminfo.memoryTypeIndex = memory_type;
+	auto memory_type = get_memory_type( device.physical_device, requirements.memoryTypeBits, MemoryUsage::CPU_TO_GPU );
+	memory = device.allocator->allocate( requirements, memory_type );
 
-	if ( memory != VK_NULL_HANDLE )
-	{
-		// Release previous memory
-		vkFreeMemory( device.handle, memory, nullptr );
-	}
-
-	res = vkAllocateMemory( device.handle, &meminfo, nullptr, &memory );
-	assert( res == VK_SUCCESS && "Cannot allocate memory" );
-
-	res = vkBindBufferMemory( device.handle, handle, memory, 0 );
+	res = vkBindBufferMemory( device.handle, handle, memory.memory, memory.offset );
 	assert( res == VK_SUCCESS && "Cannot bind memory to buffer" );
 }
 
@@ -156,10 +317,10 @@ void DynamicBuffer::clear()
 		handle = VK_NULL_HANDLE;
 	}
 
-	if ( memory != VK_NULL_HANDLE )
+	if ( memory.memory != VK_NULL_HANDLE )
 	{
-		vkFreeMemory( device.handle, memory, nullptr );
-		memory = VK_NULL_HANDLE;
+		device.allocator->free( memory );
+		memory = {};
 	}
 }
 
@@ -180,7 +341,7 @@ DynamicBuffer::DynamicBuffer( DynamicBuffer&& other )
 , memory { other.memory }
 {
 	other.handle = VK_NULL_HANDLE;
-	other.memory = VK_NULL_HANDLE;
+	other.memory = {};
 }
 
 
@@ -211,20 +372,14 @@ void DynamicBuffer::set_count( const uint32_t count )
 void DynamicBuffer::upload( const uint8_t* data, const uint32_t index )
 {
 	assert( index < element_count && "Cannot upload vertex out of bounds" );
-	void* temp;
-	VkDeviceSize offset = size * index;
-	vkMapMemory( device.handle, memory, offset, size, 0, &temp);
-	std::memcpy( temp, data, size );
-	vkUnmapMemory( device.handle, memory );
+	// Memory stays mapped by the device allocator
+	std::memcpy( memory.data + size * index, data, size );
 }
 
 
 void DynamicBuffer::upload( const uint8_t* data )
 {
-	void* temp;
-	vkMapMemory( device.handle, memory, 0, size * element_count, 0, &temp);
-	std::memcpy( temp, data, size * element_count );
-	vkUnmapMemory( device.handle, memory );
+	std::memcpy( memory.data, data, size * element_count );
 }
 
 
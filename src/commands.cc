@@ -1,5 +1,6 @@
 #include "spot/gfx/commands.h"
 
+#include <algorithm>
 #include <cassert>
 
 #include "spot/gfx/graphics.h"
@@ -15,14 +16,18 @@ CommandBuffer::CommandBuffer( const VkCommandBuffer h )
 {}
 
 
-void CommandBuffer::begin( const VkCommandBufferUsageFlags usage_flags )
+void CommandBuffer::begin( const VkCommandBufferUsageFlags usage_flags, const VkCommandBufferInheritanceInfo* inheritance )
 {
 	VkCommandBufferBeginInfo info = {};
 	info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 	info.flags = usage_flags;
+	info.pInheritanceInfo = inheritance;
 
 	auto ret = vkBeginCommandBuffer( handle, &info );
 	assert( ret == VK_SUCCESS && "Cannot begin command buffer" );
+
+	// Nothing is bound to a new command buffer
+	state = {};
 }
 
 VkImageAspectFlags get_aspect_mask( const VkImageLayout layout )
@@ -45,7 +50,7 @@ void CommandBuffer::transition( Image& image, const VkImageLayout layout )
 	barrier.image = image.handle;
 	barrier.subresourceRange.aspectMask = get_aspect_mask( layout );
 	barrier.subresourceRange.baseMipLevel = 0;
-	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.levelCount = image.mip_levels;
 	barrier.subresourceRange.baseArrayLayer = 0;
 	barrier.subresourceRange.layerCount = 1;
 
@@ -90,26 +95,122 @@ void CommandBuffer::transition( Image& image, const VkImageLayout layout )
 }
 
 
-void CommandBuffer::copy( const Buffer& from_buffer, const Image& dest_image )
+void CommandBuffer::copy( const Buffer& from_buffer, const Image& dest_image, const VkDeviceSize offset, const uint32_t level )
 {
 	VkBufferImageCopy region = {};
-	region.bufferOffset = 0;
+	region.bufferOffset = offset;
 	region.bufferRowLength = 0;
 	region.bufferImageHeight = 0;
 
 	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.mipLevel = level;
 	region.imageSubresource.baseArrayLayer = 0;
 	region.imageSubresource.layerCount = 1;
 
 	region.imageOffset = { 0, 0, 0 };
-	region.imageExtent = dest_image.extent;
+	region.imageExtent.width = std::max( dest_image.extent.width >> level, 1u );
+	region.imageExtent.height = std::max( dest_image.extent.height >> level, 1u );
+	region.imageExtent.depth = 1;
 
 	vkCmdCopyBufferToImage( handle, from_buffer.handle, dest_image.handle, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region );
 }
 
 
-void CommandBuffer::begin_render_pass( RenderPass& render_pass, Framebuffer& framebuffer )
+void CommandBuffer::generate_mipmaps( Image& image )
+{
+	assert( image.layout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL && "Cannot generate mipmaps of an image not in transfer dst layout" );
+
+	VkImageMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+	barrier.image = image.handle;
+	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.levelCount = 1;
+	barrier.subresourceRange.layerCount = 1;
+
+	auto width = int32_t( image.extent.width );
+	auto height = int32_t( image.extent.height );
+
+	for ( uint32_t level = 1; level < image.mip_levels; ++level )
+	{
+		// The previous level becomes the source of the blit
+		barrier.subresourceRange.baseMipLevel = level - 1;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		this->barrier( VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, barrier );
+
+		VkImageBlit blit = {};
+		blit.srcOffsets[1] = { width, height, 1 };
+		blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.srcSubresource.mipLevel = level - 1;
+		blit.srcSubresource.layerCount = 1;
+
+		width = std::max( width / 2, 1 );
+		height = std::max( height / 2, 1 );
+
+		blit.dstOffsets[1] = { width, height, 1 };
+		blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.dstSubresource.mipLevel = level;
+		blit.dstSubresource.layerCount = 1;
+
+		vkCmdBlitImage( handle,
+			image.handle, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			image.handle, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			1, &blit, VK_FILTER_LINEAR );
+
+		// The previous level is done
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		this->barrier( VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, barrier );
+	}
+
+	// The last level is only written
+	barrier.subresourceRange.baseMipLevel = image.mip_levels - 1;
+	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+	this->barrier( VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, barrier );
+
+	image.layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+}
+
+
+void CommandBuffer::copy( const Buffer& from_buffer, const Buffer& dest_buffer, const VkBufferCopy& region )
+{
+	vkCmdCopyBuffer( handle, from_buffer.handle, dest_buffer.handle, 1, &region );
+}
+
+
+void CommandBuffer::barrier( const VkPipelineStageFlags src_stage, const VkAccessFlags src_access, const VkPipelineStageFlags dst_stage, const VkAccessFlags dst_access )
+{
+	VkMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask = src_access;
+	barrier.dstAccessMask = dst_access;
+
+	vkCmdPipelineBarrier( handle, src_stage, dst_stage, 0, 1, &barrier, 0, nullptr, 0, nullptr );
+}
+
+
+void CommandBuffer::barrier( const VkPipelineStageFlags src_stage, const VkPipelineStageFlags dst_stage, const VkImageMemoryBarrier& image_barrier )
+{
+	vkCmdPipelineBarrier( handle, src_stage, dst_stage, 0, 0, nullptr, 0, nullptr, 1, &image_barrier );
+}
+
+
+void CommandBuffer::barrier( const VkPipelineStageFlags src_stage, const VkPipelineStageFlags dst_stage, const VkBufferMemoryBarrier& buffer_barrier )
+{
+	vkCmdPipelineBarrier( handle, src_stage, dst_stage, 0, 0, nullptr, 1, &buffer_barrier, 0, nullptr );
+}
+
+
+void CommandBuffer::begin_render_pass( RenderPass& render_pass, Framebuffer& framebuffer, const VkSubpassContents contents )
 {
 	VkRenderPassBeginInfo info = {};
 	info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -124,19 +225,50 @@ void CommandBuffer::begin_render_pass( RenderPass& render_pass, Framebuffer& fra
 	info.clearValueCount = clears.size();
 	info.pClearValues = clears.data();
 
-	vkCmdBeginRenderPass( handle, &info, VK_SUBPASS_CONTENTS_INLINE );
+	vkCmdBeginRenderPass( handle, &info, contents );
 }
 
 
-void CommandBuffer::bind( GraphicsPipeline& line_pipeline )
+void CommandBuffer::execute( const std::vector<CommandBuffer>& secondaries )
 {
-	vkCmdBindPipeline( handle, VK_PIPELINE_BIND_POINT_GRAPHICS, line_pipeline.handle );
+	if ( secondaries.empty() )
+	{
+		return;
+	}
+
+	std::vector<VkCommandBuffer> handles( secondaries.size() );
+	std::transform( std::begin( secondaries ), std::end( secondaries ), std::begin( handles ),
+		[]( auto& secondary ) { return secondary.handle; }
+	);
+
+	vkCmdExecuteCommands( handle, handles.size(), handles.data() );
+
+	// Secondary command buffers leave the state of the primary undefined
+	state = {};
+}
+
+
+void CommandBuffer::bind( GraphicsPipeline& pipeline )
+{
+	if ( state.pipeline == pipeline.handle )
+	{
+		return;
+	}
+
+	vkCmdBindPipeline( handle, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline.handle );
+	state.pipeline = pipeline.handle;
 }
 
 
 void CommandBuffer::set_line_width( const float line_width )
 {
+	if ( state.line_width == line_width )
+	{
+		return;
+	}
+
 	vkCmdSetLineWidth( handle, line_width );
+	state.line_width = line_width;
 }
 
 
@@ -152,34 +284,81 @@ void CommandBuffer::set_scissor( const VkRect2D& scissor )
 }
 
 
-void CommandBuffer::bind_vertex_buffer( Buffer& buffer, VkDeviceSize offset )
+void CommandBuffer::bind_vertex_buffer( const Buffer& buffer, VkDeviceSize offset )
 {
+	if ( state.vertex_buffer == buffer.handle && state.vertex_offset == offset )
+	{
+		return;
+	}
+
 	VkDeviceSize offsets[] = { offset };
 	vkCmdBindVertexBuffers( handle, 0, 1, &buffer.handle, offsets );
+	state.vertex_buffer = buffer.handle;
+	state.vertex_offset = offset;
 }
 
 
 void CommandBuffer::bind_vertex_buffers( DynamicBuffer& buffers )
 {
 	vkCmdBindVertexBuffers( handle, 0, 1, &buffers.handle, &buffers.offset );
+	state.vertex_buffer = buffers.handle;
+	state.vertex_offset = buffers.offset;
 }
 
 
-void CommandBuffer::bind_index_buffer( Buffer& buffer, VkDeviceSize offset )
+void CommandBuffer::bind_index_buffer( const Buffer& buffer, VkDeviceSize offset )
 {
-	vkCmdBindIndexBuffer( handle, buffer.handle, offset, VK_INDEX_TYPE_UINT16 );
+	if ( state.index_buffer == buffer.handle && state.index_offset == offset )
+	{
+		return;
+	}
+
+	vkCmdBindIndexBuffer( handle, buffer.handle, offset, VK_INDEX_TYPE_UINT32 );
+	state.index_buffer = buffer.handle;
+	state.index_offset = offset;
 }
 
 
 void CommandBuffer::bind_index_buffer( DynamicBuffer& buffer )
 {
-	vkCmdBindIndexBuffer( handle, buffer.handle, 0, VK_INDEX_TYPE_UINT16 );
+	vkCmdBindIndexBuffer( handle, buffer.handle, 0, VK_INDEX_TYPE_UINT32 );
+	state.index_buffer = buffer.handle;
+	state.index_offset = 0;
+}
+
+
+void CommandBuffer::bind_descriptor_sets( const PipelineLayout& layout, const VkDescriptorSet set, const uint32_t first, const uint32_t offset_count, const uint32_t* offsets )
+{
+	assert( first < state.sets.size() && "Cannot track descriptor set index" );
+	assert( offset_count <= state.sets[first].offsets.size() && "Cannot track dynamic offsets" );
+
+	auto& bound = state.sets[first];
+	if ( bound.layout == layout.handle && bound.handle == set && bound.offset_count == offset_count &&
+		std::equal( offsets, offsets + offset_count, std::begin( bound.offsets ) ) )
+	{
+		return;
+	}
+
+	vkCmdBindDescriptorSets( handle, VK_PIPELINE_BIND_POINT_GRAPHICS, layout.handle, first, 1, &set, offset_count, offsets );
+
+	if ( state.layout != layout.handle )
+	{
+		// Sets bound with a different layout may be disturbed, whatever their index,
+		// so none of them is trusted any longer
+		state.sets = {};
+		state.layout = layout.handle;
+	}
+
+	bound.layout = layout.handle;
+	bound.handle = set;
+	bound.offset_count = offset_count;
+	std::copy( offsets, offsets + offset_count, std::begin( bound.offsets ) );
 }
 
 
-void CommandBuffer::bind_descriptor_sets( const PipelineLayout& layout, const VkDescriptorSet set )
+void CommandBuffer::push_constants( const PipelineLayout& layout, const VkShaderStageFlags stages, const uint32_t size, const void* data )
 {
-	vkCmdBindDescriptorSets( handle, VK_PIPELINE_BIND_POINT_GRAPHICS, layout.handle, 0, 1, &set, 0, nullptr );
+	vkCmdPushConstants( handle, layout.handle, stages, 0, size, data );
 }
 
 
@@ -190,10 +369,17 @@ void CommandBuffer::draw( const uint32_t vertex_count )
 }
 
 
-void CommandBuffer::draw_indexed( const uint32_t index_count )
+void CommandBuffer::draw_indexed( const uint32_t index_count, const uint32_t instance_count, const uint32_t first_instance, const uint32_t first_index, const int32_t vertex_offset )
 {
 	assert( index_count > 0 && "Cannot draw 0 indices" );
-	vkCmdDrawIndexed( handle, index_count, 1, 0, 0, 0 );
+	vkCmdDrawIndexed( handle, index_count, instance_count, first_index, vertex_offset, first_instance );
+}
+
+
+void CommandBuffer::draw_indexed_indirect( const Buffer& buffer, const VkDeviceSize offset, const uint32_t draw_count )
+{
+	assert( draw_count > 0 && "Cannot draw 0 indirect commands" );
+	vkCmdDrawIndexedIndirect( handle, buffer.handle, offset, draw_count, sizeof( VkDrawIndexedIndirectCommand ) );
 }
 
 
@@ -249,13 +435,13 @@ CommandPool& CommandPool::operator=( CommandPool&& other )
 }
 
 
-std::vector<CommandBuffer> CommandPool::allocate_command_buffers( const uint32_t count )
+std::vector<CommandBuffer> CommandPool::allocate_command_buffers( const uint32_t count, const VkCommandBufferLevel level )
 {
 	VkCommandBufferAllocateInfo info = {};
 	info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	info.commandPool = handle;
 	info.commandBufferCount = count;
-	info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	info.level = level;
 
 	std::vector<VkCommandBuffer> handles( count );
 	auto ret = vkAllocateCommandBuffers( device.handle, &info, handles.data() );
@@ -0,0 +1,287 @@
+#include "spot/gfx/compressed.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+
+#include "spot/gltf/buffer.h"
+
+
+namespace spot::gfx
+{
+
+
+/// @brief Reads a little endian value at an offset of the data
+/// Throws std::runtime_error when the value goes past the end of the data
+template <typename T>
+T read( const uint8_t* data, const size_t size, const size_t offset )
+{
+	if ( offset > size || sizeof( T ) > size - offset )
+	{
+		throw std::runtime_error{ "Compressed image truncated" };
+	}
+	T value;
+	std::memcpy( &value, data + offset, sizeof( T ) );
+	return value;
+}
+
+
+/// Larger extents would overflow the size of their levels, and no device samples them anyway
+constexpr uint32_t max_extent = 1u << 16;
+
+
+constexpr uint8_t ktx2_identifier[] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+constexpr uint32_t make_fourcc( const char a, const char b, const char c, const char d )
+{
+	return uint32_t( a ) | uint32_t( b ) << 8 | uint32_t( c ) << 16 | uint32_t( d ) << 24;
+}
+
+
+/// @return Bytes of a 4x4 block of a supported format
+size_t get_block_size( const VkFormat format )
+{
+	switch ( format )
+	{
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	case VK_FORMAT_BC4_SNORM_BLOCK:
+		return 8;
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC5_SNORM_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		return 16;
+	default:
+		throw std::runtime_error{ "Block compressed format not supported: " + std::to_string( format ) };
+	}
+}
+
+
+/// @return Vulkan format of a DXGI format of the DX10 header
+VkFormat get_dxgi_format( const uint32_t dxgi )
+{
+	switch ( dxgi )
+	{
+	case 71: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	case 72: return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+	case 77: return VK_FORMAT_BC3_UNORM_BLOCK;
+	case 78: return VK_FORMAT_BC3_SRGB_BLOCK;
+	case 80: return VK_FORMAT_BC4_UNORM_BLOCK;
+	case 81: return VK_FORMAT_BC4_SNORM_BLOCK;
+	case 83: return VK_FORMAT_BC5_UNORM_BLOCK;
+	case 84: return VK_FORMAT_BC5_SNORM_BLOCK;
+	case 98: return VK_FORMAT_BC7_UNORM_BLOCK;
+	case 99: return VK_FORMAT_BC7_SRGB_BLOCK;
+	default:
+		throw std::runtime_error{ "DXGI format not supported: " + std::to_string( dxgi ) };
+	}
+}
+
+
+/// @return Vulkan format of a legacy DDS four character code
+VkFormat get_fourcc_format( const uint32_t fourcc )
+{
+	switch ( fourcc )
+	{
+	case make_fourcc( 'D', 'X', 'T', '1' ): return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+	case make_fourcc( 'D', 'X', 'T', '5' ): return VK_FORMAT_BC3_UNORM_BLOCK;
+	case make_fourcc( 'A', 'T', 'I', '1' ):
+	case make_fourcc( 'B', 'C', '4', 'U' ): return VK_FORMAT_BC4_UNORM_BLOCK;
+	case make_fourcc( 'A', 'T', 'I', '2' ):
+	case make_fourcc( 'B', 'C', '5', 'U' ): return VK_FORMAT_BC5_UNORM_BLOCK;
+	default:
+		throw std::runtime_error{ "DDS four character code not supported: " + std::to_string( fourcc ) };
+	}
+}
+
+
+/// @return Bytes of a level, made of whole blocks
+size_t get_level_size( const VkExtent2D extent, const uint32_t level, const size_t block_size )
+{
+	auto width = std::max( extent.width >> level, 1u );
+	auto height = std::max( extent.height >> level, 1u );
+	return size_t( ( width + 3 ) / 4 ) * ( ( height + 3 ) / 4 ) * block_size;
+}
+
+
+CompressedImage::CompressedImage( const std::string& path )
+: file { std::make_shared<MappedFile>( path ) }
+{
+	data = reinterpret_cast<const uint8_t*>( file->data );
+	size = file->size;
+	parse();
+}
+
+
+CompressedImage::CompressedImage( const uint8_t* d, const size_t s )
+: data { d }
+, size { s }
+{
+	parse();
+}
+
+
+bool CompressedImage::is_container( const std::string& path, const std::string& mime_type )
+{
+	if ( mime_type == "image/ktx2" || mime_type == "image/vnd-ms.dds" )
+	{
+		return true;
+	}
+
+	auto dot = path.find_last_of( '.' );
+	if ( dot == std::string::npos )
+	{
+		return false;
+	}
+	auto ext = path.substr( dot + 1 );
+	std::transform( std::begin( ext ), std::end( ext ), std::begin( ext ), ::tolower );
+	return ext == "ktx2" || ext == "dds";
+}
+
+
+void CompressedImage::parse()
+{
+	if ( size >= sizeof( ktx2_identifier ) &&
+		std::memcmp( data, ktx2_identifier, sizeof( ktx2_identifier ) ) == 0 )
+	{
+		parse_ktx2();
+	}
+	else if ( size >= 4 && read<uint32_t>( data, size, 0 ) == make_fourcc( 'D', 'D', 'S', ' ' ) )
+	{
+		parse_dds();
+	}
+	else
+	{
+		throw std::runtime_error{ "Cannot recognize compressed image container" };
+	}
+}
+
+
+void CompressedImage::check_extent( const uint32_t level_count ) const
+{
+	if ( extent.width == 0 || extent.height == 0 || extent.width > max_extent || extent.height > max_extent )
+	{
+		throw std::runtime_error{ "Compressed image extent not valid" };
+	}
+
+	// Down to a level of one texel
+	uint32_t max_levels = 1;
+	for ( auto side = std::max( extent.width, extent.height ); side > 1; side >>= 1 )
+	{
+		++max_levels;
+	}
+	if ( level_count > max_levels )
+	{
+		throw std::runtime_error{ "Compressed image has too many levels: " + std::to_string( level_count ) };
+	}
+}
+
+
+void CompressedImage::parse_ktx2()
+{
+	format = VkFormat( read<uint32_t>( data, size, 12 ) );
+	extent.width = read<uint32_t>( data, size, 20 );
+	extent.height = read<uint32_t>( data, size, 24 );
+	auto layer_count = read<uint32_t>( data, size, 32 );
+	auto face_count = read<uint32_t>( data, size, 36 );
+	auto level_count = std::max( read<uint32_t>( data, size, 40 ), 1u );
+	auto supercompression = read<uint32_t>( data, size, 44 );
+	if ( layer_count > 1 || face_count != 1 )
+	{
+		throw std::runtime_error{ "Cannot load KTX2 arrays or cube maps" };
+	}
+	if ( supercompression != 0 )
+	{
+		throw std::runtime_error{ "Cannot load supercompressed KTX2" };
+	}
+	auto block_size = get_block_size( format );
+	check_extent( level_count );
+
+	// Level index follows the 48 bytes of the header and 32 bytes of the index
+	levels.resize( level_count );
+	for ( uint32_t level = 0; level < level_count; ++level )
+	{
+		auto entry = 80 + size_t( level ) * 24;
+		auto offset = read<uint64_t>( data, size, entry );
+		auto length = read<uint64_t>( data, size, entry + 8 );
+
+		// Without supercompression, a level is exactly the blocks of its only layer and face
+		if ( length != get_level_size( extent, level, block_size ) )
+		{
+			throw std::runtime_error{ "KTX2 level size not valid: " + std::to_string( level ) };
+		}
+		if ( offset > size || length > size - offset )
+		{
+			throw std::runtime_error{ "KTX2 level out of bounds: " + std::to_string( level ) };
+		}
+		levels[level].offset = offset;
+		levels[level].size = length;
+	}
+}
+
+
+void CompressedImage::parse_dds()
+{
+	// Header of 124 bytes follows the magic number
+	extent.height = read<uint32_t>( data, size, 12 );
+	extent.width = read<uint32_t>( data, size, 16 );
+	auto level_count = std::max( read<uint32_t>( data, size, 28 ), 1u );
+	auto fourcc = read<uint32_t>( data, size, 84 );
+
+	size_t offset = 128;
+	if ( fourcc == make_fourcc( 'D', 'X', '1', '0' ) )
+	{
+		auto dimension = read<uint32_t>( data, size, 132 );
+		auto array_size = read<uint32_t>( data, size, 140 );
+		if ( dimension != 3 || array_size > 1 )
+		{
+			throw std::runtime_error{ "Cannot load DDS arrays or non 2D textures" };
+		}
+		format = get_dxgi_format( read<uint32_t>( data, size, 128 ) );
+		offset += 20;
+	}
+	else
+	{
+		format = get_fourcc_format( fourcc );
+	}
+	check_extent( level_count );
+
+	// Levels are stored one after the other, from the largest
+	auto block_size = get_block_size( format );
+	levels.resize( level_count );
+	for ( uint32_t level = 0; level < level_count; ++level )
+	{
+		levels[level].offset = offset;
+		levels[level].size = get_level_size( extent, level, block_size );
+		offset += levels[level].size;
+	}
+	if ( offset > size )
+	{
+		throw std::runtime_error{ "DDS levels out of bounds" };
+	}
+}
+
+
+void CompressedImage::load( uint8_t* dst, const std::vector<VkDeviceSize>& offsets ) const
+{
+	// The image may have fewer levels, like when its tiling is linear
+	auto count = std::min( levels.size(), offsets.size() - 1 );
+	for ( size_t level = 0; level < count; ++level )
+	{
+		if ( levels[level].size > offsets[level + 1] - offsets[level] )
+		{
+			throw std::runtime_error{ "Compressed level larger than its destination: " + std::to_string( level ) };
+		}
+		std::memcpy( dst + offsets[level], data + levels[level].offset, levels[level].size );
+	}
+}
+
+
+} // namespace spot::gfx
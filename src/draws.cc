@@ -0,0 +1,113 @@
+#include "spot/gfx/draws.h"
+
+#include <array>
+#include <cstring>
+
+#include "spot/gltf/material.h"
+
+
+namespace spot::gfx
+{
+
+
+bool DrawPacket::can_merge( const DrawPacket& other ) const
+{
+	if ( pipeline != other.pipeline || resources != other.resources || index_count != other.index_count )
+	{
+		return false;
+	}
+
+	if ( material && other.material )
+	{
+		// Material parameters come from instance data, while the texture comes from the bound set
+		return material->texture == other.material->texture;
+	}
+
+	// Lines have no material, but line width is a dynamic state
+	return !material && !other.material && line_width == other.line_width;
+}
+
+
+uint64_t DrawList::get_key( const uint64_t pipeline, const uint64_t material, const uint64_t geometry, const float depth )
+{
+	// The bit pattern of a positive float grows with its value,
+	// hence its highest 20 bits are a coarse but ordered depth
+	float positive = depth > 0.0f ? depth : 0.0f;
+	uint32_t depth_bits;
+	std::memcpy( &depth_bits, &positive, sizeof( depth_bits ) );
+
+	return ( ( pipeline & 0xF ) << 60 ) |
+		( ( material & 0xFFFFF ) << 40 ) |
+		( ( geometry & 0xFFFFF ) << 20 ) |
+		( depth_bits >> 12 );
+}
+
+
+float DrawList::get_depth( const math::Mat4& transform ) const
+{
+	// Z of the transform translation in view space, where the camera looks down -z
+	auto& v = view.matrix;
+	auto& t = transform.matrix;
+	float z = v[2] * t[12] + v[6] * t[13] + v[10] * t[14] + v[14] * t[15];
+	return -z;
+}
+
+
+const std::vector<const DrawPacket*>& DrawList::sort()
+{
+	entries.resize( packets.size() );
+	scratch.resize( packets.size() );
+	for ( uint32_t i = 0; i < packets.size(); ++i )
+	{
+		entries[i] = { packets[i].key, i };
+	}
+
+	// Least significant digit first, one byte at a time
+	for ( uint32_t shift = 0; shift < 64; shift += 8 )
+	{
+		std::array<uint32_t, 256> counts = {};
+		for ( auto& entry : entries )
+		{
+			++counts[( entry.key >> shift ) & 0xFF];
+		}
+
+		// Skip this byte when every key has the same value
+		if ( counts[( entries.empty() ? 0 : entries[0].key >> shift ) & 0xFF] == entries.size() )
+		{
+			continue;
+		}
+
+		uint32_t offset = 0;
+		for ( auto& count : counts )
+		{
+			auto current = count;
+			count = offset;
+			offset += current;
+		}
+
+		for ( auto& entry : entries )
+		{
+			scratch[counts[( entry.key >> shift ) & 0xFF]++] = entry;
+		}
+
+		std::swap( entries, scratch );
+	}
+
+	sorted.resize( entries.size() );
+	for ( size_t i = 0; i < entries.size(); ++i )
+	{
+		sorted[i] = &packets[entries[i].index];
+	}
+
+	return sorted;
+}
+
+
+void DrawList::clear()
+{
+	packets.clear();
+	sorted.clear();
+}
+
+
+} // namespace spot::gfx
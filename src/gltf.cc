@@ -1,7 +1,9 @@
+#include <cstring>
 #include <fstream>
 #include <stdexcept>
-#include <spot/file/ifstream.h>
+#include <string_view>
 
+#include "spot/gfx/workers.h"
 #include "spot/gltf/gltf.h"
 #include "spot/gltf/node.h"
 
@@ -14,8 +16,10 @@ Gltf::Gltf( Gltf&& other )
 : asset{ std::move( other.asset ) }
 , path{ std::move( other.path ) }
 , buffers_cache{ std::move( other.buffers_cache ) }
+, glb{ std::move( other.glb ) }
+, glb_bin_offset{ other.glb_bin_offset }
+, glb_bin_length{ other.glb_bin_length }
 , cameras{ std::move( other.cameras ) }
-, images{ std::move( other.images ) }
 , lights{ std::move( other.lights ) }
 , scripts{ std::move( other.scripts ) }
 , scenes{ std::move( other.scenes ) }
@@ -31,8 +35,10 @@ Gltf& Gltf::operator=( Gltf&& other )
 	asset         = std::move( other.asset );
 	path          = std::move( other.path );
 	buffers_cache = std::move( other.buffers_cache );
+	glb           = std::move( other.glb );
+	glb_bin_offset = other.glb_bin_offset;
+	glb_bin_length = other.glb_bin_length;
 	cameras       = std::move( other.cameras );
-	std::swap( images, other.images );
 	std::swap( lights, other.lights );
 	scripts       = std::move( other.scripts );
 	scenes        = std::move( other.scenes );
@@ -45,25 +51,240 @@ Gltf& Gltf::operator=( Gltf&& other )
 }
 
 
-nlohmann::json read_json( const std::string& path )
+/// @return Whether the file starts with the magic of a binary gltf
+/// Its header is not validated yet, so a truncated one is still recognized
+bool is_glb( const MappedFile& file )
 {
-	// read a JSON file
-	auto in = file::Ifstream( path );
-	assert( in.is_open() && "Cannot open gltf file" );
-	nlohmann::json js;
-	in >> js;
-	return js;
+	return file.size >= 4 && std::memcmp( file.data, "glTF", 4 ) == 0;
 }
 
 
-Gltf::Gltf( Device& d, const std::string& path )
-: Gltf( d, read_json( path ), path )
-{}
+/// @return A little endian 32 bit value of a binary gltf
+/// Throws std::runtime_error when the value goes past the end of the file
+uint32_t read_u32( const MappedFile& file, const size_t offset )
+{
+	if ( offset > file.size || sizeof( uint32_t ) > file.size - offset )
+	{
+		throw std::runtime_error{ "Cannot read past the end of glb" };
+	}
+	uint32_t value;
+	std::memcpy( &value, file.data + offset, sizeof( value ) );
+	return value;
+}
+
+
+/// @brief Number of elements of the top level arrays which are streamed
+struct ElementCounts
+{
+	size_t accessors = 0;
+	size_t buffer_views = 0;
+	size_t nodes = 0;
+};
+
+
+/// @brief Counts elements of the streamed arrays, looking only at brackets and strings
+/// This is much cheaper than parsing, and lets every array be reserved before it is filled
+ElementCounts count_elements( const char* begin, const char* end )
+{
+	ElementCounts counts;
+
+	// Counter of the top level array being scanned, if streamed
+	size_t* counter = nullptr;
+
+	// Last string read at the top level, the key of the following value
+	std::string_view key;
+
+	int depth = 0;
+	for ( auto c = begin; c < end; ++c )
+	{
+		switch ( *c )
+		{
+		case '"':
+		{
+			auto string = ++c;
+			for ( ; c < end && *c != '"'; ++c )
+			{
+				if ( *c == '\\' )
+				{
+					++c;
+				}
+			}
+			if ( depth == 1 )
+			{
+				key = std::string_view( string, c - string );
+			}
+			break;
+		}
+		case '[':
+		{
+			if ( depth == 1 )
+			{
+				counter = key == "accessors" ? &counts.accessors :
+				          key == "bufferViews" ? &counts.buffer_views :
+				          key == "nodes" ? &counts.nodes : nullptr;
+			}
+			++depth;
+			break;
+		}
+		case '{':
+		{
+			if ( depth == 2 && counter )
+			{
+				++*counter;
+			}
+			++depth;
+			break;
+		}
+		case ']':
+		case '}':
+		{
+			if ( --depth == 1 )
+			{
+				counter = nullptr;
+			}
+			break;
+		}
+		default:
+			break;
+		}
+	}
+
+	return counts;
+}
+
+
+nlohmann::json Gltf::parse( const char* begin, const char* end )
+{
+	using Event = nlohmann::json::parse_event_t;
+
+	// Arrays and their references are reserved upfront, as they are filled one element at a time
+	auto counts = count_elements( begin, end );
+	reserve_accessors( counts.accessors );
+	reserve_buffer_views( counts.buffer_views );
+	reserve_nodes( counts.nodes );
 
+	// Top level key whose value is being parsed
+	std::string section;
+
+	return nlohmann::json::parse( begin, end,
+		[this, &section]( const int depth, const Event event, nlohmann::json& parsed ) {
+			if ( depth == 1 && event == Event::key )
+			{
+				section = parsed.get<std::string>();
+			}
+			else if ( depth == 1 && event == Event::array_end &&
+				( section == "accessors" || section == "bufferViews" || section == "nodes" ) )
+			{
+				// Dropped elements stay in their array as placeholders, so the whole array is dropped.
+				// Its key is left with a discarded value, which init() skips
+				return false;
+			}
+			else if ( depth == 2 && event == Event::object_end )
+			{
+				// Elements of the largest arrays are initialized and dropped as soon as they are read
+				if ( section == "accessors" )
+				{
+					init_accessor( parsed );
+					return false;
+				}
+				else if ( section == "bufferViews" )
+				{
+					init_buffer_view( parsed );
+					return false;
+				}
+				else if ( section == "nodes" )
+				{
+					init_node( parsed );
+					return false;
+				}
+			}
+			return true;
+		} );
+}
+
+
+Gltf::Gltf( Device& d, const std::string& pth, WorkerPool* pool )
+: Gltf( d )
+{
+	// Only needed while loading
+	workers = pool;
+
+	auto file = std::make_shared<MappedFile>( pth );
+	if ( is_glb( *file ) )
+	{
+		// Header of 12 bytes is followed by a JSON chunk and an optional BIN chunk
+		if ( file->size < 20 )
+		{
+			throw std::runtime_error{ "Binary glTF header truncated: " + pth };
+		}
+		auto version = read_u32( *file, 4 );
+		if ( version != 2 )
+		{
+			throw std::runtime_error{ "Binary glTF version not supported: " + std::to_string( version ) };
+		}
+		size_t length = read_u32( *file, 8 );
+		if ( length > file->size )
+		{
+			throw std::runtime_error{ "Binary glTF truncated: " + pth };
+		}
+
+		constexpr uint32_t json_type = 0x4E4F534A;
+		constexpr uint32_t bin_type = 0x004E4942;
+
+		// Chunk ends are computed with size_t, as a 32 bit length could wrap around
+		size_t json_length = read_u32( *file, 12 );
+		if ( read_u32( *file, 16 ) != json_type )
+		{
+			throw std::runtime_error{ "First glb chunk is not JSON: " + pth };
+		}
+		if ( 20 + json_length > length )
+		{
+			throw std::runtime_error{ "JSON chunk out of glb bounds: " + pth };
+		}
+		auto json = parse( file->data + 20, file->data + 20 + json_length );
+
+		// Chunks are aligned to 4 bytes
+		auto bin_chunk = 20 + ( ( json_length + 3 ) & ~size_t( 3 ) );
+		if ( bin_chunk + 8 <= length && read_u32( *file, bin_chunk + 4 ) == bin_type )
+		{
+			size_t bin_length = read_u32( *file, bin_chunk );
+			if ( bin_chunk + 8 + bin_length > length )
+			{
+				throw std::runtime_error{ "BIN chunk out of glb bounds: " + pth };
+			}
+			glb = file;
+			glb_bin_offset = bin_chunk + 8;
+			glb_bin_length = bin_length;
+		}
+
+		init( json, pth );
+	}
+	else
+	{
+		// The JSON is parsed straight from the mapping
+		init( parse( file->data, file->data + file->size ), pth );
+	}
+
+	workers = nullptr;
+}
 
 
 Gltf::Gltf( Device& d, const nlohmann::json& j, const std::string& pth )
 : Gltf( d )
+{
+	init( j, pth );
+}
+
+
+/// @return Whether a section is there and still to be initialized, as sections streamed by Gltf::parse are discarded
+bool has_section( const nlohmann::json& j, const char* key )
+{
+	auto it = j.find( key );
+	return it != j.end() && !it->is_discarded();
+}
+
+
+void Gltf::init( const nlohmann::json& j, const std::string& pth )
 {
 	// Get the directory path
 	auto index = pth.find_last_of( "/\\" );
@@ -79,7 +300,7 @@ Gltf::Gltf( Device& d, const nlohmann::json& j, const std::string& pth )
 	}
 
 	// BufferViews
-	if ( j.count( "bufferViews" ) )
+	if ( has_section( j, "bufferViews" ) )
 	{
 		init_buffer_views( j["bufferViews"] );
 	}
@@ -109,7 +330,10 @@ Gltf::Gltf( Device& d, const nlohmann::json& j, const std::string& pth )
 	}
 
 	// Accessors
-	init_accessors( j["accessors"] );
+	if ( has_section( j, "accessors" ) )
+	{
+		init_accessors( j["accessors"] );
+	}
 
 	// Materials
 	if ( j.count( "materials" ) )
@@ -142,7 +366,7 @@ Gltf::Gltf( Device& d, const nlohmann::json& j, const std::string& pth )
 	}
 
 	// Nodes
-	if ( j.count( "nodes" ) )
+	if ( has_section( j, "nodes" ) )
 	{
 		init_nodes( j["nodes"] );
 	}
@@ -165,6 +389,9 @@ Gltf::Gltf( Device& d, const nlohmann::json& j, const std::string& pth )
 		}
 	}
 
+	// References of elements read while parsing, now that every array is initialized
+	link();
+
 	// Scenes
 	if ( j.count( "scenes" ) )
 	{
@@ -181,6 +408,69 @@ Gltf::Gltf( Device& d, const nlohmann::json& j, const std::string& pth )
 }
 
 
+void Gltf::reserve_accessors( const size_t count )
+{
+	accessors->reserve( accessors->size() + count );
+	links.buffer_views.reserve( links.buffer_views.size() + count );
+}
+
+
+void Gltf::reserve_buffer_views( const size_t count )
+{
+	buffer_views->reserve( buffer_views->size() + count );
+	links.buffers.reserve( links.buffers.size() + count );
+}
+
+
+void Gltf::reserve_nodes( const size_t count )
+{
+	nodes->reserve( nodes->size() + count );
+	links.meshes.reserve( links.meshes.size() + count );
+}
+
+
+void Gltf::link()
+{
+	for ( auto& [view, buffer] : links.buffers )
+	{
+		view->buffer = buffers.find( buffer );
+	}
+
+	for ( auto& [accessor, view] : links.buffer_views )
+	{
+		accessor->buffer_view = buffer_views.find( view );
+	}
+
+	for ( auto& [node, camera] : links.cameras )
+	{
+		node->camera = &cameras[camera];
+	}
+
+	for ( auto& [node, mesh] : links.meshes )
+	{
+		node->mesh = meshes.find( mesh );
+	}
+
+	for ( auto& [node, light] : links.lights )
+	{
+		node->light = lights.find( light );
+	}
+
+	for ( auto& [node, bound] : links.bounds )
+	{
+		node->bounds = bounds.find( bound );
+	}
+
+	// Children keep their order, as they were recorded one node after the other
+	for ( auto& [node, child] : links.children )
+	{
+		node->children.push_back( nodes.find( child ) );
+	}
+
+	links = {};
+}
+
+
 void Gltf::init_asset( const nlohmann::json& j )
 {
 	// Version (mandatory)
@@ -202,8 +492,12 @@ void Gltf::init_asset( const nlohmann::json& j )
 
 void Gltf::init_buffers( const nlohmann::json& j )
 {
-	for ( const auto& b : j )
+	std::vector<Handle<ByteBuffer>> pending;
+
+	for ( size_t i = 0; i < j.size(); ++i )
 	{
+		auto& b = j[i];
+
 		// ByteBuffer length in bytes (mandatory)
 		auto byte_length = b["byteLength"].get<size_t>();
 
@@ -219,44 +513,81 @@ void Gltf::init_buffers( const nlohmann::json& j )
 			}
 		}
 
-		buffers.push( ByteBuffer( uri, byte_length ) );
+		if ( uri.empty() && glb && i == 0 )
+		{
+			// First buffer without uri is the binary chunk of the glb, viewed without copying
+			if ( byte_length > glb_bin_length )
+			{
+				throw std::runtime_error{ "BIN chunk shorter than buffer: " + std::to_string( glb_bin_length ) };
+			}
+			buffers.push( ByteBuffer( glb, glb_bin_offset, byte_length ) );
+		}
+		else
+		{
+			// Loaded below, once every buffer is in place
+			auto buffer = buffers.push();
+			buffer->uri = std::move( uri );
+			buffer->byte_length = byte_length;
+			pending.emplace_back( buffer );
+		}
+	}
+
+	// Base64 decodes and file mappings are independent of each other
+	auto load = [&pending]( const size_t i ) { pending[i]->load(); };
+	if ( workers )
+	{
+		workers->parallel_for( pending.size(), load );
+	}
+	else
+	{
+		for ( size_t i = 0; i < pending.size(); ++i )
+		{
+			load( i );
+		}
 	}
 }
 
 
 void Gltf::init_buffer_views( const nlohmann::json& j )
 {
+	reserve_buffer_views( j.size() );
 	for ( const auto& v : j )
 	{
-		auto view = buffer_views.push();
+		init_buffer_view( v );
+	}
+}
 
-		// ByteBuffer
-		auto buffer_index = v["buffer"].get<size_t>();
-		view->buffer = buffers.find( buffer_index );
 
-		// Byte offset
-		if ( v.count( "byteOffset" ) )
-		{
-			view->byte_offset = v["byteOffset"].get<size_t>();
-		}
+void Gltf::init_buffer_view( const nlohmann::json& v )
+{
+	auto view = buffer_views.push();
+	auto end = std::end( v );
 
-		// Byte length
-		if ( v.count( "byteLength" ) )
-		{
-			view->byte_length = v["byteLength"].get<size_t>();
-		}
+	// ByteBuffer
+	links.buffers.emplace_back( view, v["buffer"].get<size_t>() );
 
-		// Byte stride
-		if ( v.count( "byteStride" ) )
-		{
-			view->byte_stride = v["byteStride"].get<size_t>();
-		}
+	// Byte offset
+	if ( auto it = v.find( "byteOffset" ); it != end )
+	{
+		view->byte_offset = it->get<size_t>();
+	}
 
-		// Target
-		if ( v.count( "target" ) )
-		{
-			view->target = static_cast<BufferView::Target>( v["target"].get<size_t>() );
-		}
+	// Byte length
+	if ( auto it = v.find( "byteLength" ); it != end )
+	{
+		view->byte_length = it->get<size_t>();
+	}
+
+	// Byte stride
+	if ( auto it = v.find( "byteStride" ); it != end )
+	{
+		view->byte_stride = it->get<size_t>();
+	}
+
+	// Target
+	if ( auto it = v.find( "target" ); it != end )
+	{
+		view->target = static_cast<BufferView::Target>( it->get<size_t>() );
 	}
 }
 
@@ -458,6 +789,17 @@ void Gltf::init_textures( const nlohmann::json& j )
 			texture->source = gltf_images.find( index );
 		}
 
+		// Block compressed DDS source, preferred when present
+		if ( t.count( "extensions" ) && t["extensions"].count( "MSFT_texture_dds" ) )
+		{
+			auto& dds = t["extensions"]["MSFT_texture_dds"];
+			if ( dds.count( "source" ) )
+			{
+				auto index = dds["source"].get<int32_t>();
+				texture->source = gltf_images.find( index );
+			}
+		}
+
 		// Name
 		if ( t.count( "name" ) )
 		{
@@ -577,16 +919,47 @@ size_t size_of( Accessor::Type tp )
 	}
 }
 
+size_t rows_of( Accessor::Type tp )
+{
+	switch ( tp )
+	{
+	case Accessor::Type::MAT2: return 2;
+	case Accessor::Type::MAT3: return 3;
+	case Accessor::Type::MAT4: return 4;
+	default: return size_of( tp );
+	}
+}
+
+
+size_t column_stride_of( Accessor::ComponentType ct, Accessor::Type tp )
+{
+	auto column_size = rows_of( tp ) * size_of( ct );
+	switch ( tp )
+	{
+	case Accessor::Type::MAT2:
+	case Accessor::Type::MAT3:
+	case Accessor::Type::MAT4: return ( column_size + 3 ) & ~size_t( 3 );
+	default: return column_size;
+	}
+}
+
+
 size_t Accessor::get_size() const
 {
-	return count * size_of( component_type ) * size_of( type );
+	return count * get_element_size();
+}
+
+
+size_t Accessor::get_element_size() const
+{
+	return size_of( type ) / rows_of( type ) * column_stride_of( component_type, type );
 }
 
 
 const uint8_t* Accessor::get_data() const
 {
 	auto& buffer = buffer_view->buffer;
-	auto data = buffer->data.data() + buffer_view->byte_offset + byte_offset;
+	auto data = buffer->get_data() + buffer_view->byte_offset + byte_offset;
 	return reinterpret_cast<const uint8_t*>( data );
 }
 
@@ -599,48 +972,63 @@ size_t Accessor::get_stride() const
 
 void Gltf::init_accessors( const nlohmann::json& j )
 {
+	reserve_accessors( j.size() );
 	for ( const auto& a : j )
 	{
-		auto accessor = accessors.push();
+		init_accessor( a );
+	}
+}
 
-		// ByteBuffer view
-		if ( a.count( "bufferView" ) )
-		{
-			auto buffer_view_index = a["bufferView"].get<size_t>();
-			accessor->buffer_view = buffer_views.find( buffer_view_index );
-		}
 
-		// Byte offset
-		if ( a.count( "byteOffset" ) )
-		{
-			accessor->byte_offset = a["byteOffset"].get<size_t>();
-		}
+void Gltf::init_accessor( const nlohmann::json& a )
+{
+	auto accessor = accessors.push();
+	auto end = std::end( a );
+
+	// ByteBuffer view
+	if ( auto it = a.find( "bufferView" ); it != end )
+	{
+		links.buffer_views.emplace_back( accessor, it->get<size_t>() );
+	}
+
+	// Byte offset
+	if ( auto it = a.find( "byteOffset" ); it != end )
+	{
+		accessor->byte_offset = it->get<size_t>();
+	}
 
-		// Component type
-		accessor->component_type = a["componentType"].get<Accessor::ComponentType>();
+	// Component type
+	accessor->component_type = a["componentType"].get<Accessor::ComponentType>();
 
-		// Count
-		accessor->count = a["count"].get<size_t>();
+	// Normalized
+	if ( auto it = a.find( "normalized" ); it != end )
+	{
+		accessor->normalized = it->get<bool>();
+	}
 
-		// Type
-		accessor->type = from_string<Accessor::Type>( a["type"].get<std::string>() );
+	// Count
+	accessor->count = a["count"].get<size_t>();
 
-		// Max
-		if ( a.count( "max" ) )
+	// Type
+	accessor->type = from_string<Accessor::Type>( a["type"].get_ref<const std::string&>() );
+
+	// Max
+	if ( auto it = a.find( "max" ); it != end )
+	{
+		accessor->max.reserve( it->size() );
+		for ( const auto& value : *it )
 		{
-			for ( const auto& value : a["max"] )
-			{
-				accessor->max.push_back( value.get<float>() );
-			}
+			accessor->max.push_back( value.get<float>() );
 		}
+	}
 
-		// Min
-		if ( a.count( "min" ) )
+	// Min
+	if ( auto it = a.find( "min" ); it != end )
+	{
+		accessor->min.reserve( it->size() );
+		for ( const auto& value : *it )
 		{
-			for ( const auto& value : a["min"] )
-			{
-				accessor->min.push_back( value.get<float>() );
-			}
+			accessor->min.push_back( value.get<float>() );
 		}
 	}
 }
@@ -795,12 +1183,11 @@ void Gltf::init_meshes( const nlohmann::json& j )
 		{
 			auto& primitive = mesh.primitives.emplace_back();
 
-			auto attributes = p["attributes"].get<std::map<std::string, unsigned>>();
-
-			for ( const auto& a : attributes )
+			// Attributes are read in place, without converting them to a map first
+			for ( const auto& a : p["attributes"].items() )
 			{
-				auto semantic = from_string<Primitive::Semantic>( a.first );
-				auto accessor = accessors.find( a.second );
+				auto semantic = from_string<Primitive::Semantic>( a.key() );
+				auto accessor = accessors.find( a.value().get<size_t>() );
 				primitive.attributes.emplace( semantic, accessor );
 			}
 
@@ -898,110 +1285,104 @@ void Gltf::init_lights( const nlohmann::json& j )
 
 void Gltf::init_nodes( const nlohmann::json& j )
 {
-	size_t i = 0;
-
+	reserve_nodes( j.size() );
 	for ( const auto& n : j )
 	{
-		auto node = nodes.push();
+		init_node( n );
+	}
+}
 
-		// Name
-		if ( n.count( "name" ) )
-		{
-			node->name = n["name"].get<std::string>();
-		}
 
-		// Camera
-		if ( n.count( "camera" ) )
-		{
-			unsigned m  = n["camera"];
-			node->camera = &( cameras[m] );
-		}
+void Gltf::init_node( const nlohmann::json& n )
+{
+	auto node = nodes.push();
+	auto end = std::end( n );
 
-		// Matrix
-		if ( n.count( "matrix" ) )
-		{
-			auto marr = n["matrix"].get<std::array<float, 16>>();
-			node->matrix = math::Mat4( marr.data() );
-		}
+	// Name
+	if ( auto it = n.find( "name" ); it != end )
+	{
+		node->name = it->get<std::string>();
+	}
 
-		// Mesh
-		if ( n.count( "mesh" ) )
-		{
-			auto mesh_index = n["mesh"];
-			node->mesh = meshes.find( mesh_index );
-		}
+	// Camera
+	if ( auto it = n.find( "camera" ); it != end )
+	{
+		links.cameras.emplace_back( node, it->get<size_t>() );
+	}
 
-		// Rotation
-		if ( n.count( "rotation" ) )
+	// Children, which may come later in the array
+	if ( auto it = n.find( "children" ); it != end )
+	{
+		node->children.reserve( it->size() );
+		for ( const auto& child : *it )
 		{
-			auto qvec     = n["rotation"].get<std::vector<float>>();
-			node->rotation = math::Quat{ qvec[3], qvec[0], qvec[1], qvec[2] };
+			links.children.emplace_back( node, child.get<size_t>() );
 		}
+	}
 
-		// Scale
-		if ( n.count( "scale" ) )
-		{
-			auto s     = n["scale"].get<std::vector<float>>();
-			node->scale = math::Vec3{ s[0], s[1], s[2] };
-		}
+	// Matrix
+	if ( auto it = n.find( "matrix" ); it != end )
+	{
+		auto marr = it->get<std::array<float, 16>>();
+		node->matrix = math::Mat4( marr.data() );
+	}
 
-		// Translation
-		if ( n.count( "translation" ) )
-		{
-			auto t           = n["translation"].get<std::vector<float>>();
-			node->translation = math::Vec3{ t[0], t[1], t[2] };
-		}
+	// Mesh
+	if ( auto it = n.find( "mesh" ); it != end )
+	{
+		links.meshes.emplace_back( node, it->get<size_t>() );
+	}
 
-		// Estensions
-		if ( n.count( "extensions" ) )
-		{
-			auto& extensions = n["extensions"];
-			// Lights
-			if ( extensions.count( "KHR_lights_punctual" ) )
-			{
-				auto light_index = extensions["KHR_lights_punctual"]["light"].get<size_t>();
-				node->light = lights.find( light_index );
-			}
-		}
+	// Rotation
+	if ( auto it = n.find( "rotation" ); it != end )
+	{
+		auto& q = *it;
+		node->rotation = math::Quat{ q[3].get<float>(), q[0].get<float>(), q[1].get<float>(), q[2].get<float>() };
+	}
 
-		// Extras
-		if ( n.count( "extras" ) )
-		{
-			auto& extras = n["extras"];
+	// Scale
+	if ( auto it = n.find( "scale" ); it != end )
+	{
+		auto& s = *it;
+		node->scale = math::Vec3{ s[0].get<float>(), s[1].get<float>(), s[2].get<float>() };
+	}
 
-			// Bounds
-			if ( extras.count( "bounds" ) )
-			{
-				auto bounds_index = extras["bounds"].get<size_t>();
-				node->bounds = bounds.find( bounds_index );
-			}
+	// Translation
+	if ( auto it = n.find( "translation" ); it != end )
+	{
+		auto& t = *it;
+		node->translation = math::Vec3{ t[0].get<float>(), t[1].get<float>(), t[2].get<float>() };
+	}
 
-			// Scripts
-			if ( extras.count( "scripts" ) )
-			{
-				node->scripts_indices = extras["scripts"].get<std::vector<size_t>>();
-			}
+	// Estensions
+	if ( auto it = n.find( "extensions" ); it != end )
+	{
+		auto& extensions = *it;
+		// Lights
+		if ( extensions.count( "KHR_lights_punctual" ) )
+		{
+			auto light_index = extensions["KHR_lights_punctual"]["light"].get<size_t>();
+			links.lights.emplace_back( node, light_index );
 		}
 	}
 
-	// Second pass
-	i = 0;
-	for ( auto& n : j )
+	// Extras
+	if ( auto it = n.find( "extras" ); it != end )
 	{
-		auto& node = (*nodes)[i];
+		auto& extras = *it;
 
-		// Now children are available
-		if ( n.count( "children" ) )
+		// Bounds
+		if ( extras.count( "bounds" ) )
 		{
-			auto handles = n["children"].get<std::vector<size_t>>();
-			node.children.resize( handles.size() );
-			for ( size_t i = 0; i < handles.size(); ++i )
-			{
-				node.children[i] = nodes.find( handles[i] );
-			}
+			auto bounds_index = extras["bounds"].get<size_t>();
+			links.bounds.emplace_back( node, bounds_index );
 		}
 
-		++i;
+		// Scripts
+		if ( extras.count( "scripts" ) )
+		{
+			node->scripts_indices = extras["scripts"].get<std::vector<size_t>>();
+		}
 	}
 }
 
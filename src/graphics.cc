@@ -3,6 +3,7 @@
 #include <array>
 #include <filesystem>
 #include <limits>
+#include <optional>
 #include <algorithm>
 #include <cassert>
 #include <cstring>
@@ -26,6 +27,7 @@ PhysicalDevice::PhysicalDevice( VkPhysicalDevice h )
 {
 	vkGetPhysicalDeviceProperties( handle, &properties );
 	vkGetPhysicalDeviceFeatures( handle, &features );
+	vkGetPhysicalDeviceMemoryProperties( handle, &memory_properties );
 
 	uint32_t queue_family_count;
 	vkGetPhysicalDeviceQueueFamilyProperties( handle, &queue_family_count, nullptr );
@@ -69,13 +71,10 @@ std::vector<VkPresentModeKHR> PhysicalDevice::get_present_modes( VkSurfaceKHR s
 
 uint32_t PhysicalDevice::get_memory_type( uint32_t type_filter, VkMemoryPropertyFlags flags )
 {
-	VkPhysicalDeviceMemoryProperties properties;
-	vkGetPhysicalDeviceMemoryProperties( handle, &properties );
-
-	for ( uint32_t i = 0; i < properties.memoryTypeCount; ++i )
+	for ( uint32_t i = 0; i < memory_properties.memoryTypeCount; ++i )
 	{
 		if ( ( type_filter & ( 1 << i ) ) &&
-		     ( ( properties.memoryTypes[i].propertyFlags & flags ) == flags ) )
+		     ( ( memory_properties.memoryTypes[i].propertyFlags & flags ) == flags ) )
 		{
 			return i;
 		}
@@ -86,6 +85,29 @@ uint32_t PhysicalDevice::get_memory_type( uint32_t type_filter, VkMemoryProperty
 }
 
 
+uint32_t PhysicalDevice::get_memory_type( const uint32_t type_filter, const VkMemoryPropertyFlags required, const VkMemoryPropertyFlags preferred )
+{
+	auto flags = required | preferred;
+	for ( uint32_t i = 0; i < memory_properties.memoryTypeCount; ++i )
+	{
+		if ( ( type_filter & ( 1 << i ) ) &&
+		     ( ( memory_properties.memoryTypes[i].propertyFlags & flags ) == flags ) )
+		{
+			return i;
+		}
+	}
+
+	return get_memory_type( type_filter, required );
+}
+
+
+bool PhysicalDevice::has_unified_memory() const
+{
+	return properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU ||
+		properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU;
+}
+
+
 VkFormatProperties PhysicalDevice::get_format_properties( const VkFormat format ) const
 {
 	VkFormatProperties props;
@@ -163,6 +185,26 @@ VkResult Queue::present( const std::vector<VkSwapchainKHR>& swapchains, const st
 	return vkQueuePresentKHR( handle, &info );
 }
 
+/// @return The index of a queue family which supports transfer but not graphics, if any
+std::optional<uint32_t> get_transfer_family( const PhysicalDevice& physical_device )
+{
+	std::optional<uint32_t> ret;
+	for ( uint32_t i = 0; i < physical_device.queue_families.size(); ++i )
+	{
+		auto flags = physical_device.queue_families[i].queueFlags;
+		if ( ( flags & VK_QUEUE_TRANSFER_BIT ) && !( flags & VK_QUEUE_GRAPHICS_BIT ) )
+		{
+			// Prefer a family which does not support compute either
+			if ( !ret || !( flags & VK_QUEUE_COMPUTE_BIT ) )
+			{
+				ret = i;
+			}
+		}
+	}
+	return ret;
+}
+
+
 Device::Device( PhysicalDevice& d, const VkSurfaceKHR s, const RequiredExtensions required_extensions )
 : physical_device { d }
 , surface { s }
@@ -171,15 +213,23 @@ Device::Device( PhysicalDevice& d, const VkSurfaceKHR s, const RequiredExtension
 	info.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 
 	// Queue infos
-	VkDeviceQueueCreateInfo queue_info = {};
-	queue_info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-	queue_info.queueFamilyIndex = 0;
-	queue_info.queueCount = 1;
+	std::vector<VkDeviceQueueCreateInfo> queue_infos( 1 );
+	queue_infos[0].sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+	queue_infos[0].queueFamilyIndex = 0;
+	queue_infos[0].queueCount = 1;
 	float queue_priority = 1.0f;
-	queue_info.pQueuePriorities = &queue_priority;
+	queue_infos[0].pQueuePriorities = &queue_priority;
 
-	info.queueCreateInfoCount = 1;
-	info.pQueueCreateInfos = &queue_info;
+	// A family with transfer but no graphics is usually backed by dedicated copy engines
+	auto transfer_family = get_transfer_family( physical_device );
+	if ( transfer_family )
+	{
+		auto& transfer_info = queue_infos.emplace_back( queue_infos[0] );
+		transfer_info.queueFamilyIndex = *transfer_family;
+	}
+
+	info.queueCreateInfoCount = queue_infos.size();
+	info.pQueueCreateInfos = queue_infos.data();
 
 	// Features
 	VkPhysicalDeviceFeatures features = {};
@@ -190,6 +240,10 @@ Device::Device( PhysicalDevice& d, const VkSurfaceKHR s, const RequiredExtension
 		features.wideLines = VK_TRUE;
 	}
 
+	// Indirect draws read instance data through firstInstance, and draw many commands at once when supported
+	features.drawIndirectFirstInstance = physical_device.features.drawIndirectFirstInstance;
+	features.multiDrawIndirect = physical_device.features.multiDrawIndirect;
+
 	info.pEnabledFeatures = &features;
 
 	// Extensions
@@ -207,6 +261,14 @@ Device::Device( PhysicalDevice& d, const VkSurfaceKHR s, const RequiredExtension
 	assert( queues[0].handle != VK_NULL_HANDLE && "Cannot get graphics queue" );
 	assert( queues[0].flags & VK_QUEUE_GRAPHICS_BIT && "First queue is not for graphics" );
 	assert( queues[0].supports_present( surface ) && "First queue does not support present" );
+
+	if ( transfer_family )
+	{
+		queues.emplace_back( *this, *transfer_family, 0 );
+	}
+
+	allocator = std::make_unique<DeviceAllocator>( *this );
+	uploads = std::make_unique<UploadManager>( *this );
 }
 
 
@@ -215,6 +277,8 @@ Device::~Device()
 	if ( handle != VK_NULL_HANDLE )
 	{
 		wait_idle();
+		uploads.reset();
+		allocator.reset();
 		vkDestroyDevice( handle, nullptr );
 	}
 }
@@ -242,6 +306,19 @@ Queue& Device::find_graphics_queue()
 }
 
 
+Queue& Device::find_transfer_queue()
+{
+	auto it = std::find_if( std::begin( queues ), std::end( queues ),
+		[]( auto& queue ) { return ( queue.flags & VK_QUEUE_TRANSFER_BIT ) && !( queue.flags & VK_QUEUE_GRAPHICS_BIT ); });
+	if ( it == std::end( queues ) )
+	{
+		// Graphics queues support transfer implicitly
+		return find_graphics_queue();
+	}
+	return *it;
+}
+
+
 Queue& Device::find_present_queue( VkSurfaceKHR surface )
 {
 	auto it = std::find_if( std::begin( queues ), std::end( queues ),
@@ -369,6 +446,14 @@ void Fence::wait() const
 }
 
 
+bool Fence::is_signaled() const
+{
+	auto res = vkGetFenceStatus( device.handle, handle );
+	assert( ( res == VK_SUCCESS || res == VK_NOT_READY ) && "Cannot get fence status" );
+	return res == VK_SUCCESS;
+}
+
+
 void Fence::reset()
 {
 	auto res = vkResetFences( device.handle, 1, &handle );
@@ -740,59 +825,90 @@ VkRect2D create_scissor( const Window& window )
 }
 
 
-std::vector<VkDescriptorSetLayoutBinding> get_line_bindings()
-{
-	VkDescriptorSetLayoutBinding binding = {};
-	binding.binding = 0;
-	binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	binding.descriptorCount = 1;
-	binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-
-	return { binding };
-}
-
-
-std::vector<VkDescriptorSetLayoutBinding> get_mesh_no_image_bindings()
+/// @return Bindings of set 0, with data which changes once per frame
+/// It is the same for every pipeline layout, so it stays bound across pipeline changes
+std::vector<VkDescriptorSetLayoutBinding> get_frame_bindings()
 {
-	VkDescriptorSetLayoutBinding mvp = {};
-	mvp.binding = 0;
-	mvp.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	mvp.descriptorCount = 1;
-	mvp.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	VkDescriptorSetLayoutBinding view = {};
+	view.binding = 0;
+	view.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	view.descriptorCount = 1;
+	view.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
 	VkDescriptorSetLayoutBinding ambient = {};
 	ambient.binding = 1;
-	ambient.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	ambient.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	ambient.descriptorCount = 1;
 	ambient.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
 	VkDescriptorSetLayoutBinding light = {};
 	light.binding = 2;
-	light.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	light.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	light.descriptorCount = 1;
 	light.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
+	return { view, ambient, light };
+}
+
+
+/// @return Bindings of set 2, with an array of instance data indexed by gl_InstanceIndex
+std::vector<VkDescriptorSetLayoutBinding> get_object_bindings()
+{
+	VkDescriptorSetLayoutBinding model = {};
+	model.binding = 0;
+	model.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+	model.descriptorCount = 1;
+	model.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+	return { model };
+}
+
+
+/// @return Push constants with object data, which are the same for every pipeline layout
+/// so that sets bound with one layout stay compatible with the others
+std::vector<VkPushConstantRange> get_push_constant_ranges()
+{
+	VkPushConstantRange range = {};
+	range.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	range.offset = 0;
+	range.size = sizeof( ObjectConstants );
+
+	return { range };
+}
+
+
+/// @return Bindings of the line pipeline, which has no material set
+std::vector<std::vector<VkDescriptorSetLayoutBinding>> get_line_bindings()
+{
+	return { get_frame_bindings(), {}, get_object_bindings() };
+}
+
+
+/// @return Bindings of the mesh pipeline without image, where the material set has only the array of materials
+std::vector<std::vector<VkDescriptorSetLayoutBinding>> get_mesh_no_image_bindings()
+{
 	VkDescriptorSetLayoutBinding material = {};
-	material.binding = 3;
-	material.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	material.binding = 0;
+	material.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
 	material.descriptorCount = 1;
 	material.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-	return { mvp, ambient, light, material };
+	return { get_frame_bindings(), { material }, get_object_bindings() };
 }
 
 
-std::vector<VkDescriptorSetLayoutBinding> get_mesh_bindings()
+/// @return Bindings of the mesh pipeline, where the material set has the texture as well
+std::vector<std::vector<VkDescriptorSetLayoutBinding>> get_mesh_bindings()
 {
 	auto ret = get_mesh_no_image_bindings();
 
 	VkDescriptorSetLayoutBinding sampler = {};
-	sampler.binding = 4;
+	sampler.binding = 1;
 	sampler.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 	sampler.descriptorCount = 1;
 	sampler.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-	ret.emplace_back( sampler );
+	ret[1].emplace_back( sampler );
 	return ret;
 }
 
@@ -806,13 +922,13 @@ Graphics::Graphics()
 , render_pass { swapchain }
 , line_vert { device, "shader/line.vert.spv" }
 , line_frag { device, "shader/line.frag.spv" }
-, line_layout { device, get_line_bindings() }
+, line_layout { device, get_line_bindings(), get_push_constant_ranges() }
 , mesh_vert { device, "shader/mesh.vert.spv" }
 , mesh_frag { device, "shader/mesh.frag.spv" }
 , mesh_no_image_vert { device, "shader/mesh-no-image.vert.spv" }
 , mesh_no_image_frag { device, "shader/mesh-no-image.frag.spv" }
-, mesh_layout { device, get_mesh_bindings() }
-, mesh_no_image_layout { device, get_mesh_no_image_bindings() }
+, mesh_layout { device, get_mesh_bindings(), get_push_constant_ranges() }
+, mesh_no_image_layout { device, get_mesh_no_image_bindings(), get_push_constant_ranges() }
 , viewport { window, camera }
 , scissor { create_scissor( window ) }
 , renderer { *this }
@@ -821,16 +937,33 @@ Graphics::Graphics()
 , framebuffers { frames.create_framebuffers( render_pass ) }
 , graphics_queue { device.find_graphics_queue() }
 , present_queue { device.find_present_queue( surface.handle ) }
+, textures { device }
+, placeholder { device, VkExtent2D { 1, 1 }, VK_FORMAT_R8G8B8A8_UNORM }
+, placeholder_view { placeholder }
 {
+	// The placeholder is uploaded right away, as it may be sampled by the first frame
+	auto staging = Buffer( device, 4, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryUsage::CPU_TO_GPU );
+	std::memset( staging.map( 4 ), 0xff, 4 );
+	staging.unmap();
+	placeholder.upload( staging );
+
 	for ( size_t i = 0; i < swapchain.images.size(); ++i )
 	{
 		images_available.emplace_back( device );
 		images_drawn.emplace_back( device );
 		frames_in_flight.emplace_back( device );
 	}
+
+	recorders.resize( swapchain.images.size() );
 }
 
 
+Graphics::Recorder::Recorder( Device& d )
+: command_pool { d }
+, command_buffer { command_pool.allocate_command_buffers( 1, VK_COMMAND_BUFFER_LEVEL_SECONDARY )[0] }
+{}
+
+
 bool Graphics::render_begin()
 {
 	std::rotate(std::begin(images_available), ++std::begin(images_available), std::end(images_available));
@@ -880,18 +1013,365 @@ bool Graphics::render_begin()
 	current_frame_in_flight->wait();
 	current_frame_in_flight->reset();
 
+	// The GPU is done with uniform data of this frame
+	renderer.uniform_allocators[current_frame_index].reset();
+	renderer.begin_frame( current_frame_index );
+
+	// Descriptor sets of destroyed textures go away with them
+	for ( auto view : textures.collect( renderer.frame_number, swapchain.images.size() + 1 ) )
+	{
+		renderer.remove_texture( view );
+	}
+
 	current_command_buffer = &command_buffers[image_index];
 	current_framebuffer = &framebuffers[image_index];
 
+	// The render pass begins at render end, once it is known how draws are recorded
 	current_command_buffer->begin();
-	current_command_buffer->begin_render_pass( render_pass, *current_framebuffer );
+
+	// Acquire completed uploads before any draw may use them
+	device.uploads->poll( *current_command_buffer );
+	update_pending_textures();
+
+	upload_frame_data();
 
 	return true;
 }
 
 
+void Graphics::update_pending_textures()
+{
+	auto it = std::remove_if( std::begin( pending_textures ), std::end( pending_textures ),
+		[this]( auto& pending ) {
+			if ( !textures.is_ready( pending.view ) )
+			{
+				return false;
+			}
+			pending.material->texture = pending.view;
+			return true;
+		}
+	);
+	pending_textures.erase( it, std::end( pending_textures ) );
+}
+
+
+void Graphics::upload_frame_data()
+{
+	auto& uniforms = renderer.uniform_allocators[current_frame_index];
+
+	ViewUbo view_ubo;
+	view_ubo.view = camera.get_view();
+	view_ubo.proj = camera.get_proj();
+	frame_offsets[0] = uniforms.upload( view_ubo );
+
+	frame_offsets[1] = uniforms.upload( ambient.ubo );
+
+	LightUbo light_ubo = {};
+	if ( light_node && light_node->light )
+	{
+		light_ubo.position = light_node->translation;
+		light_ubo.color = light_node->light->color;
+	}
+	frame_offsets[2] = uniforms.upload( light_ubo );
+
+	draw_list.clear();
+	draw_list.view = view_ubo.view;
+}
+
+
+void Graphics::bind_frame_data( CommandBuffer& command_buffer )
+{
+	// Set 0 is defined the same way in every pipeline layout,
+	// therefore it stays bound for the whole command buffer
+	auto frame_set = renderer.frame_sets[current_frame_index];
+	command_buffer.bind_descriptor_sets( mesh_layout, frame_set, 0, frame_offsets.size(), frame_offsets.data() );
+}
+
+
+void Graphics::prepare_batches()
+{
+	auto& uniforms = renderer.uniform_allocators[current_frame_index];
+	auto& packets = draw_list.sort();
+
+	// Instance data is written in sorted order, so that neighbouring packets can be drawn as consecutive instances.
+	// Packets go in chunks of at most max_instances packets and max_materials materials, each chunk with
+	// its own instance and material arrays, so a frame can draw any number of them
+	uint32_t chunk_first = 0;
+	uint32_t instances_offset = 0;
+	uint32_t materials_offset = 0;
+	InstanceData* instances = nullptr;
+	Material::PbrMetallicRoughness* materials = nullptr;
+
+	auto begin_chunk = [&]( const uint32_t first )
+	{
+		chunk_first = first;
+		instances_offset = uniforms.allocate( get_instances_size() );
+		materials_offset = uniforms.allocate( get_materials_size() );
+
+		// Pointers are taken after allocating, as the buffer may grow on any allocation
+		instances = reinterpret_cast<InstanceData*>( uniforms.data + instances_offset );
+		materials = reinterpret_cast<Material::PbrMetallicRoughness*>( uniforms.data + materials_offset );
+		material_indices.clear();
+	};
+
+	// Whether count more packets, with as many new materials at most, fit in the current chunk
+	auto fits = [&]( const uint32_t first, const uint32_t count )
+	{
+		return first + count - chunk_first <= max_instances && material_indices.size() + count <= max_materials;
+	};
+
+	auto get_material_index = [this, &materials]( const Handle<Material>& material ) -> uint32_t
+	{
+		if ( !material )
+		{
+			return 0;
+		}
+
+		auto [it, inserted] = material_indices.emplace( material, uint32_t( material_indices.size() ) );
+		if ( inserted )
+		{
+			materials[it->second] = material->pbr;
+		}
+		return it->second;
+	};
+
+	batches.clear();
+	renderer.indirect_batches.clear();
+	begin_chunk( 0 );
+
+	if ( indirect_draws && device.physical_device.features.drawIndirectFirstInstance == VK_TRUE )
+	{
+		// Every packet reads its data from the instance array, as there are no per-draw push constants
+		for ( uint32_t i = 0; i < packets.size(); ++i )
+		{
+			if ( !fits( i, 1 ) )
+			{
+				// Commands are allocated before the next chunk, while pointers of this one are not needed any longer
+				renderer.build_indirect_batches( packets, chunk_first, i, instances_offset, materials_offset, current_frame_index );
+				begin_chunk( i );
+			}
+
+			instances[i - chunk_first].model = packets[i]->transform;
+			instances[i - chunk_first].material = get_material_index( packets[i]->material );
+		}
+		renderer.build_indirect_batches( packets, chunk_first, packets.size(), instances_offset, materials_offset, current_frame_index );
+		return;
+	}
+
+	// A batch is never larger than an empty chunk
+	constexpr uint32_t max_batch = std::min( max_instances, max_materials );
+
+	uint32_t first = 0;
+	while ( first < packets.size() )
+	{
+		auto packet = packets[first];
+
+		uint32_t count = 1;
+		while ( count < max_batch && first + count < packets.size() && packets[first + count]->can_merge( *packet ) )
+		{
+			++count;
+		}
+
+		if ( !fits( first, count ) )
+		{
+			begin_chunk( first );
+		}
+
+		Batch batch;
+		batch.packet = packet;
+		batch.first = first - chunk_first;
+		batch.count = count;
+		batch.instances_offset = instances_offset;
+		batch.materials_offset = materials_offset;
+
+		// Texture sets are created here, as recording threads only read them
+		if ( packet->material )
+		{
+			batch.material_set = renderer.get_material_set( packet->material, current_frame_index );
+		}
+
+		if ( count == 1 )
+		{
+			// Fast path for a single instance, which does not touch the instance array
+			batch.constants.model = packet->transform;
+			batch.constants.material = get_material_index( packet->material );
+		}
+		else
+		{
+			for ( uint32_t i = first; i < first + count; ++i )
+			{
+				instances[i - chunk_first].model = packets[i]->transform;
+				instances[i - chunk_first].material = get_material_index( packets[i]->material );
+			}
+			batch.constants.instanced = 1;
+		}
+
+		batches.emplace_back( batch );
+		first += count;
+	}
+}
+
+
+void Graphics::record_batches( CommandBuffer& command_buffer, const size_t begin, const size_t end )
+{
+	bind_frame_data( command_buffer );
+
+	auto object_set = renderer.object_sets[current_frame_index];
+
+	for ( size_t i = begin; i < end; ++i )
+	{
+		auto& batch = batches[i];
+		auto packet = batch.packet;
+
+		// The command buffer skips binds which did not change since the previous batch
+		auto& pipeline = *packet->pipeline;
+		command_buffer.bind( pipeline );
+
+		if ( packet->material )
+		{
+			command_buffer.bind_descriptor_sets( pipeline.layout, batch.material_set, 1, 1, &batch.materials_offset );
+		}
+		else if ( device.physical_device.features.wideLines == VK_TRUE )
+		{
+			command_buffer.set_line_width( packet->line_width );
+		}
+
+		command_buffer.bind_descriptor_sets( pipeline.layout, object_set, 2, 1, &batch.instances_offset );
+		command_buffer.push_constants( pipeline.layout, VK_SHADER_STAGE_VERTEX_BIT, sizeof( ObjectConstants ), &batch.constants );
+
+		// Most primitives share the same geometry block, so these binds are usually skipped
+		auto& range = packet->resources->range;
+		auto& block = renderer.geometry.blocks[range.block];
+		command_buffer.bind_vertex_buffer( block.vertex_buffer );
+		command_buffer.bind_index_buffer( block.index_buffer );
+		command_buffer.draw_indexed( packet->index_count, batch.count, batch.first, range.first_index, range.vertex_offset );
+	}
+}
+
+
+void Graphics::record_indirect_batches( CommandBuffer& command_buffer )
+{
+	bind_frame_data( command_buffer );
+
+	auto object_set = renderer.object_sets[current_frame_index];
+	auto& commands_buffer = renderer.uniform_allocators[current_frame_index].buffer;
+
+	ObjectConstants constants;
+	constants.instanced = 1;
+
+	for ( auto& batch : renderer.indirect_batches )
+	{
+		auto& pipeline = *batch.pipeline;
+		command_buffer.bind( pipeline );
+
+		auto& block = renderer.geometry.blocks[batch.block];
+		command_buffer.bind_vertex_buffer( block.vertex_buffer );
+		command_buffer.bind_index_buffer( block.index_buffer );
+
+		if ( batch.material_set != VK_NULL_HANDLE )
+		{
+			command_buffer.bind_descriptor_sets( pipeline.layout, batch.material_set, 1, 1, &batch.materials_offset );
+		}
+		else if ( device.physical_device.features.wideLines == VK_TRUE )
+		{
+			command_buffer.set_line_width( batch.line_width );
+		}
+
+		command_buffer.bind_descriptor_sets( pipeline.layout, object_set, 2, 1, &batch.instances_offset );
+		command_buffer.push_constants( pipeline.layout, VK_SHADER_STAGE_VERTEX_BIT, sizeof( ObjectConstants ), &constants );
+
+		if ( device.physical_device.features.multiDrawIndirect == VK_TRUE )
+		{
+			command_buffer.draw_indexed_indirect( commands_buffer, batch.offset, batch.draw_count );
+		}
+		else
+		{
+			// Without multiDrawIndirect, commands are still read by the GPU but issued one by one
+			for ( uint32_t i = 0; i < batch.draw_count; ++i )
+			{
+				command_buffer.draw_indexed_indirect( commands_buffer, batch.offset + i * sizeof( VkDrawIndexedIndirectCommand ) );
+			}
+		}
+	}
+}
+
+
+void Graphics::record_draws()
+{
+	prepare_batches();
+
+	// Uniform data of the frame is allocated, and no set has been bound yet
+	renderer.update_uniform_sets( current_frame_index );
+
+	// Staged geometry is copied before the render pass which draws it
+	renderer.geometry.flush( *current_command_buffer, current_frame_index );
+
+	size_t thread_count = std::min<size_t>( recording_threads, batches.size() );
+	if ( !renderer.indirect_batches.empty() )
+	{
+		// A few indirect draws are not worth spreading across threads
+		current_command_buffer->begin_render_pass( render_pass, *current_framebuffer );
+		record_indirect_batches( *current_command_buffer );
+	}
+	else if ( thread_count <= 1 )
+	{
+		current_command_buffer->begin_render_pass( render_pass, *current_framebuffer );
+		record_batches( *current_command_buffer, 0, batches.size() );
+	}
+	else
+	{
+		current_command_buffer->begin_render_pass( render_pass, *current_framebuffer, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS );
+
+		// Each thread owns a command pool, as pools can not be used concurrently
+		auto& frame_recorders = recorders[current_frame_index];
+		while ( frame_recorders.size() < thread_count )
+		{
+			frame_recorders.emplace_back( device );
+		}
+
+		VkCommandBufferInheritanceInfo inheritance = {};
+		inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritance.renderPass = render_pass.handle;
+		inheritance.subpass = 0;
+		inheritance.framebuffer = current_framebuffer->handle;
+
+		auto record = [this, &frame_recorders, &inheritance]( const size_t index, const size_t begin, const size_t end )
+		{
+			auto& command_buffer = frame_recorders[index].command_buffer;
+			command_buffer.begin( VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT, &inheritance );
+			record_batches( command_buffer, begin, end );
+			command_buffer.end();
+		};
+
+		// Batches are split into contiguous ranges, which keeps the sorted order
+		// when secondary command buffers are executed one after the other.
+		// Ranges are recorded by the persistent pool, helped by the calling thread
+		size_t range = ( batches.size() + thread_count - 1 ) / thread_count;
+		workers.parallel_for( thread_count, [this, &record, range]( const size_t i ) {
+			size_t begin = std::min( i * range, batches.size() );
+			size_t end = std::min( begin + range, batches.size() );
+			record( i, begin, end );
+		} );
+
+		std::vector<CommandBuffer> secondaries;
+		secondaries.reserve( thread_count );
+		for ( size_t i = 0; i < thread_count; ++i )
+		{
+			secondaries.emplace_back( frame_recorders[i].command_buffer );
+		}
+
+		current_command_buffer->execute( secondaries );
+	}
+
+	batches.clear();
+	draw_list.clear();
+}
+
+
 void Graphics::render_end()
 {
+	record_draws();
+
 	current_command_buffer->end_render_pass();
 	current_command_buffer->end();
 
@@ -912,78 +1392,67 @@ void Graphics::draw( const Handle<Node>& node, const Handle<Mesh>& mesh, const m
 }
 
 
-void Graphics::draw( const Handle<Node>& node, const Primitive& primitive, const math::Mat4& transform )
+const PrimitiveResources& Graphics::get_resources( const Primitive& primitive )
 {
-	auto node_pair = renderer.node_resources.find( node );
-	if ( node_pair == std::end( renderer.node_resources ) )
+	auto prim_it = renderer.primitive_resources.find( primitive.get_hash() );
+	if ( prim_it == std::end( renderer.primitive_resources ) )
 	{
-		renderer.add( node );
-		return;
+		// New geometry, or geometry which was set again
+		renderer.add( primitive );
+		prim_it = renderer.primitive_resources.find( primitive.get_hash() );
 	}
 
-	auto hash_prim = std::hash<Primitive>()( primitive );
-	auto& resources = renderer.primitive_resources.at( hash_prim );
-
-	// Upload MVP UBO
-	MvpUbo ubo;
-	ubo.model = transform;
-	ubo.view  = camera.get_view();
-	ubo.proj  = camera.get_proj();
+	prim_it->second.last_frame = renderer.frame_number;
+	return prim_it->second;
+}
 
-	auto data = reinterpret_cast<const uint8_t*>( &ubo );
 
-	auto& node_resources = node_pair->second;
-	auto& uniform_buffer = node_resources.ubos[current_frame_index];
-	uniform_buffer.upload( data, sizeof( MvpUbo ) );
+void Graphics::push_draw( const Primitive& primitive, const PrimitiveResources& resources, const math::Mat4& transform )
+{
+	auto pipeline_index = select_pipeline( primitive.material );
 
-	size_t hash_desc = std::hash_combine( node, primitive.material );
-	auto desc_it = renderer.descriptor_resources.find( hash_desc );
-	if ( desc_it == std::end( renderer.descriptor_resources ) )
+	// Materials without texture share the same material set
+	size_t material_set = 0;
+	if ( primitive.material && primitive.material->texture != VK_NULL_HANDLE )
 	{
-		desc_it = renderer.add_descriptors( node, primitive.material );
+		material_set = hash_bytes( &primitive.material->texture, sizeof( VkImageView ) );
 	}
-	auto& descriptor_resources = desc_it->second;
-	auto& pipeline = renderer.pipelines[descriptor_resources.pipeline];
-	current_command_buffer->bind( pipeline );
 
-	if ( primitive.material )
-	{
-		// Upload Material UBO
-		auto material_data = reinterpret_cast<const uint8_t*>( &primitive.material->pbr );
-		auto& material_resources = renderer.material_resources.at( primitive.material );
-		auto& material_ubo = material_resources.ubos[current_frame_index];
-		material_ubo.upload( material_data, sizeof( Material::PbrMetallicRoughness ) );
-
-		// Upload Ambient UBO
-		auto ambient_data = reinterpret_cast<const uint8_t*>( &ambient.ubo );
-		auto& ambient_ubo = renderer.ambient_resources.ubos[current_frame_index];
-		ambient_ubo.upload( ambient_data, sizeof( Ambient::Ubo ) );
-
-		// Upload Light UBO
-		assert( light_node && light_node->light && "There is no node with light" );
-		LightUbo light_ubo = {};
-		light_ubo.position = light_node->translation;
-		light_ubo.color = light_node->light->color;
-		auto light_data = reinterpret_cast<const uint8_t*>( &light_ubo );
-		auto& light_res = renderer.light_resources.begin()->second;
-		auto& light_buffer = light_res.ubos[current_frame_index];
-		light_buffer.upload( light_data, sizeof( LightUbo ) );
-	}
-	else // Draw mesh with lines
+	DrawPacket packet;
+	packet.key = DrawList::get_key( pipeline_index, material_set, primitive.get_hash(), draw_list.get_depth( transform ) );
+	packet.pipeline = &renderer.pipelines[pipeline_index];
+	packet.material = primitive.material;
+	packet.resources = &resources;
+	packet.index_count = primitive.get_indices().size();
+	packet.transform = transform;
+	packet.line_width = primitive.line_width;
+	draw_list.push( packet );
+}
+
+
+void Graphics::draw( const Handle<Node>& node, const Primitive& primitive, const math::Mat4& transform )
+{
+	push_draw( primitive, get_resources( primitive ), transform );
+}
+
+
+void Graphics::draw_instanced( const Handle<Mesh>& mesh, const math::Mat4* transforms, const size_t count )
+{
+	for ( auto& primitive : mesh->primitives )
 	{
-		// Check wideline support
-		if ( device.physical_device.features.wideLines == VK_TRUE )
+		// Resources are looked up once for all the instances
+		auto& resources = get_resources( primitive );
+		for ( size_t i = 0; i < count; ++i )
 		{
-			current_command_buffer->set_line_width( primitive.line_width );
+			push_draw( primitive, resources, transforms[i] );
 		}
 	}
+}
 
-	current_command_buffer->bind_vertex_buffer( resources.vertex_buffer );
-	current_command_buffer->bind_index_buffer( resources.index_buffer );
 
-	auto& descriptor_set = descriptor_resources.descriptor_sets[current_frame_index];
-	current_command_buffer->bind_descriptor_sets( pipeline.layout, descriptor_set );
-	current_command_buffer->draw_indexed( primitive.indices.size() );
+void Graphics::draw_instanced( const Handle<Mesh>& mesh, const std::vector<math::Mat4>& transforms )
+{
+	draw_instanced( mesh, transforms.data(), transforms.size() );
 }
 
 
@@ -1,44 +1,141 @@
 #include "spot/gfx/images.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <spot/log.h>
 
 #include "spot/gfx/png.h"
+#include "spot/gfx/compressed.h"
+#include "spot/gfx/hash.h"
 #include "spot/gfx/graphics.h"
 
 namespace spot::gfx
 {
 
-VkFormat get_format( Png& png )
+/// @return Format of decoded texels with these channels and bits per channel
+/// @param srgb Whether 8 bit color is encoded in sRGB, there are no 16 bit sRGB formats
+VkFormat get_format( const png_byte channels, const int bit_depth, const bool srgb )
 {
-	switch ( png.color_type )
+	if ( bit_depth == 16 )
 	{
-	case PNG_COLOR_TYPE_RGB:
+		switch ( channels )
+		{
+		case 1: return VK_FORMAT_R16_UNORM;
+		case 2: return VK_FORMAT_R16G16_UNORM;
+		case 3: return VK_FORMAT_R16G16B16_UNORM;
+		case 4: return VK_FORMAT_R16G16B16A16_UNORM;
+		}
+	}
+	else if ( bit_depth == 8 )
 	{
-		assert( png.bit_depth == 8 && png.channels == 3 );
-		return VK_FORMAT_R8G8B8_UNORM;
+		switch ( channels )
+		{
+		case 1: return VK_FORMAT_R8_UNORM;
+		case 2: return VK_FORMAT_R8G8_UNORM;
+		case 3: return srgb ? VK_FORMAT_R8G8B8_SRGB : VK_FORMAT_R8G8B8_UNORM;
+		case 4: return srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+		}
 	}
-	case PNG_COLOR_TYPE_RGB_ALPHA:
+
+	assert( false && "Vulkan format not supported" );
+	return VK_FORMAT_UNDEFINED;
+}
+
+
+/// @return Whether images of this format can be sampled with this tiling
+bool can_sample( const PhysicalDevice& physical_device, const VkFormat format, const VkImageTiling tiling )
+{
+	auto props = physical_device.get_format_properties( format );
+	auto features = tiling == VK_IMAGE_TILING_OPTIMAL ? props.optimalTilingFeatures : props.linearTilingFeatures;
+	return features & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT;
+}
+
+
+/// @brief Selects the most compact format the device can sample, converting the png to match it
+/// Native channels and bit depth come first, then 8 bits per channel, then RGBA which every device samples.
+/// Formats with optimal tiling are preferred, as linear images are slower to sample and have a single level.
+VkFormat get_format( const PhysicalDevice& physical_device, Png& png, const bool srgb )
+{
+	const png_byte channels[] = { png.channels, 4 };
+	const int bit_depths[] = { png.bit_depth, 8 };
+
+	for ( auto tiling : { VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_TILING_LINEAR } )
 	{
-		assert( png.bit_depth == 8 && png.channels == 4 );
-		return VK_FORMAT_R8G8B8A8_UNORM;
+		for ( auto bit_depth : bit_depths )
+		{
+			for ( auto channel_count : channels )
+			{
+				auto format = get_format( channel_count, bit_depth, srgb );
+				if ( can_sample( physical_device, format, tiling ) )
+				{
+					png.convert( channel_count, bit_depth );
+					return format;
+				}
+			}
+		}
 	}
+
+	assert( false && "Cannot sample any format for this png" );
+	return VK_FORMAT_UNDEFINED;
+}
+
+
+/// @return Size in bytes of a texel of an uncompressed color format, or of a 4x4 block of a compressed one
+VkDeviceSize get_texel_size( const VkFormat format )
+{
+	switch ( format )
+	{
+	case VK_FORMAT_R8_UNORM: return 1;
+	case VK_FORMAT_R8G8_UNORM: return 2;
+	case VK_FORMAT_R8G8B8_UNORM:
+	case VK_FORMAT_R8G8B8_SRGB: return 3;
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB: return 4;
+	case VK_FORMAT_R16_UNORM: return 2;
+	case VK_FORMAT_R16G16_UNORM: return 4;
+	case VK_FORMAT_R16G16B16_UNORM: return 6;
+	case VK_FORMAT_R16G16B16A16_UNORM: return 8;
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC4_UNORM_BLOCK:
+	case VK_FORMAT_BC4_SNORM_BLOCK: return 8;
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC5_UNORM_BLOCK:
+	case VK_FORMAT_BC5_SNORM_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK: return 16;
 	default:
-		assert( false && "Vulkan format not supported" );
+		assert( false && "Texel size of format not supported" );
 	}
 
-	return VK_FORMAT_UNDEFINED;
+	return 0;
 }
 
 
-Image::Image( Device& d, Png& png )
-: Image { d, { png.width, png.height }, get_format( png ) }
+/// @return Whether texels of the format are stored in blocks of 4x4
+bool is_block_compressed( const VkFormat format )
+{
+	return format >= VK_FORMAT_BC1_RGB_UNORM_BLOCK && format <= VK_FORMAT_BC7_SRGB_BLOCK;
+}
+
+
+Image::Image( Device& d, Png& png, const uint32_t levels, const bool srgb )
+: Image { d, { png.width, png.height }, get_format( d.physical_device, png, srgb ), levels }
 {}
 
 
-Image::Image( Device& d, const VkExtent2D ext, const VkFormat fmt )
+Image::Image( Device& d, const VkExtent2D ext, const VkFormat fmt, const uint32_t levels )
 : device { d }
 , extent { ext.width, ext.height, 1 }
 , format { fmt }
+, mip_levels { levels }
 , command_pool { d }
 {
 	// Check format
@@ -46,7 +143,6 @@ Image::Image( Device& d, const VkExtent2D ext, const VkFormat fmt )
 	auto props = d.physical_device.get_format_properties( fmt );
 
 	// Select proper tiling
-	VkImageTiling tiling = {};
 	if ( props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT )
 	{
 		tiling = VK_IMAGE_TILING_OPTIMAL;
@@ -54,6 +150,9 @@ Image::Image( Device& d, const VkExtent2D ext, const VkFormat fmt )
 	else if ( props.linearTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT )
 	{
 		tiling = VK_IMAGE_TILING_LINEAR;
+
+		// Linear images are only guaranteed to support a single level
+		mip_levels = 1;
 	}
 	else
 	{
@@ -65,12 +164,17 @@ Image::Image( Device& d, const VkExtent2D ext, const VkFormat fmt )
 	info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
 	info.imageType = VK_IMAGE_TYPE_2D;
 	info.extent = extent;
-	info.mipLevels = 1;
+	info.mipLevels = mip_levels;
 	info.arrayLayers = 1;
 	info.tiling = tiling;
 	info.format = format;
 	info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
 	info.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	if ( mip_levels > 1 )
+	{
+		// Each level is blitted from the previous one
+		info.usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+	}
 	if ( format == VK_FORMAT_D32_SFLOAT )
 	{
 		info.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
@@ -86,18 +190,12 @@ Image::Image( Device& d, const VkExtent2D ext, const VkFormat fmt )
 		VkMemoryRequirements requirements;
 		vkGetImageMemoryRequirements( device.handle, handle, &requirements);
 
-		VkMemoryAllocateInfo info = {};
-		info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-		info.allocationSize = requirements.size;
 		auto memory_type = device.physical_device.get_memory_type(
 			requirements.memoryTypeBits,
 			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT );
-		info.memoryTypeIndex = memory_type;
-
-		auto res = vkAllocateMemory( device.handle, &info, nullptr, &memory );
-		assert( res == VK_SUCCESS && "Cannot allocate memory for image" );
+		memory = device.allocator->allocate( requirements, memory_type, tiling == VK_IMAGE_TILING_LINEAR );
 
-		res = vkBindImageMemory( device.handle, handle, memory, 0 );
+		auto res = vkBindImageMemory( device.handle, handle, memory.memory, memory.offset );
 		assert( res == VK_SUCCESS && "Cannot bind image memory" );
 	}
 }
@@ -107,8 +205,8 @@ Image::~Image()
 {
 	if ( handle != VK_NULL_HANDLE )
 	{
-		vkFreeMemory( device.handle, memory, nullptr );
 		vkDestroyImage( device.handle, handle, nullptr );
+		device.allocator->free( memory );
 	}
 }
 
@@ -117,13 +215,15 @@ Image::Image( Image&& other )
 : device { other.device }
 , extent { other.extent }
 , format { other.format }
+, mip_levels { other.mip_levels }
+, tiling { other.tiling }
 , handle { other.handle }
 , memory { other.memory }
 , layout { other.layout }
 , command_pool { std::move( other.command_pool ) }
 {
 	other.handle = VK_NULL_HANDLE;
-	other.memory = VK_NULL_HANDLE;
+	other.memory = {};
 }
 
 
@@ -132,6 +232,8 @@ Image& Image::operator=( Image&& other )
 	assert( device.handle == other.device.handle && "Cannot move images from different device" );
 	std::swap( extent, other.extent );
 	std::swap( format, other.format );
+	std::swap( mip_levels, other.mip_levels );
+	std::swap( tiling, other.tiling );
 	std::swap( handle, other.handle );
 	std::swap( memory, other.memory );
 	std::swap( layout, other.layout );
@@ -177,6 +279,46 @@ void Image::upload( Buffer& buffer )
 }
 
 
+uint32_t Image::get_full_mip_levels( const VkExtent2D extent )
+{
+	uint32_t levels = 1;
+	for ( auto size = std::max( extent.width, extent.height ); size > 1; size /= 2 )
+	{
+		++levels;
+	}
+	return levels;
+}
+
+
+bool Image::supports_linear_blit() const
+{
+	auto props = device.physical_device.get_format_properties( format );
+	auto features = tiling == VK_IMAGE_TILING_OPTIMAL ? props.optimalTilingFeatures : props.linearTilingFeatures;
+	auto required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+	return ( features & required ) == required;
+}
+
+
+std::vector<VkDeviceSize> Image::get_level_offsets() const
+{
+	auto texel_size = get_texel_size( format );
+	auto alignment = 4 * texel_size;
+
+	// Compressed levels are made of whole blocks, counted as texels
+	auto block = is_block_compressed( format ) ? 4u : 1u;
+
+	std::vector<VkDeviceSize> offsets( mip_levels + 1 );
+	for ( uint32_t level = 0; level < mip_levels; ++level )
+	{
+		auto width = ( std::max( extent.width >> level, 1u ) + block - 1 ) / block;
+		auto height = ( std::max( extent.height >> level, 1u ) + block - 1 ) / block;
+		auto end = offsets[level] + width * height * texel_size;
+		offsets[level + 1] = ( end + alignment - 1 ) / alignment * alignment;
+	}
+	return offsets;
+}
+
+
 VkImageAspectFlags get_aspect( const Image& image )
 {
 	if ( image.format == VK_FORMAT_D32_SFLOAT )
@@ -190,6 +332,23 @@ VkImageAspectFlags get_aspect( const Image& image )
 }
 
 
+/// @brief Gray images are stored with one or two channels, while shaders sample them as RGBA
+VkComponentMapping get_components( const VkFormat format )
+{
+	switch ( format )
+	{
+	case VK_FORMAT_R8_UNORM:
+	case VK_FORMAT_R16_UNORM:
+		return { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_ONE };
+	case VK_FORMAT_R8G8_UNORM:
+	case VK_FORMAT_R16G16_UNORM:
+		return { VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G };
+	default:
+		return {};
+	}
+}
+
+
 ImageView::ImageView( const Image& image )
 : device { image.device }
 {
@@ -198,9 +357,10 @@ ImageView::ImageView( const Image& image )
 	info.image = image.handle;
 	info.viewType = VK_IMAGE_VIEW_TYPE_2D;
 	info.format = image.format;
+	info.components = get_components( image.format );
 	info.subresourceRange.aspectMask = get_aspect( image );
 	info.subresourceRange.baseMipLevel = 0;
-	info.subresourceRange.levelCount = 1;
+	info.subresourceRange.levelCount = image.mip_levels;
 	info.subresourceRange.baseArrayLayer = 0;
 	info.subresourceRange.layerCount = 1;
 
@@ -259,7 +419,8 @@ Sampler::Sampler( Device& d )
 	info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
 	info.mipLodBias = 0.0f;
 	info.minLod = 0.0f;
-	info.maxLod = 0.0f;
+	// Every level of the image view may be sampled
+	info.maxLod = VK_LOD_CLAMP_NONE;
 
 	auto res = vkCreateSampler( device.handle, &info, nullptr, &handle );
 	assert( res == VK_SUCCESS && "Cannot create sampler" );
@@ -291,83 +452,397 @@ Sampler& Sampler::operator=( Sampler&& other )
 }
 
 
-Images::Images( Device& d )
-: device { d }
+Images::Images( Device& d, const VkDeviceSize b )
+: budget { b }
+, device { d }
 {}
 
 
-VkImageView Images::load( const char* name, std::vector<uint8_t>& mem )
+/// @return Key of an image file, so that different paths to the same file share it
+std::string get_path_key( const std::string& path )
 {
-	VkImageView ret = VK_NULL_HANDLE;
+	return std::filesystem::weakly_canonical( path ).string();
+}
 
-	auto it = images.find( name );
-	if ( it == std::end( images ) )
+
+VkImageView Images::acquire( const std::string& key )
+{
+	auto it = entries.find( key );
+	if ( it == std::end( entries ) )
 	{
-		auto png = Png( mem );
-		auto png_size = png.get_size();
-		auto staging_buffer = Buffer( device, png_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT );
-		auto mem = reinterpret_cast<png_byte*>( staging_buffer.map( png_size ) );
-		png.load( mem );
-		staging_buffer.unmap();
+		++misses;
+		return VK_NULL_HANDLE;
+	}
+
+	++hits;
+	++it->second.references;
+	return it->second.view.handle;
+}
 
-		auto image = Image( device, png );
-		image.upload( staging_buffer );
-		auto view = ImageView( image );
-		ret = view.handle;
 
-		auto pair = std::make_pair( std::move( image ), std::move( view ) );
-		auto[res, ok] = images.emplace( name, std::move( pair ) );
-		assert( ok && "Cannot store image" );
+Image& Images::insert( const std::string& key, Image&& image )
+{
+	auto view = ImageView( image );
+	auto handle = view.handle;
+
+	resident_bytes += image.memory.size;
+
+	auto[it, ok] = entries.emplace( key, Entry { std::move( image ), std::move( view ), 1, frame_number } );
+	assert( ok && "Cannot store image" );
+	keys.emplace( handle, key );
+
+	return it->second.image;
+}
+
+
+/// @brief Halves a level with a box filter, clamping at odd edges
+/// @tparam T Type of a channel, 8 or 16 bits
+template <typename T>
+void downsample( const T* src, const uint32_t width, const uint32_t height, const uint32_t channels, T* dst )
+{
+	auto dst_width = std::max( width / 2, 1u );
+	auto dst_height = std::max( height / 2, 1u );
+
+	for ( uint32_t y = 0; y < dst_height; ++y )
+	{
+		auto y0 = std::min( y * 2, height - 1 );
+		auto y1 = std::min( y * 2 + 1, height - 1 );
+		for ( uint32_t x = 0; x < dst_width; ++x )
+		{
+			auto x0 = std::min( x * 2, width - 1 );
+			auto x1 = std::min( x * 2 + 1, width - 1 );
+			for ( uint32_t c = 0; c < channels; ++c )
+			{
+				uint32_t sum = src[( y0 * width + x0 ) * channels + c] + src[( y0 * width + x1 ) * channels + c] +
+					src[( y1 * width + x0 ) * channels + c] + src[( y1 * width + x1 ) * channels + c];
+				dst[( y * dst_width + x ) * channels + c] = T( ( sum + 2 ) / 4 );
+			}
+		}
 	}
-	else
+}
+
+
+/// @brief Decodes a png into staging memory and uploads it with its levels
+/// @return Ticket of the upload
+UploadTicket upload_png( UploadManager& uploads, Png& png, Image& image )
+{
+	if ( image.mip_levels == 1 || image.supports_linear_blit() )
+	{
+		// Rows are decoded straight into staging memory, aligned to both the texel size and 4 bytes
+		auto staging = uploads.reserve( png.get_size(), 4 * png.get_texel_size() );
+		png.load( staging.data );
+		return uploads.upload( std::move( staging ), image, image.mip_levels > 1 );
+	}
+
+	// Levels are generated on the CPU, from system memory as staging memory is slow to read back
+	auto offsets = image.get_level_offsets();
+	std::vector<uint8_t> levels( offsets.back() );
+	png.load( levels.data() );
+	for ( uint32_t level = 1; level < image.mip_levels; ++level )
+	{
+		auto width = std::max( image.extent.width >> ( level - 1 ), 1u );
+		auto height = std::max( image.extent.height >> ( level - 1 ), 1u );
+		auto src = levels.data() + offsets[level - 1];
+		auto dst = levels.data() + offsets[level];
+		if ( png.bit_depth == 16 )
+		{
+			// Offsets are aligned to the texel size, so channels are aligned too
+			downsample( reinterpret_cast<const uint16_t*>( src ), width, height, png.channels, reinterpret_cast<uint16_t*>( dst ) );
+		}
+		else
+		{
+			downsample( src, width, height, png.channels, dst );
+		}
+	}
+
+	auto staging = uploads.reserve( levels.size(), 4 * png.get_texel_size() );
+	std::memcpy( staging.data, levels.data(), levels.size() );
+	return uploads.upload( std::move( staging ), image );
+}
+
+
+uint32_t Images::get_mip_levels( const Png& png ) const
+{
+	return mipmaps ? Image::get_full_mip_levels( { png.width, png.height } ) : 1;
+}
+
+
+VkImageView Images::load( const std::vector<uint8_t>& mem )
+{
+	return load( mem.data(), mem.size() );
+}
+
+
+VkImageView Images::load( const uint8_t* data, const size_t size, const std::string& mime_type )
+{
+	return wait( request( data, size, mime_type ) );
+}
+
+
+VkImageView Images::request( const uint8_t* data, const size_t size, const std::string& mime_type )
+{
+	// Embedded images are identified by their content
+	auto key = "#" + std::to_string( hash_bytes( data, size ) );
+	if ( auto view = acquire( key ) )
+	{
+		return view;
+	}
+
+	if ( CompressedImage::is_container( {}, mime_type ) )
 	{
-		ret = it->second.second.handle;
+		return load_compressed( key, CompressedImage( data, size ) );
 	}
 
-	return ret;
+	// The stored image does not move anymore, so it can be uploaded asynchronously
+	auto png = Png( data, size );
+	auto& image = insert( key, Image( device, png, get_mip_levels( png ), srgb ) );
+	auto view = entries.at( key ).view.handle;
+	tickets.emplace( view, upload_png( *device.uploads, png, image ) );
+
+	return view;
 }
 
 
-VkImageView Images::load( const char* path )
+VkImageView Images::load_compressed( const std::string& key, const CompressedImage& compressed )
 {
-	VkImageView ret = VK_NULL_HANDLE;
+	// Levels of a linear image cannot be relied upon, therefore optimal tiling is required
+	if ( !can_sample( device.physical_device, compressed.format, VK_IMAGE_TILING_OPTIMAL ) )
+	{
+		loge( "Cannot sample format {} of {}\n", int( compressed.format ), key );
+		return VK_NULL_HANDLE;
+	}
 
-	auto it = images.find( path );
-	if ( it == std::end( images ) )
+	// Levels come with the container, as blocks cannot be blitted
+	auto levels = uint32_t( compressed.levels.size() );
+	auto& image = insert( key, Image( device, compressed.extent, compressed.format, levels ) );
+	auto view = entries.at( key ).view.handle;
+
+	auto offsets = image.get_level_offsets();
+	auto staging = device.uploads->reserve( offsets.back(), 4 * get_texel_size( image.format ) );
+	compressed.load( staging.data, offsets );
+	tickets.emplace( view, device.uploads->upload( std::move( staging ), image ) );
+
+	return view;
+}
+
+
+VkImageView Images::load( const std::string& path, const std::string& mime_type )
+{
+	return wait( request( path, mime_type ) );
+}
+
+
+VkImageView Images::request( const std::string& path, const std::string& mime_type )
+{
+	auto key = get_path_key( path );
+	if ( auto view = acquire( key ) )
 	{
-		auto png = Png( path );
-		auto png_size = png.get_size();
-		auto staging_buffer = Buffer( device, png_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT );
-		auto mem = reinterpret_cast<png_byte*>( staging_buffer.map( png_size ) );
-		png.load( mem );
-		staging_buffer.unmap();
+		return view;
+	}
+
+	if ( CompressedImage::is_container( path, mime_type ) )
+	{
+		return load_compressed( key, CompressedImage( path ) );
+	}
+
+	auto png = Png( path );
+	auto& image = insert( key, Image( device, png, get_mip_levels( png ), srgb ) );
+	auto view = entries.at( key ).view.handle;
+	tickets.emplace( view, upload_png( *device.uploads, png, image ) );
+
+	return view;
+}
 
-		auto image = Image( device, png );
-		image.upload( staging_buffer );
-		auto view = ImageView( image );
-		ret = view.handle;
 
-		auto pair = std::make_pair( std::move( image ), std::move( view ) );
-		auto[res, ok] = images.emplace( path, std::move( pair ) );
-		assert( ok && "Cannot store image" );
+VkImageView Images::load_async( const std::string& path, WorkerPool& workers, const std::string& mime_type )
+{
+	auto key = get_path_key( path );
+	if ( auto view = acquire( key ) )
+	{
+		return view;
 	}
-	else
+
+	if ( CompressedImage::is_container( path, mime_type ) )
+	{
+		return load_compressed( key, CompressedImage( path ) );
+	}
+
+	// The header is enough to create the image
+	auto png = std::make_shared<Png>( path );
+	auto& image = insert( key, Image( device, *png, get_mip_levels( *png ), srgb ) );
+	auto view = entries.at( key ).view.handle;
+
+	// Rows are decoded by a worker, and uploads are batched by the upload manager as decodes finish
+	auto task = std::make_shared<std::packaged_task<UploadTicket()>>(
+		[png, &image, &uploads = *device.uploads]() {
+			return upload_png( uploads, *png, image );
+		}
+	);
+	decodes.emplace( view, task->get_future() );
+	workers.push( [task]() { ( *task )(); } );
+
+	return view;
+}
+
+
+VkImageView Images::wait( const VkImageView view )
+{
+	// Decoded by a worker when it was loaded asynchronously first
+	auto decode = decodes.find( view );
+	if ( decode != std::end( decodes ) )
+	{
+		tickets.emplace( view, decode->second.get() );
+		decodes.erase( decode );
+	}
+
+	auto it = tickets.find( view );
+	if ( it != std::end( tickets ) )
 	{
-		ret = it->second.second.handle;
+		device.uploads->wait( it->second );
+		tickets.erase( it );
 	}
 
-	return ret;
+	return view;
 }
 
+
+void Images::release( const VkImageView view )
+{
+	auto key = keys.find( view );
+	assert( key != std::end( keys ) && "Cannot release an unknown image" );
+
+	auto& entry = entries.at( key->second );
+	assert( entry.references > 0 && "Cannot release an image which is not referenced" );
+	--entry.references;
+	entry.last_used = frame_number;
+}
+
+
+bool Images::is_ready( const VkImageView view )
+{
+	auto decode = decodes.find( view );
+	if ( decode != std::end( decodes ) )
+	{
+		if ( decode->second.wait_for( std::chrono::seconds( 0 ) ) != std::future_status::ready )
+		{
+			return false;
+		}
+		tickets.emplace( view, decode->second.get() );
+		decodes.erase( decode );
+	}
+
+	auto it = tickets.find( view );
+	if ( it == std::end( tickets ) )
+	{
+		return true;
+	}
+
+	if ( !device.uploads->is_complete( it->second ) )
+	{
+		return false;
+	}
+
+	tickets.erase( it );
+	return true;
+}
+
+
+std::vector<VkImageView> Images::collect( const uint64_t frame, const uint32_t frames_in_flight )
+{
+	frame_number = frame;
+
+	// Evicted images may still be sampled by frames in flight
+	std::vector<VkImageView> destroyed;
+	auto it = std::remove_if( std::begin( evicted ), std::end( evicted ),
+		[this, frames_in_flight, &destroyed]( auto& eviction ) {
+			if ( eviction.first + frames_in_flight > frame_number )
+			{
+				return false;
+			}
+			destroyed.emplace_back( eviction.second.view.handle );
+			return true;
+		}
+	);
+	evicted.erase( it, std::end( evicted ) );
+
+	// Evict the least recently used images without references
+	while ( resident_bytes > budget )
+	{
+		auto lru = std::end( entries );
+		for ( auto entry = std::begin( entries ); entry != std::end( entries ); ++entry )
+		{
+			// Images still being decoded or uploaded are in use by workers and by the transfer queue
+			auto view = entry->second.view.handle;
+			auto ticket = tickets.find( view );
+			bool uploading = decodes.count( view ) ||
+				( ticket != std::end( tickets ) && !device.uploads->is_complete( ticket->second ) );
+			if ( entry->second.references > 0 || uploading )
+			{
+				continue;
+			}
+			if ( lru == std::end( entries ) || entry->second.last_used < lru->second.last_used )
+			{
+				lru = entry;
+			}
+		}
+
+		if ( lru == std::end( entries ) )
+		{
+			break;
+		}
+
+		++evictions;
+		resident_bytes -= lru->second.image.memory.size;
+		keys.erase( lru->second.view.handle );
+		tickets.erase( lru->second.view.handle );
+		evicted.emplace_back( frame_number, std::move( lru->second ) );
+		entries.erase( lru );
+	}
+
+	return destroyed;
+}
+
+
+Images::Stats Images::get_stats() const
+{
+	Stats stats;
+	stats.hits = hits;
+	stats.misses = misses;
+	stats.evictions = evictions;
+	stats.resident_bytes = resident_bytes;
+	return stats;
+}
+
+
 Images::Images( Images&& o )
-: device { o.device }
-, images { std::move( o.images ) }
+: budget { o.budget }
+, device { o.device }
+, entries { std::move( o.entries ) }
+, keys { std::move( o.keys ) }
+, tickets { std::move( o.tickets ) }
+, decodes { std::move( o.decodes ) }
+, evicted { std::move( o.evicted ) }
+, frame_number { o.frame_number }
+, hits { o.hits }
+, misses { o.misses }
+, evictions { o.evictions }
+, resident_bytes { o.resident_bytes }
 {}
 
 Images& Images::operator=( Images&& o )
 {
 	assert( device == o.device && "Images are not from the same device" );
-	std::swap( images, o.images );
+	std::swap( budget, o.budget );
+	std::swap( entries, o.entries );
+	std::swap( keys, o.keys );
+	std::swap( tickets, o.tickets );
+	std::swap( decodes, o.decodes );
+	std::swap( evicted, o.evicted );
+	std::swap( frame_number, o.frame_number );
+	std::swap( hits, o.hits );
+	std::swap( misses, o.misses );
+	std::swap( evictions, o.evictions );
+	std::swap( resident_bytes, o.resident_bytes );
 	return *this;
 }
 
@@ -0,0 +1,212 @@
+#include "spot/gfx/memory.h"
+
+#include <algorithm>
+#include <cassert>
+
+#include "spot/gfx/graphics.h"
+
+
+namespace spot::gfx
+{
+
+
+DeviceAllocator::DeviceAllocator( const Device& d, const VkDeviceSize bs )
+: device { d }
+, block_size { bs }
+, dedicated_size { bs / 4 }
+{
+	assert( block_size <= RangeAllocator::invalid && "Cannot track blocks larger than 4 GiB" );
+
+	auto& properties = device.physical_device.memory_properties;
+	pools.resize( properties.memoryTypeCount * 2 );
+	for ( uint32_t i = 0; i < pools.size(); ++i )
+	{
+		pools[i].memory_type = i / 2;
+	}
+
+	dedicated_bytes.resize( properties.memoryHeapCount );
+	dedicated_counts.resize( properties.memoryHeapCount );
+}
+
+
+DeviceAllocator::~DeviceAllocator()
+{
+	// Memory is implicitly unmapped when freed
+	for ( auto& pool : pools )
+	{
+		for ( auto& block : pool.blocks )
+		{
+			if ( block.memory != VK_NULL_HANDLE )
+			{
+				vkFreeMemory( device.handle, block.memory, nullptr );
+			}
+		}
+	}
+}
+
+
+VkDeviceMemory DeviceAllocator::allocate_memory( const VkDeviceSize size, const uint32_t memory_type, uint8_t** data )
+{
+	VkMemoryAllocateInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	info.allocationSize = size;
+	info.memoryTypeIndex = memory_type;
+
+	VkDeviceMemory memory = VK_NULL_HANDLE;
+	auto res = vkAllocateMemory( device.handle, &info, nullptr, &memory );
+	assert( res == VK_SUCCESS && "Cannot allocate device memory" );
+
+	*data = nullptr;
+	auto flags = device.physical_device.memory_properties.memoryTypes[memory_type].propertyFlags;
+	if ( flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT )
+	{
+		res = vkMapMemory( device.handle, memory, 0, VK_WHOLE_SIZE, 0, reinterpret_cast<void**>( data ) );
+		assert( res == VK_SUCCESS && "Cannot map device memory" );
+	}
+
+	return memory;
+}
+
+
+Allocation DeviceAllocator::allocate( const VkMemoryRequirements& requirements, const uint32_t memory_type, const bool linear )
+{
+	std::lock_guard<std::mutex> lock { mutex };
+
+	Allocation allocation;
+	allocation.memory_type = memory_type;
+	allocation.size = requirements.size;
+
+	if ( requirements.size >= dedicated_size )
+	{
+		allocation.dedicated = true;
+		allocation.memory = allocate_memory( requirements.size, memory_type, &allocation.data );
+
+		auto heap = device.physical_device.memory_properties.memoryTypes[memory_type].heapIndex;
+		dedicated_bytes[heap] += requirements.size;
+		++dedicated_counts[heap];
+		return allocation;
+	}
+
+	allocation.pool = memory_type * 2 + ( linear ? 1 : 0 );
+	auto& pool = pools[allocation.pool];
+
+	auto size = uint32_t( requirements.size );
+	auto alignment = uint32_t( requirements.alignment );
+
+	for ( allocation.block = 0; allocation.block < pool.blocks.size(); ++allocation.block )
+	{
+		auto& block = pool.blocks[allocation.block];
+		if ( block.memory == VK_NULL_HANDLE )
+		{
+			continue;
+		}
+
+		auto offset = block.ranges.allocate( size, alignment );
+		if ( offset != RangeAllocator::invalid )
+		{
+			allocation.memory = block.memory;
+			allocation.offset = offset;
+			allocation.data = block.data ? block.data + offset : nullptr;
+			return allocation;
+		}
+	}
+
+	// Reuse the slot of a released block, so that indices of other blocks do not change
+	for ( allocation.block = 0; allocation.block < pool.blocks.size(); ++allocation.block )
+	{
+		if ( pool.blocks[allocation.block].memory == VK_NULL_HANDLE )
+		{
+			break;
+		}
+	}
+	if ( allocation.block == pool.blocks.size() )
+	{
+		pool.blocks.emplace_back();
+	}
+
+	auto& block = pool.blocks[allocation.block];
+	block.memory = allocate_memory( block_size, memory_type, &block.data );
+	block.ranges = RangeAllocator( uint32_t( block_size ) );
+
+	auto offset = block.ranges.allocate( size, alignment );
+	assert( offset != RangeAllocator::invalid && "Cannot allocate from a new block" );
+
+	allocation.memory = block.memory;
+	allocation.offset = offset;
+	allocation.data = block.data ? block.data + offset : nullptr;
+	return allocation;
+}
+
+
+void DeviceAllocator::free( const Allocation& allocation )
+{
+	std::lock_guard<std::mutex> lock { mutex };
+
+	if ( allocation.dedicated )
+	{
+		vkFreeMemory( device.handle, allocation.memory, nullptr );
+
+		auto heap = device.physical_device.memory_properties.memoryTypes[allocation.memory_type].heapIndex;
+		dedicated_bytes[heap] -= allocation.size;
+		--dedicated_counts[heap];
+		return;
+	}
+
+	auto& pool = pools[allocation.pool];
+	auto& block = pool.blocks[allocation.block];
+	block.ranges.free( uint32_t( allocation.offset ), uint32_t( allocation.size ) );
+
+	if ( block.ranges.get_free_size() < block.ranges.capacity )
+	{
+		return;
+	}
+
+	// Keep one empty block around, to avoid allocating again right away,
+	// so this one goes only when another block is empty as well
+	auto other = std::find_if( std::begin( pool.blocks ), std::end( pool.blocks ),
+		[&block]( auto& b ) {
+			return &b != &block && b.memory != VK_NULL_HANDLE && b.ranges.get_free_size() == b.ranges.capacity;
+		}
+	);
+	if ( other != std::end( pool.blocks ) )
+	{
+		vkFreeMemory( device.handle, block.memory, nullptr );
+		block.memory = VK_NULL_HANDLE;
+		block.data = nullptr;
+	}
+}
+
+
+std::vector<DeviceAllocator::HeapStats> DeviceAllocator::get_stats() const
+{
+	std::lock_guard<std::mutex> lock { mutex };
+
+	auto& properties = device.physical_device.memory_properties;
+	std::vector<HeapStats> stats( properties.memoryHeapCount );
+
+	for ( auto& pool : pools )
+	{
+		auto& heap = stats[properties.memoryTypes[pool.memory_type].heapIndex];
+		for ( auto& block : pool.blocks )
+		{
+			if ( block.memory != VK_NULL_HANDLE )
+			{
+				heap.allocated += block_size;
+				heap.used += block.ranges.capacity - block.ranges.get_free_size();
+				++heap.block_count;
+			}
+		}
+	}
+
+	for ( uint32_t i = 0; i < stats.size(); ++i )
+	{
+		stats[i].allocated += dedicated_bytes[i];
+		stats[i].used += dedicated_bytes[i];
+		stats[i].dedicated_count = dedicated_counts[i];
+	}
+
+	return stats;
+}
+
+
+} // namespace spot::gfx
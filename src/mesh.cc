@@ -2,20 +2,51 @@
 
 #include "spot/gltf/gltf.h"
 #include "spot/gltf/node.h"
+#include "spot/gfx/hash.h"
 
 
 namespace spot::gfx
 {
 
+Primitive::Primitive()
+{
+	update_hash();
+}
+
+
 Primitive::Primitive(
 	std::vector<Vertex> v,
 	std::vector<Index> i,
 	const Handle<Material>& m
 )
-: vertices { std::move( v ) }
+: material { m }
+, vertices { std::move( v ) }
 , indices { std::move( i ) }
-, material { m }
-{}
+{
+	update_hash();
+}
+
+
+void Primitive::set_geometry( std::vector<Vertex> v, std::vector<Index> i )
+{
+	vertices = std::move( v );
+	indices = std::move( i );
+	update_hash();
+}
+
+
+void Primitive::set_vertices( std::vector<Vertex> v )
+{
+	vertices = std::move( v );
+	update_hash();
+}
+
+
+void Primitive::update_hash()
+{
+	auto vertices_hash = hash_bytes( vertices.data(), vertices.size() * sizeof( Vertex ) );
+	hash = hash_bytes( indices.data(), indices.size() * sizeof( Index ), vertices_hash );
+}
 
 
 Mesh Mesh::create_line( const math::Vec3& a, const math::Vec3& b, const Color& c, const float line_width )
@@ -24,13 +55,13 @@ Mesh Mesh::create_line( const math::Vec3& a, const math::Vec3& b, const Color& c
 
 	Primitive prim;
 
-	prim.vertices.resize( 2 );
-	prim.vertices[0].p = a;
-	prim.vertices[0].c = c;
-	prim.vertices[1].p = b;
-	prim.vertices[1].c = c;
+	std::vector<Vertex> vertices( 2 );
+	vertices[0].p = a;
+	vertices[0].c = c;
+	vertices[1].p = b;
+	vertices[1].c = c;
 
-	prim.indices = { 0, 1 };
+	prim.set_geometry( std::move( vertices ), { 0, 1 } );
 
 	prim.line_width = line_width;
 
@@ -132,10 +163,12 @@ Mesh Mesh::create_rect( const math::Vec3& a, const math::Vec3& b, const Color& c
 	auto mesh = create_rect( a, b, Handle<Material>() );
 	for ( auto& prim : mesh.primitives )
 	{
-		for ( auto& vert : prim.vertices )
+		auto vertices = prim.get_vertices();
+		for ( auto& vert : vertices )
 		{
 			vert.c = color;
 		}
+		prim.set_vertices( std::move( vertices ) );
 	}
 	return mesh;
 }
@@ -154,7 +187,8 @@ Mesh Mesh::create_quad( const Handle<Material>& material, const math::Vec3& a, c
 	assert( material && "Cannot create a quad with invalid material" );
 	Mesh ret = create_rect( a, b, material );
 
-	auto& vertices = ret.primitives[0].vertices;
+	auto& prim = ret.primitives[0];
+	auto vertices = prim.get_vertices();
 
 	// Text coords
 	vertices[0].t = math::Vec2( 1.0f, 0.0 ); // a
@@ -162,6 +196,8 @@ Mesh Mesh::create_quad( const Handle<Material>& material, const math::Vec3& a, c
 	vertices[2].t = math::Vec2( 0.0f, 1.0 ); // c
 	vertices[3].t = math::Vec2( 1.0f, 1.0 ); // d
 
+	prim.set_vertices( std::move( vertices ) );
+
 	return ret;
 }
 
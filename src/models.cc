@@ -1,7 +1,10 @@
 #include "spot/gfx/models.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <spot/gltf/gltf.h>
+#include <spot/log.h>
 
 #include "spot/gfx/graphics.h"
 
@@ -28,27 +31,137 @@ Handle<Node> Models::create_text( const std::string& text )
 }
 
 
+/// @brief Converts indices and vertex attributes of a primitive from its accessors
+/// Primitives are independent, so they can be converted concurrently
+void convert( Primitive& p )
+{
+	std::vector<Index> indices;
+
+	// Indices of any unsigned component type
+	if ( auto& accessor = p.indices_handle )
+	{
+		assert( accessor->type == Accessor::Type::SCALAR );
+		indices.resize( accessor->count );
+		AccessorView<Index>( *accessor ).read( indices.data(), sizeof( Index ), 1 );
+	}
+
+	// Vertex attributes
+	std::vector<Vertex> vertices;
+
+	for ( auto [semantic, accessor] : p.attributes )
+	{
+		if ( accessor->count == 0 )
+		{
+			continue;
+		}
+
+		if ( vertices.empty() )
+		{
+			vertices.resize( accessor->count );
+		}
+		assert( vertices.size() == accessor->count && "Attributes of a primitive differ in count" );
+
+		// Every attribute is converted in one pass, whatever its component type and stride
+		auto view = AccessorView<float>( *accessor );
+		auto stride = sizeof( Vertex );
+
+		switch ( semantic )
+		{
+		case Primitive::Semantic::POSITION:
+		{
+			assert( accessor->type == Accessor::Type::VEC3 );
+			view.read( &vertices[0].p.x, stride, 3 );
+			break;
+		}
+		case Primitive::Semantic::NORMAL:
+		{
+			assert( accessor->type == Accessor::Type::VEC3 );
+			view.read( &vertices[0].n.x, stride, 3 );
+			break;
+		}
+		case Primitive::Semantic::TEXCOORD_0:
+		{
+			assert( accessor->type == Accessor::Type::VEC2 );
+			view.read( &vertices[0].t.x, stride, 2 );
+			break;
+		}
+		case Primitive::Semantic::COLOR_0:
+		{
+			// Alpha stays opaque for RGB colors
+			assert( accessor->type == Accessor::Type::VEC3 || accessor->type == Accessor::Type::VEC4 );
+			view.read( &vertices[0].c.r, stride, view.components );
+			break;
+		}
+		default:
+		{
+			assert( false && "Semantic not supported" );
+		}
+		}
+	}
+
+	p.set_geometry( std::move( vertices ), std::move( indices ) );
+}
+
+
+using Clock = std::chrono::steady_clock;
+
+
+/// @return Milliseconds elapsed between two points in time
+int64_t get_ms( const Clock::time_point& begin, const Clock::time_point& end )
+{
+	return std::chrono::duration_cast<std::chrono::milliseconds>( end - begin ).count();
+}
+
+
 Handle<Gltf> Graphics::load_model( const std::string& path )
 {
-	auto model = models.push( Gltf( device, path ) );
+	auto start = Clock::now();
+
+	// Buffers are loaded concurrently by the pool
+	auto model = models.push( Gltf( device, path, &workers ) );
+	auto parsed = Clock::now();
 
 	// Load materials
-	for ( auto& material : *model->materials )
+	for ( size_t i = 0; i < model->materials->size(); ++i )
 	{
-		if ( material.texture_handle )
+		auto material = model->materials.find( i );
+		if ( material->texture_handle )
 		{
-			auto& source = material.texture_handle->source;
+			auto& source = material->texture_handle->source;
 			assert( source && "Texture has no source" );
-			material.texture = model->images.load( source->uri.c_str() );
+			VkImageView view = VK_NULL_HANDLE;
+			if ( source->uri.empty() )
+			{
+				// Embedded in a buffer view, like images of a binary gltf, and read in place
+				auto buffer_view = model->buffer_views.find( source->buffer_view );
+				auto data = buffer_view->buffer->get_data() + buffer_view->byte_offset;
+				view = textures.load( reinterpret_cast<const uint8_t*>( data ), buffer_view->byte_length, source->mime_type );
+			}
+			else
+			{
+				view = textures.load_async( source->uri, workers, source->mime_type );
+			}
+
+			// Until the texture is decoded and uploaded, the material samples the placeholder
+			material->texture = placeholder_view.handle;
+			if ( !view )
+			{
+				// Format cannot be sampled, the placeholder stays
+				continue;
+			}
+			pending_textures.emplace_back( PendingTexture { material, view } );
 		}
 	}
 
+	auto requested = Clock::now();
+
 	// A primitive without material does not exist in gltf
 	// Therefore we a white material at the endMaterial white {
 	
 	auto white = model->materials.push( Material( Color::White ) );
 
 	// Load meshes
+	std::vector<Primitive*> primitives;
 	for ( auto& m : *model->meshes )
 	{
 		for ( auto& p : m.primitives )
@@ -59,119 +172,48 @@ Handle<Gltf> Graphics::load_model( const std::string& path )
 				p.material = white;
 			}
 
-			std::vector<Index> indices;
+			primitives.emplace_back( &p );
+		}
+	}
 
-			// Indices
-			if ( auto& accessor = p.indices_handle )
-			{
-				indices.resize( accessor->count );
-				std::memcpy( indices.data(), accessor->get_data(), accessor->get_size() );
+	// Primitives are converted by the pool, while the calling thread helps
+	workers.parallel_for( primitives.size(), [&primitives]( const size_t i ) { convert( *primitives[i] ); } );
 
-				assert( accessor->component_type == Accessor::ComponentType::UNSIGNED_SHORT );
-				assert( accessor->type == Accessor::Type::SCALAR );
-			}
+	auto converted = Clock::now();
+	logi( "Loaded {}: parse {}ms, textures {}ms, primitives {}ms\n",
+		path,
+		get_ms( start, parsed ),
+		get_ms( parsed, requested ),
+		get_ms( requested, converted ) );
 
-			// Vertex attributes
-			std::vector<Vertex> vertices;
+	return model;
+}
 
-			for ( auto [semantic, accessor] : p.attributes )
-			{
-				auto data = accessor->get_data();
-				auto elem_size = accessor->get_size() / accessor->count;
-				auto stride = accessor->get_stride();
-
-				if ( vertices.empty() )
-				{
-					vertices.resize( accessor->count );
-				}
-
-				switch ( semantic )
-				{
-				case Primitive::Semantic::POSITION:
-				{
-					if ( stride == 0 )
-					{
-						stride = sizeof( math::Vec3 );
-					}
-				
-					for ( size_t i = 0; i < accessor->count; ++i )
-					{
-						auto& vert = vertices[i];
-						auto vert_data = data + i * stride;
-						std::memcpy( &vert.p.x, vert_data, elem_size );
-					}
-
-					assert( accessor->component_type == Accessor::ComponentType::FLOAT );
-					assert( accessor->type == Accessor::Type::VEC3 );
-					break;
-				}
-				case Primitive::Semantic::NORMAL:
-				{
-					if ( stride == 0 )
-					{
-						stride = sizeof( math::Vec3 );
-					}
-
-					for ( size_t i = 0; i < accessor->count; ++i )
-					{
-						auto& vert = vertices[i];
-						auto vert_data = data + i * stride;
-						std::memcpy( &vert.n.x, vert_data, elem_size );
-					}
-
-					assert( accessor->component_type == Accessor::ComponentType::FLOAT );
-					assert( accessor->type == Accessor::Type::VEC3 );
-					break;
-				}
-				case Primitive::Semantic::TEXCOORD_0:
-				{
-					if ( stride == 0 )
-					{
-						stride = sizeof( math::Vec2 );
-					}
-
-					for ( size_t i = 0; i < accessor->count; ++i )
-					{
-						auto& vert = vertices[i];
-						auto vert_data = data + i * stride;
-						std::memcpy( &vert.t.x, vert_data, elem_size );
-					}
-
-					assert( accessor->component_type == Accessor::ComponentType::FLOAT );
-					assert( accessor->type == Accessor::Type::VEC2 );
-					break;
-				}
-				case Primitive::Semantic::COLOR_0:
-				{
-					if ( stride == 0 )
-					{
-						stride = sizeof( Color );
-					}
-
-					for ( size_t i = 0; i < accessor->count; ++i )
-					{
-						auto& vert = vertices[i];
-						auto vert_data = data + i * stride;
-						std::memcpy( &vert.c.r, vert_data, elem_size );
-					}
-
-					assert( accessor->component_type == Accessor::ComponentType::FLOAT );
-					assert( accessor->type == Accessor::Type::VEC4 );
-					break;
-				}
-				default:
-				{
-					assert( false && "Semantic not supported" );
-				}
-				}
-			}
 
-			p.vertices = vertices;
-			p.indices = indices;
-		}
+void Graphics::release( const Handle<Material>& material )
+{
+	auto pending = std::find_if( std::begin( pending_textures ), std::end( pending_textures ),
+		[&material]( auto& pending ) { return pending.material == material; } );
+	if ( pending != std::end( pending_textures ) )
+	{
+		textures.release( pending->view );
+		pending_textures.erase( pending );
+	}
+	else if ( material->texture && material->texture != placeholder_view.handle )
+	{
+		textures.release( material->texture );
 	}
 
-	return model;
+	material->texture = VK_NULL_HANDLE;
+}
+
+
+void Graphics::release( const Handle<Gltf>& model )
+{
+	for ( size_t i = 0; i < model->materials->size(); ++i )
+	{
+		release( model->materials.find( i ) );
+	}
 }
 
 
@@ -10,14 +10,24 @@ namespace spot::gfx
 {
 
 
-PipelineLayout::PipelineLayout( Device& d, const std::vector<VkDescriptorSetLayoutBinding>& bindings )
+PipelineLayout::PipelineLayout( Device& d,
+	const std::vector<std::vector<VkDescriptorSetLayoutBinding>>& set_bindings,
+	const std::vector<VkPushConstantRange>& push_constant_ranges )
 : device { d }
-, descriptor_set_layout { d, std::move( bindings ) }
 {
+	std::vector<VkDescriptorSetLayout> handles;
+	for ( auto& bindings : set_bindings )
+	{
+		auto& set_layout = descriptor_set_layouts.emplace_back( d, bindings );
+		handles.emplace_back( set_layout.handle );
+	}
+
 	VkPipelineLayoutCreateInfo info = {};
 	info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	info.setLayoutCount = 1;
-	info.pSetLayouts = &descriptor_set_layout.handle;
+	info.setLayoutCount = handles.size();
+	info.pSetLayouts = handles.data();
+	info.pushConstantRangeCount = push_constant_ranges.size();
+	info.pPushConstantRanges = push_constant_ranges.data();
 
 	const auto res = vkCreatePipelineLayout( device.handle, &info, nullptr, &handle );
 	assert( res == VK_SUCCESS && "Cannot create pipeline layout" );
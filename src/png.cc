@@ -4,6 +4,8 @@
 #include <png.h>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <stdexcept>
 #include <spot/log.h>
 
 #include "spot/gfx/graphics.h"
@@ -12,28 +14,17 @@ namespace spot::gfx
 {
 
 
-void handle_error( png_struct* png, const char* msg )
+/// @brief Leaves libpng by throwing, as it must not return to the caller of png_error
+/// This works at any point of decoding, while a jump buffer would be stale once the function setting it returns
+[[noreturn]] void handle_error( png_struct* png, const char* msg )
 {
-	loge( "PNG error: {}\n", msg );
-	exit( EXIT_FAILURE );
+	throw std::runtime_error{ std::string( "PNG error: " ) + msg };
 }
 
 
 void handle_warning( png_struct* png, const char* msg )
 {
 	loge( "PNG warning: {}\n", msg );
-	exit( EXIT_FAILURE );
-}
-
-
-void read_status( png_struct* png, uint32_t row, int pass )
-{
-	Png* obj = ( Png* )png_get_error_ptr( png );
-	
-	uint32_t percent = row * 100.0f / obj->height;
-	std::printf("\r");
-	logi( "Read\t{}%", percent );
-	std::fflush( stdout );
 }
 
 
@@ -59,122 +50,175 @@ void Png::print_info()
 }
 
 
-Png::Png( const std::string& path )
+/// @brief Creates the read and info structs of libpng
+void create_read( Png& obj )
 {
-	png = png_create_read_struct( PNG_LIBPNG_VER_STRING, this, handle_error, handle_warning );
-	assert( png && "Cannot create PNG read" );
+	obj.png = png_create_read_struct( PNG_LIBPNG_VER_STRING, &obj, handle_error, handle_warning );
+	assert( obj.png && "Cannot create PNG read" );
 
-	info = png_create_info_struct( png );
-	assert( info && "Cannot create PNG info" );
-	
-	end = png_create_info_struct( png );
-	assert( end && "Cannot create PNG end info" );
+	obj.info = png_create_info_struct( obj.png );
+	assert( obj.info && "Cannot create PNG info" );
 
-	auto res = setjmp( png_jmpbuf( png ) );
-	assert( !res && "Cannot set PNG jump" );
+	obj.end = png_create_info_struct( obj.png );
+	assert( obj.end && "Cannot create PNG end info" );
+}
 
-	file = std::fopen( path.c_str(), "rb" );
-	assert( file && "Cannot open png file" );
 
-	png_init_io( png, file );
+/// @return Number of channels of a color type without palette
+png_byte get_channels( const int color_type )
+{
+	switch ( color_type )
+	{
+	case PNG_COLOR_TYPE_GRAY: return 1;
+	case PNG_COLOR_TYPE_GRAY_ALPHA: return 2;
+	case PNG_COLOR_TYPE_RGB: return 3;
+	case PNG_COLOR_TYPE_RGB_ALPHA: return 4;
+	default:
+		assert( false && "PNG color type not supported" );
+	}
+
+	return 0;
+}
 
-	// Meter
-	png_set_read_status_fn( png, read_status );
 
+void Png::read_info()
+{
 	png_read_info( png, info );
 
 	png_get_IHDR( png, info, &width, &height, &bit_depth, &color_type, &interlace_type, &compression_type, &filter_method );
 
-	/// Some graphics card only support sampling from RGBA, therefore we are forcing RGBA
-	/// @todo Improve by querying capabilities of the GPU before adjusting png info
+	// Palettes and low bit depths cannot be sampled, they are expanded to 8 bits per channel
 	if ( color_type == PNG_COLOR_TYPE_PALETTE )
 	{
 		png_set_palette_to_rgb( png );
-		png_set_add_alpha( png, 255, PNG_FILLER_AFTER );
-		png_read_update_info( png, info );
-		color_type = png_get_color_type( png, info );
+		color_type = PNG_COLOR_TYPE_RGB;
+		bit_depth = 8;
 	}
-	else if ( color_type == PNG_COLOR_TYPE_RGB )
+	else if ( color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8 )
 	{
-		png_set_add_alpha( png, 255, PNG_FILLER_AFTER );
-		png_read_update_info( png, info );
-		color_type = png_get_color_type( png, info );
+		png_set_expand_gray_1_2_4_to_8( png );
+		bit_depth = 8;
 	}
 
-	assert( bit_depth == 8 && "PNG bit depth not supported" );
-	channels = png_get_channels( png, info );
-	print_info();
+	// Transparency chunk becomes an alpha channel
+	if ( png_get_valid( png, info, PNG_INFO_tRNS ) )
+	{
+		png_set_tRNS_to_alpha( png );
+		color_type |= PNG_COLOR_MASK_ALPHA;
+	}
+
+	// Channels of 16 bits are stored big endian, while Vulkan expects them little endian
+	if ( bit_depth == 16 )
+	{
+		png_set_swap( png );
+	}
+
+	channels = get_channels( color_type );
+}
+
+
+Png::Png( const std::string& path )
+{
+	file = std::fopen( path.c_str(), "rb" );
+	if ( !file )
+	{
+		throw std::runtime_error{ "Cannot open png file " + path };
+	}
+
+	create_read( *this );
+	png_init_io( png, file );
+
+	try
+	{
+		read_info();
+	}
+	catch ( ... )
+	{
+		// The destructor does not run when a constructor throws
+		destroy();
+		throw;
+	}
 }
 
 
+/// @brief Copies the next bytes of the source, advancing its cursor without touching the encoded data
 void read_data( png_structp png_ptr, png_bytep dst, png_size_t length )
 {
 	png_voidp io_ptr = png_get_io_ptr( png_ptr );
 	assert( io_ptr && "Invalid png io_ptr" );
-	auto mem = reinterpret_cast<std::vector<uint8_t>*>( io_ptr );
+	auto source = reinterpret_cast<Png::Source*>( io_ptr );
+
+	if ( length > source->size - source->cursor )
+	{
+		png_error( png_ptr, "Read past the end of png data" );
+	}
 
-	std::memcpy( dst, mem->data(), length );
-	mem->erase( std::begin( *mem ), std::begin( *mem ) + length );
+	std::memcpy( dst, source->data + source->cursor, length );
+	source->cursor += length;
 }
 
 
-Png::Png( std::vector<uint8_t>& mem )
+Png::Png( const uint8_t* data, const size_t size )
+: source { data, size, 0 }
 {
-	png = png_create_read_struct( PNG_LIBPNG_VER_STRING, this, handle_error, handle_warning );
-	assert( png && "Cannot create PNG read" );
+	assert( data && size && "Cannot load png from empty memory" );
 
-	info = png_create_info_struct( png );
-	assert( info && "Cannot create PNG info" );
-	
-	end = png_create_info_struct( png );
-	assert( end && "Cannot create PNG end info" );
+	create_read( *this );
+	png_set_read_fn( png, &source, read_data );
 
-	auto res = setjmp( png_jmpbuf( png ) );
-	assert( !res && "Cannot set PNG jump" );
+	try
+	{
+		read_info();
+	}
+	catch ( ... )
+	{
+		destroy();
+		throw;
+	}
+}
 
-	assert( mem.size() && "Cannot load png from empy memory" );
 
-	png_set_read_fn( png, &mem, read_data );
+Png::Png( const std::vector<uint8_t>& mem )
+: Png { mem.data(), mem.size() }
+{}
 
-	// Meter
-	png_set_read_status_fn( png, read_status );
 
-	png_read_info( png, info );
+void Png::convert( const png_byte target_channels, const int target_bit_depth )
+{
+	assert( target_channels >= channels && target_bit_depth <= bit_depth && "Cannot convert png to this layout" );
 
-	png_get_IHDR( png, info, &width, &height, &bit_depth, &color_type, &interlace_type, &compression_type, &filter_method );
+	if ( target_bit_depth < bit_depth )
+	{
+		png_set_strip_16( png );
+		bit_depth = target_bit_depth;
+	}
 
-	/// Some graphics card only support sampling from RGBA, therefore we are forcing RGBA
-	/// @todo Improve by querying capabilities of the GPU before adjusting png info
-	if ( color_type == PNG_COLOR_TYPE_PALETTE || color_type == PNG_COLOR_TYPE_GRAY )
+	if ( target_channels >= 3 && channels < 3 )
 	{
-		if ( color_type == PNG_COLOR_TYPE_PALETTE )
-		{
-			png_set_palette_to_rgb( png );
-		}
-		else if ( color_type == PNG_COLOR_TYPE_GRAY )
-		{
-			png_set_gray_to_rgb( png );
-		}
-		png_set_add_alpha( png, 255, PNG_FILLER_AFTER );
-		png_read_update_info( png, info );
-		color_type = png_get_color_type( png, info );
+		png_set_gray_to_rgb( png );
+		color_type |= PNG_COLOR_MASK_COLOR;
 	}
-	else if ( color_type == PNG_COLOR_TYPE_RGB )
+
+	if ( target_channels == 4 && !( color_type & PNG_COLOR_MASK_ALPHA ) )
 	{
-		png_set_add_alpha( png, 255, PNG_FILLER_AFTER );
-		png_read_update_info( png, info );
-		color_type = png_get_color_type( png, info );
+		png_set_add_alpha( png, 0xffff, PNG_FILLER_AFTER );
+		color_type |= PNG_COLOR_MASK_ALPHA;
 	}
 
-	assert( bit_depth == 8 && "PNG bit depth not supported" );
-	channels = png_get_channels( png, info );
-	print_info();
+	channels = get_channels( color_type );
+	assert( channels == target_channels && "Cannot convert png to these channels" );
+}
+
+
+size_t Png::get_texel_size() const
+{
+	return channels * bit_depth / 8;
 }
 
 
 size_t Png::get_size() const
 {
-	return width * height * channels;
+	return width * height * get_texel_size();
 }
 
 
@@ -186,19 +230,31 @@ void Png::load( png_byte* bytes )
 	rows.resize( height );
 	for( uint32_t i = 0; i < height; ++i )
 	{
-		size_t offset = width * channels * i;
+		size_t offset = width * get_texel_size() * i;
 		rows[i] = bytes + offset;
 	}
 
 	png_read_image( png, rows.data() );
 	png_read_end( png, info );
-	std::printf("\n");
 }
 
 Png::~Png()
 {
-	png_destroy_read_struct( &png, &info, &end );
-	std::fclose( file );
+	destroy();
+}
+
+
+void Png::destroy()
+{
+	if ( png )
+	{
+		png_destroy_read_struct( &png, &info, &end );
+	}
+	if ( file )
+	{
+		std::fclose( file );
+		file = nullptr;
+	}
 }
 
 } // namespace spot::gfx
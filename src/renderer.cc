@@ -1,11 +1,16 @@
 #include "spot/gfx/renderer.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <iterator>
 #include <spot/log.h>
 
 #include "spot/gltf/material.h"
 #include "spot/gltf/node.h"
 #include "spot/gfx/graphics.h"
+#include "spot/gfx/commands.h"
+#include "spot/gfx/draws.h"
 #include "spot/gfx/hash.h"
 
 #define FIND( container, object ) ( container.find( object ) != std::end( container ) )
@@ -73,11 +78,164 @@ std::vector<VkVertexInputAttributeDescription> get_attributes<Vertex>()
 }
 
 
+/// @return The index of the standard mesh pipeline, which is at index 0 by default
+uint64_t get_mesh_pipeline()
+{
+	return 0;
+}
+
+
+/// @return The index of the no-image-mesh pipeline, which is at index 1 by default
+uint64_t get_mesh_no_image_pipeline()
+{
+	return 1;
+}
+
+
+/// @return The index of the line pipeline, 2 by default
+uint64_t get_line_pipeline()
+{
+	return 2;
+}
+
+
+/// @return The pipeline to use for this material
+uint64_t select_pipeline( const Handle<Material>& material )
+{
+	if ( material )
+	{
+		if ( material->texture != VK_NULL_HANDLE )
+		{
+			return get_mesh_pipeline();
+		}
+
+		return get_mesh_no_image_pipeline();
+	}
+
+	return get_line_pipeline();
+}
+
+
+VkDeviceSize get_instances_size()
+{
+	return max_instances * sizeof( InstanceData );
+}
+
+
+VkDeviceSize get_materials_size()
+{
+	return max_materials * sizeof( Material::PbrMetallicRoughness );
+}
+
+
+/// @return Pool sizes for frame, material and object sets for each swapchain image
+std::vector<VkDescriptorPoolSize> get_uniform_pool_sizes( const uint32_t image_count )
+{
+	std::vector<VkDescriptorPoolSize> pool_sizes( 2 );
+
+	// Frame sets have 3 dynamic ubos
+	pool_sizes[0].descriptorCount = image_count * 3;
+	pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	// Material and object sets have a dynamic storage buffer each
+	pool_sizes[1].descriptorCount = image_count * 2;
+	pool_sizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+
+	return pool_sizes;
+}
+
+
+/// @brief Points dynamic buffer bindings of a set to a uniform buffer
+/// Actual offsets are provided when binding the set
+/// @param type Either dynamic uniform or dynamic storage buffer
+/// @param ranges Size of the data of each binding, in binding order
+void write_uniform_set(
+	const Device& device,
+	const VkDescriptorSet set,
+	const VkBuffer buffer,
+	const VkDescriptorType type,
+	const std::vector<VkDeviceSize>& ranges )
+{
+	std::vector<VkDescriptorBufferInfo> infos( ranges.size() );
+	std::vector<VkWriteDescriptorSet> writes( ranges.size() );
+
+	for ( uint32_t i = 0; i < ranges.size(); ++i )
+	{
+		infos[i].buffer = buffer;
+		infos[i].offset = 0;
+		infos[i].range = ranges[i];
+
+		auto& write = writes[i];
+		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		write.dstSet = set;
+		write.dstBinding = i;
+		write.dstArrayElement = 0;
+		write.descriptorType = type;
+		write.descriptorCount = 1;
+		write.pBufferInfo = &infos[i];
+	}
+
+	vkUpdateDescriptorSets( device.handle, writes.size(), writes.data(), 0, nullptr );
+}
+
+
 Renderer::Renderer( Graphics& g )
 : gfx { g }
-, ambient_resources { gfx.swapchain }
+, uniform_pool {
+		gfx.device,
+		get_uniform_pool_sizes( gfx.swapchain.images.size() ),
+		uint32_t( gfx.swapchain.images.size() * 3 )
+	}
+, geometry { gfx.device, uint32_t( gfx.swapchain.images.size() ) }
+, sampler { gfx.device }
 {
 	recreate_pipelines();
+
+	for ( size_t i = 0; i < gfx.swapchain.images.size(); ++i )
+	{
+		uniform_allocators.emplace_back( gfx.device );
+	}
+
+	// Pipeline layouts do not change on recreation, so these sets are created once
+	auto image_count = gfx.swapchain.images.size();
+	auto& set_layouts = gfx.mesh_no_image_layout.descriptor_set_layouts;
+	frame_sets = uniform_pool.allocate( set_layouts[0], image_count );
+	material_sets = uniform_pool.allocate( set_layouts[1], image_count );
+	object_sets = uniform_pool.allocate( set_layouts[2], image_count );
+
+	for ( size_t i = 0; i < image_count; ++i )
+	{
+		write_uniform_sets( i );
+	}
+}
+
+
+void Renderer::write_uniform_sets( const uint32_t frame_index )
+{
+	auto buffer = uniform_allocators[frame_index].buffer.handle;
+	write_uniform_set( gfx.device, frame_sets[frame_index], buffer, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+		{ sizeof( ViewUbo ), sizeof( Ambient::Ubo ), sizeof( LightUbo ) } );
+	write_uniform_set( gfx.device, material_sets[frame_index], buffer, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+		{ get_materials_size() } );
+	write_uniform_set( gfx.device, object_sets[frame_index], buffer, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+		{ get_instances_size() } );
+
+	// Textured material sets refer to the same buffer for their material array
+	for ( auto& [view, resources] : texture_resources )
+	{
+		write_uniform_set( gfx.device, resources.descriptor_sets[frame_index], buffer, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+			{ get_materials_size() } );
+	}
+}
+
+
+void Renderer::update_uniform_sets( const uint32_t frame_index )
+{
+	auto& uniforms = uniform_allocators[frame_index];
+	if ( uniforms.grown )
+	{
+		write_uniform_sets( frame_index );
+		uniforms.grown = false;
+	}
 }
 
 
@@ -124,449 +282,431 @@ void Renderer::recreate_pipelines()
 }
 
 
-std::vector<VkDescriptorPoolSize> get_uniform_pool_sizes( const uint32_t count )
+GeometryArena::Block::Block( const Device& device, const uint32_t vertex_capacity, const uint32_t index_capacity )
+: vertex_buffer { device, vertex_capacity * sizeof( Vertex ),
+	VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, MemoryUsage::GPU_ONLY }
+, index_buffer { device, index_capacity * sizeof( Index ),
+	VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, MemoryUsage::GPU_ONLY }
+, vertex_ranges { vertex_capacity }
+, index_ranges { index_capacity }
 {
-	VkDescriptorPoolSize pool_size = {};
-	pool_size.descriptorCount = count;
-	pool_size.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	// With unified memory, geometry is written directly while previous frames may still read
+	// other ranges, so memory stays mapped and is implicitly unmapped when freed
+	if ( vertex_buffer.is_mappable() && index_buffer.is_mappable() )
+	{
+		vertices = reinterpret_cast<Vertex*>( vertex_buffer.map( vertex_capacity * sizeof( Vertex ) ) );
+		indices = reinterpret_cast<Index*>( index_buffer.map( index_capacity * sizeof( Index ) ) );
+	}
+}
 
-	return { pool_size };
+
+GeometryArena::GeometryArena( const Device& d, const uint32_t frame_count, const uint32_t vertex_cap, const uint32_t index_cap )
+: device { d }
+, vertex_capacity { vertex_cap }
+, index_capacity { index_cap }
+, staging_in_flight( frame_count )
+{
+	blocks.emplace_back( device, vertex_capacity, index_capacity );
 }
 
 
-DynamicResources::DynamicResources( Device& d, Swapchain& s, GraphicsPipeline& gp )
-: vertex_buffer { d, sizeof( Dot ), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT }
-, index_buffer { d, sizeof( Index ), VK_BUFFER_USAGE_INDEX_BUFFER_BIT }
-, uniform_buffers {}
-, pipeline { gp.index }
-, descriptor_pool { d,
-	get_uniform_pool_sizes( s.images.size() ),
-	uint32_t( s.images.size() ) }
-, descriptor_sets { descriptor_pool.allocate( gp.layout.descriptor_set_layout, s.images.size() ) }
+GeometryArena::Range GeometryArena::allocate( const Primitive& primitive )
 {
-	for ( size_t i = 0; i < s.images.size(); ++i )
+	Range range;
+	auto& vertices = primitive.get_vertices();
+	auto& indices = primitive.get_indices();
+	range.vertex_count = vertices.size();
+	range.index_count = indices.size();
+	assert( range.vertex_count > 0 && range.index_count > 0 && "Cannot allocate an empty primitive" );
+
+	for ( ; range.block < blocks.size(); ++range.block )
 	{
-		uniform_buffers.emplace_back(
-			Buffer( d, sizeof( MvpUbo ), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT )
-		);
-
-		VkDescriptorBufferInfo buffer_info = {};
-		buffer_info.buffer = uniform_buffers[i].handle;
-		buffer_info.offset = 0;
-		buffer_info.range = sizeof( MvpUbo );
+		auto& block = blocks[range.block];
+		range.vertex_offset = block.vertex_ranges.allocate( range.vertex_count );
+		if ( range.vertex_offset == RangeAllocator::invalid )
+		{
+			continue;
+		}
 
-		VkWriteDescriptorSet descriptor_write = {};
-		descriptor_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptor_write.dstSet = descriptor_sets[i];
-		descriptor_write.dstBinding = 0;
-		descriptor_write.dstArrayElement = 0;
+		range.first_index = block.index_ranges.allocate( range.index_count );
+		if ( range.first_index == RangeAllocator::invalid )
+		{
+			block.vertex_ranges.free( range.vertex_offset, range.vertex_count );
+			continue;
+		}
 
-		descriptor_write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-		descriptor_write.descriptorCount = 1;
+		break;
+	}
 
-		descriptor_write.pBufferInfo = &buffer_info;
+	if ( range.block == blocks.size() )
+	{
+		// A primitive larger than a block gets a block of its own size
+		blocks.emplace_back( device,
+			std::max( vertex_capacity, range.vertex_count ),
+			std::max( index_capacity, range.index_count ) );
+		range.vertex_offset = blocks.back().vertex_ranges.allocate( range.vertex_count );
+		range.first_index = blocks.back().index_ranges.allocate( range.index_count );
+	}
 
-		vkUpdateDescriptorSets(d.handle, 1, &descriptor_write, 0, nullptr);
+	// Indices stay relative to the first vertex of the primitive, as the vertex offset is added when drawing
+	auto& block = blocks[range.block];
+	if ( block.vertices && block.indices )
+	{
+		std::copy( std::begin( vertices ), std::end( vertices ), block.vertices + range.vertex_offset );
+		std::copy( std::begin( indices ), std::end( indices ), block.indices + range.first_index );
+		return range;
 	}
-}
 
+	StagedCopy copy;
+	copy.staging = staging.size();
+	copy.block = range.block;
+	copy.vertices.dstOffset = range.vertex_offset * sizeof( Vertex );
+	copy.vertices.size = range.vertex_count * sizeof( Vertex );
+	copy.indices.dstOffset = range.first_index * sizeof( Index );
+	copy.indices.size = range.index_count * sizeof( Index );
 
-std::vector<Buffer> create_mvp_ubos( const Swapchain& swapchain )
-{
-	std::vector<Buffer> ret;
+	auto& region = staging.emplace_back( device.uploads->reserve( copy.vertices.size + copy.indices.size ) );
+	copy.vertices.srcOffset = region.offset;
+	copy.indices.srcOffset = region.offset + copy.vertices.size;
+	std::memcpy( region.data, vertices.data(), copy.vertices.size );
+	std::memcpy( region.data + copy.vertices.size, indices.data(), copy.indices.size );
 
-	for ( size_t i = 0; i < swapchain.images.size(); ++i )
-	{
-		ret.emplace_back(
-			Buffer(
-				swapchain.device,
-				sizeof( MvpUbo ),
-				VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
-			)
-		);
-	}
+	staged_copies.emplace_back( copy );
 
-	return ret;
+	return range;
 }
 
 
-std::vector<Buffer> create_mat_ubos( const Swapchain& swapchain )
+void GeometryArena::flush( CommandBuffer& command_buffer, const uint32_t frame_index )
 {
-	std::vector<Buffer> ret;
+	if ( staged_copies.empty() )
+	{
+		return;
+	}
 
-	for ( size_t i = 0; i < swapchain.images.size(); ++i )
+	for ( auto& copy : staged_copies )
 	{
-		ret.emplace_back(
-			Buffer(
-				swapchain.device,
-				sizeof( MvpUbo ),
-				VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
-			)
-		);
+		auto& block = blocks[copy.block];
+		auto& source = *staging[copy.staging].buffer;
+		command_buffer.copy( source, block.vertex_buffer, copy.vertices );
+		command_buffer.copy( source, block.index_buffer, copy.indices );
 	}
 
-	return ret;
+	// Draws of this command buffer may read the geometry just copied
+	command_buffer.barrier(
+		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+		VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT );
+
+	auto& in_flight = staging_in_flight[frame_index];
+	std::move( std::begin( staging ), std::end( staging ), std::back_inserter( in_flight ) );
+	staging.clear();
+	staged_copies.clear();
 }
 
 
-/// @return Buffers for ambient bindings for each swapchain image
-/// @todo How about constant buffers?
-std::vector<Buffer> create_ambient_ubos( const Swapchain& swapchain )
+void GeometryArena::release_staging( const uint32_t frame_index )
 {
-	std::vector<Buffer> ret;
-
-	for ( size_t i = 0; i < swapchain.images.size(); ++i )
+	auto& in_flight = staging_in_flight[frame_index];
+	for ( auto& region : in_flight )
 	{
-		ret.emplace_back(
-			Buffer(
-				swapchain.device,
-				sizeof( Ambient::Ubo ),
-				VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
-			)
-		);
+		device.uploads->release( region );
 	}
+	in_flight.clear();
+}
+
 
-	return ret;
+void GeometryArena::free( const Range& range )
+{
+	assert( range.block < blocks.size() && "Cannot free a range of an unknown block" );
+	auto& block = blocks[range.block];
+	block.vertex_ranges.free( range.vertex_offset, range.vertex_count );
+	block.index_ranges.free( range.first_index, range.index_count );
 }
 
 
-/// @return Buffers for light bindings for each swapchain image
-std::vector<Buffer> create_light_ubos( const Swapchain& swapchain )
+GeometryArena::Stats GeometryArena::get_stats() const
 {
-	std::vector<Buffer> ret;
+	Stats stats;
+	stats.block_count = blocks.size();
 
-	for ( size_t i = 0; i < swapchain.images.size(); ++i )
+	uint32_t largest_vertices = 0;
+	uint32_t largest_indices = 0;
+
+	for ( auto& block : blocks )
 	{
-		ret.emplace_back(
-			Buffer(
-				swapchain.device,
-				sizeof( LightUbo ),
-				VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT
-			)
-		);
-	}
+		stats.free_vertices += block.vertex_ranges.get_free_size();
+		stats.used_vertices += block.vertex_ranges.capacity - block.vertex_ranges.get_free_size();
+		stats.free_indices += block.index_ranges.get_free_size();
+		stats.used_indices += block.index_ranges.capacity - block.index_ranges.get_free_size();
 
-	return ret;
-}
+		largest_vertices += block.vertex_ranges.get_largest_free_range();
+		largest_indices += block.index_ranges.get_largest_free_range();
+	}
 
+	// Blocks are fragmented by nature, so only the scattering within each block counts
+	if ( stats.free_vertices > 0 )
+	{
+		stats.vertex_fragmentation = 1.0f - float( largest_vertices ) / float( stats.free_vertices );
+	}
+	if ( stats.free_indices > 0 )
+	{
+		stats.index_fragmentation = 1.0f - float( largest_indices ) / float( stats.free_indices );
+	}
 
-NodeResources::NodeResources( const Swapchain& swapchain )
-: ubos { create_mvp_ubos( swapchain ) }
-{}
+	return stats;
+}
 
 
-MaterialResources::MaterialResources( const Swapchain& swapchain )
-: ubos { create_mat_ubos( swapchain ) }
-, sampler { swapchain.device }
+PrimitiveResources::PrimitiveResources( GeometryArena& a, const Primitive& primitive )
+: arena { &a }
+, range { a.allocate( primitive ) }
 {}
 
 
-AmbientResources::AmbientResources( const Swapchain& swapchain )
-: ubos { create_ambient_ubos( swapchain ) }
-{}
+PrimitiveResources::~PrimitiveResources()
+{
+	if ( arena )
+	{
+		arena->free( range );
+	}
+}
 
 
-LightResources::LightResources( const Swapchain& swapchain )
-: ubos { create_light_ubos( swapchain ) }
-{}
+PrimitiveResources::PrimitiveResources( PrimitiveResources&& other )
+: arena { other.arena }
+, range { other.range }
+, last_frame { other.last_frame }
+{
+	other.arena = nullptr;
+}
 
 
-std::vector<VkDescriptorPoolSize> get_mesh_pool_size( const uint32_t count )
+PrimitiveResources& PrimitiveResources::operator=( PrimitiveResources&& other )
 {
-	std::vector<VkDescriptorPoolSize> pool_sizes(4);
-
-	pool_sizes[0].descriptorCount = count;
-	pool_sizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	pool_sizes[1].descriptorCount = count;
-	pool_sizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	pool_sizes[2].descriptorCount = count;
-	pool_sizes[2].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	pool_sizes[3].descriptorCount = count;
-	pool_sizes[3].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	std::swap( arena, other.arena );
+	std::swap( range, other.range );
+	std::swap( last_frame, other.last_frame );
 
-	return pool_sizes;
+	return *this;
 }
 
-/// @todo Figure out
-PrimitiveResources::PrimitiveResources( const Device& device, const Primitive& primitive )
-: vertex_buffer {
-		device,
-		primitive.vertices.size() * sizeof( Vertex ),
-		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT }
-, index_buffer {
-		device,
-		primitive.indices.size() * sizeof( Index ),
-		VK_BUFFER_USAGE_INDEX_BUFFER_BIT }
+
+/// @return Pool sizes for material sets with a texture, for each swapchain image
+std::vector<VkDescriptorPoolSize> get_texture_pool_sizes( const uint32_t image_count )
 {
-	// Upload vertices
-	{
-		auto data = reinterpret_cast<const uint8_t*>( primitive.vertices.data() );
-		auto size = primitive.vertices.size() * sizeof( Vertex );
-		vertex_buffer.upload( data, size );
-	}
+	std::vector<VkDescriptorPoolSize> pool_sizes( 2 );
 
-	// Upload indices
-	{
-		auto data = reinterpret_cast<const uint8_t*>( primitive.indices.data() );
-		auto size = primitive.indices.size() * sizeof( Index );
-		index_buffer.upload( data, size );
-	}
+	pool_sizes[0].descriptorCount = image_count;
+	pool_sizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+	pool_sizes[1].descriptorCount = image_count;
+	pool_sizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+	return pool_sizes;
 }
 
 
-DescriptorResources::DescriptorResources(
-	const Renderer& renderer,
-	const GraphicsPipeline& pipel,
-	const Handle<Node>& node,
-	const Handle<Material>& material )
-: pipeline { pipel.index }
-, descriptor_pool {
-		renderer.gfx.swapchain.device,
-		get_mesh_pool_size( renderer.gfx.swapchain.images.size() * 2 ),
-		uint32_t( renderer.gfx.swapchain.images.size() * 2 )
+TextureResources::TextureResources( const Renderer& renderer, const VkImageView view )
+: descriptor_pool {
+		renderer.gfx.device,
+		get_texture_pool_sizes( renderer.gfx.swapchain.images.size() ),
+		uint32_t( renderer.gfx.swapchain.images.size() )
 	}
 , descriptor_sets {
 		descriptor_pool.allocate(
-			pipel.layout.descriptor_set_layout,
+			renderer.gfx.mesh_layout.descriptor_set_layouts[1],
 			renderer.gfx.swapchain.images.size()
 		)
 	}
 {
-	assert( renderer.node_resources.count( node ) && "Node resources were not created" );
-	const auto& node_res = renderer.node_resources.at( node );
-
-	for ( size_t i = 0; i < renderer.gfx.swapchain.images.size(); ++i )
+	for ( size_t i = 0; i < descriptor_sets.size(); ++i )
 	{
-		std::vector<VkWriteDescriptorSet> writes = {};
+		// Materials differ for each frame, as they live in the frame uniform allocator
+		auto buffer = renderer.uniform_allocators[i].buffer.handle;
+		write_uniform_set( renderer.gfx.device, descriptor_sets[i], buffer, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC,
+			{ get_materials_size() } );
+
+		VkDescriptorImageInfo image_info = {};
+		image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		image_info.imageView = view;
+		image_info.sampler = renderer.sampler.handle;
 
-		VkDescriptorBufferInfo buffer_info = {};
-		buffer_info.buffer = node_res.ubos[i].handle;
-		buffer_info.offset = 0;
-		buffer_info.range = sizeof( MvpUbo );
-	
 		VkWriteDescriptorSet write = {};
 		write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 		write.dstSet = descriptor_sets[i];
-		write.dstBinding = 0;
+		write.dstBinding = 1;
 		write.dstArrayElement = 0;
-		write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
 		write.descriptorCount = 1;
-		write.pBufferInfo = &buffer_info;
+		write.pImageInfo = &image_info;
 
-		writes.emplace_back( write );
+		vkUpdateDescriptorSets( renderer.gfx.device.handle, 1, &write, 0, nullptr );
+	}
+}
 
-		VkDescriptorBufferInfo ambient_info = {};
-		if ( material )
-		{
-			ambient_info.buffer = renderer.ambient_resources.ubos[i].handle;
-			ambient_info.offset = 0;
-			ambient_info.range = sizeof( Ambient::Ubo );
 
-			VkWriteDescriptorSet ambient_write = {};
-			ambient_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			ambient_write.dstSet = descriptor_sets[i];
-			ambient_write.dstBinding = 1; /// @todo Fix magic number
-			ambient_write.dstArrayElement = 0;
-			ambient_write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-			ambient_write.descriptorCount = 1;
-			ambient_write.pBufferInfo = &ambient_info;
+void Renderer::add( const Primitive& prim )
+{
+	// We need vertex and index buffers. These are stored in primitive resources
+	auto hash_prim = prim.get_hash();
+	// Avoid duplication of primitive resources
+	if ( !FIND( primitive_resources, hash_prim ) )
+	{
+		auto resources = PrimitiveResources( geometry, prim );
+		resources.last_frame = frame_number;
+		primitive_resources.emplace( hash_prim, std::move( resources ) );
+	}
 
-			writes.emplace_back( ambient_write );
+	if ( prim.material && prim.material->texture != VK_NULL_HANDLE )
+	{
+		add_texture( prim.material->texture );
+	}
+}
 
-		}
 
-		VkDescriptorBufferInfo light_info = {};
-		if ( material )
-		{
-			/// @todo Think about multiple lights
-			// assert( renderer.light_resources.count( light ) &&
-			// 	"Light resources were not created" );
-			// auto& light_res = renderer.light_resources.at( light );
-
-			auto& light_res = renderer.light_resources.begin()->second;
-
-			light_info.buffer = light_res.ubos[i].handle;
-			light_info.offset = 0;
-			light_info.range = sizeof( LightUbo );
-
-			VkWriteDescriptorSet light_write = {};
-			light_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			light_write.dstSet = descriptor_sets[i];
-			light_write.dstBinding = 2;
-			light_write.dstArrayElement = 0;
-			light_write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-			light_write.descriptorCount = 1;
-			light_write.pBufferInfo = &light_info;
-
-			writes.emplace_back( light_write );
-		}
+void Renderer::begin_frame( const uint32_t frame_index )
+{
+	++frame_number;
+	geometry.release_staging( frame_index );
 
+	// Frames in flight may still read geometry drawn in the last swapchain image count frames
+	uint64_t frames = std::max<uint64_t>( release_frames, gfx.swapchain.images.size() + 1 );
+	if ( frame_number <= frames )
+	{
+		return;
+	}
 
-		VkDescriptorBufferInfo mat_info = {};
-		if ( material )
+	for ( auto it = std::begin( primitive_resources ); it != std::end( primitive_resources ); )
+	{
+		if ( it->second.last_frame < frame_number - frames )
 		{
-			assert( renderer.material_resources.count( material ) && "Material resources were not created" );
-			auto& mat_res = renderer.material_resources.at( material );
-
-			mat_info.buffer = mat_res.ubos[i].handle;
-			mat_info.offset = 0;
-			mat_info.range = sizeof( Material::PbrMetallicRoughness );
-
-			VkWriteDescriptorSet mat_write = {};
-			mat_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			mat_write.dstSet = descriptor_sets[i];
-			mat_write.dstBinding = 3;
-			mat_write.dstArrayElement = 0;
-			mat_write.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-			mat_write.descriptorCount = 1;
-			mat_write.pBufferInfo = &mat_info;
-
-			writes.emplace_back( mat_write );
+			it = primitive_resources.erase( it );
 		}
-
-		VkDescriptorImageInfo image_info = {};
-		if ( material && material->texture != VK_NULL_HANDLE )
+		else
 		{
-			assert( renderer.material_resources.count( material ) && "Material resources were not created" );
-			auto& mat_res = renderer.material_resources.at( material );
-
-			image_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-			image_info.imageView = material->texture;
-			image_info.sampler = mat_res.sampler.handle;
-
-			VkWriteDescriptorSet write = {};
-			write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-			write.dstSet = descriptor_sets[i];
-			write.dstBinding = 4;
-			write.dstArrayElement = 0;
-			write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-			write.descriptorCount = 1;
-			write.pImageInfo = &image_info;
-
-			writes.emplace_back( write );
+			++it;
 		}
-
-		vkUpdateDescriptorSets( pipel.device.handle, writes.size(), writes.data(), 0, nullptr );
 	}
 }
 
 
-/// @return The index of the standard mesh pipeline, which is at index 0 by default
-uint64_t get_mesh_pipeline()
-{
-	return 0;
-}
-
-
-/// @return The index of the no-image-mesh pipeline, which is at index 1 by default
-uint64_t get_mesh_no_image_pipeline()
-{
-	return 1;
-}
-
-
-/// @return The index of the line pipeline, 2 by default
-uint64_t get_line_pipeline()
+void Renderer::add( const Handle<Node>& node )
 {
-	return 2;
-}
-
+	if ( !node->mesh && !node->light )
+	{
+		return; // no mesh or light to add
+	}
 
-/// @return The pipeline to use for this material
-uint64_t select_pipeline( const Handle<Material>& material )
-{
-	if ( material )
+	// Uniform data of nodes and lights is written into the frame uniform allocator
+	// while drawing, hence only meshes need resources to be created in advance
+	if ( node->mesh )
 	{
-		if ( material->texture != VK_NULL_HANDLE )
+		// Now get the mesh, and its primitives
+		for ( auto& prim : node->mesh->primitives )
 		{
-			return get_mesh_pipeline();
+			add( prim );
 		}
-
-		return get_mesh_no_image_pipeline();
 	}
-
-	return get_line_pipeline();
 }
 
 
-void Renderer::add( const Handle<Node>& node, const Primitive& prim )
+std::unordered_map<VkImageView, TextureResources>::iterator Renderer::add_texture( const VkImageView view )
 {
-	// We need vertex and index buffers. These are stored in primitive resources
-	auto hash_prim = std::hash<Primitive>()( prim );
-	// Avoid duplication of primitive resources
-	if ( !FIND( primitive_resources, hash_prim ) )
+	// Materials sharing a texture share its descriptor set as well
+	auto it = texture_resources.find( view );
+	if ( it != std::end( texture_resources ) )
 	{
-		primitive_resources.emplace( hash_prim, PrimitiveResources( gfx.device, prim ) );
+		return it;
 	}
 
-	add_descriptors( node, prim.material );
+	bool ok;
+	std::tie( it, ok ) = texture_resources.emplace( view, TextureResources( *this, view ) );
+	assert( ok && "Cannot emplace texture resource" );
+	return it;
 }
 
 
-void Renderer::add( const Handle<Node>& node )
+void Renderer::remove_texture( const VkImageView view )
 {
-	if ( !node->mesh && !node->light )
-	{
-		return; // no mesh or light to add
-	}
+	texture_resources.erase( view );
+}
 
-	// The node has a mesh or a light, therefore we need UBOs for the MVP matrix
-	// MVP ubos are store in node resources
-	if ( !FIND( node_resources, node ) )
-	{
-		node_resources.emplace( node, NodeResources( gfx.swapchain ) );
-	}
 
-	if ( node->light )
+VkDescriptorSet Renderer::get_material_set( const Handle<Material>& material, const uint32_t frame_index )
+{
+	if ( !material || material->texture == VK_NULL_HANDLE )
 	{
-		// Create resources for the light
-		light_resources.emplace( node->light.get_index(), LightResources( gfx.swapchain ) );
+		return material_sets[frame_index];
 	}
 
-	if ( node->mesh )
+	auto texture_it = texture_resources.find( material->texture );
+	if ( texture_it == std::end( texture_resources ) )
 	{
-		// Now get the mesh, and its primitives
-		for ( auto& prim : node->mesh->primitives )
-		{
-			add( node, prim );
-		}
+		texture_it = add_texture( material->texture );
 	}
+	return texture_it->second.descriptor_sets[frame_index];
 }
 
 
-std::unordered_map<size_t, DescriptorResources>::iterator
-Renderer::add_descriptors( const Handle<Node>& node, const Handle<Material>& material )
+const std::vector<IndirectBatch>& Renderer::build_indirect_batches(
+	const std::vector<const DrawPacket*>& packets,
+	const uint32_t begin,
+	const uint32_t end,
+	const uint32_t instances_offset,
+	const uint32_t materials_offset,
+	const uint32_t frame_index )
 {
-	// We need descriptors for the MVP ubos and material textures
-	// A node may have a mesh with multiple primitives with different materials
-	// And the same material may appear into multiple primitives of different nodes
-	// So we hash combine both node and material
-	/// @todo Use handles to include generations when hash combining
-	auto key = std::hash_combine( node.get_index(), material.get_index() );
-	auto it = descriptor_resources.find( key );
-	if ( it != std::end( descriptor_resources ) )
-	{
-		// Skip if we already have resources associated to this pair ( node, material )
-		return it;
-	}
+	auto& uniforms = uniform_allocators[frame_index];
+	auto commands_offset = uniforms.allocate( ( end - begin ) * sizeof( VkDrawIndexedIndirectCommand ) );
+	auto commands = reinterpret_cast<VkDrawIndexedIndirectCommand*>( uniforms.data + commands_offset );
+	uint32_t command_count = 0;
 
-	if ( material )
+	// Batches of previous packets read different arrays
+	auto batches_begin = indirect_batches.size();
+
+	uint32_t first = begin;
+	while ( first < end )
 	{
-		// Add ubo for this material
-		if ( material_resources.find( material ) == std::end( material_resources ) )
+		auto packet = packets[first];
+
+		uint32_t count = 1;
+		while ( first + count < end && packets[first + count]->can_merge( *packet ) )
+		{
+			++count;
+		}
+
+		auto material_set = packet->material ? get_material_set( packet->material, frame_index ) : VK_NULL_HANDLE;
+
+		// Packets are sorted by pipeline and material set, so a batch only grows at the back
+		if ( indirect_batches.size() == batches_begin ||
+			indirect_batches.back().pipeline != packet->pipeline ||
+			indirect_batches.back().block != packet->resources->range.block ||
+			indirect_batches.back().material_set != material_set ||
+			( !packet->material && indirect_batches.back().line_width != packet->line_width ) )
 		{
-			material_resources.emplace( material, gfx.swapchain );
+			IndirectBatch batch;
+			batch.pipeline = packet->pipeline;
+			batch.block = packet->resources->range.block;
+			batch.material_set = material_set;
+			batch.line_width = packet->line_width;
+			batch.offset = commands_offset + command_count * sizeof( VkDrawIndexedIndirectCommand );
+			batch.instances_offset = instances_offset;
+			batch.materials_offset = materials_offset;
+			indirect_batches.emplace_back( batch );
 		}
+
+		auto& command = commands[command_count++];
+		command.indexCount = packet->index_count;
+		command.instanceCount = count;
+		command.firstIndex = packet->resources->range.first_index;
+		command.vertexOffset = int32_t( packet->resources->range.vertex_offset );
+		// Instance data of packets is at their sorted index within the array
+		command.firstInstance = first - begin;
+
+		++indirect_batches.back().draw_count;
+		first += count;
 	}
 
-	auto pipeline_index = select_pipeline( material );
-	auto& graphics_pipeline = pipelines[pipeline_index];
-	auto resource = DescriptorResources( *this, graphics_pipeline, node, material );
-	bool ok;
-	std::tie( it, ok ) = descriptor_resources.emplace( key, std::move( resource ) );
-	assert( ok && "Cannot emplace primitive resource" );
-	logi( "Descriptor [node {}, material {}]\n", node.get_index(), material.get_index() );
-	return it;
+	return indirect_batches;
 }
 
 
@@ -0,0 +1,486 @@
+#include "spot/gfx/uploads.h"
+
+#include <cassert>
+#include <cstring>
+
+#include "spot/gfx/graphics.h"
+#include "spot/gfx/images.h"
+
+
+namespace spot::gfx
+{
+
+
+/// @brief Ownership acquire of an image, which may be followed by the generation of its levels
+struct ImageAcquire
+{
+	Image* image = nullptr;
+	VkImageMemoryBarrier barrier = {};
+	bool generate_mipmaps = false;
+};
+
+
+/// @brief Uploads recorded into the same command buffer and submitted together
+struct UploadManager::Batch
+{
+	Batch( Device& device, CommandPool& pool );
+
+	CommandBuffer command_buffer;
+
+	/// Signaled when the transfer queue has executed this batch
+	Fence fence;
+
+	/// Sources of the copies, released when the batch completes
+	std::vector<Staging> staging;
+
+	/// Barriers to record on the graphics queue to acquire ownership of the resources
+	std::vector<VkBufferMemoryBarrier> buffer_acquires;
+	std::vector<ImageAcquire> image_acquires;
+
+	/// Ticket of the last upload of the batch
+	UploadTicket ticket = 0;
+};
+
+
+UploadManager::Batch::Batch( Device& device, CommandPool& pool )
+: command_buffer { std::move( pool.allocate_command_buffers()[0] ) }
+, fence { device }
+{}
+
+
+StagingRing::StagingRing( const Device& device, const VkDeviceSize cap )
+: buffer { device, cap, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryUsage::CPU_TO_GPU }
+, capacity { cap }
+{
+	data = reinterpret_cast<uint8_t*>( buffer.map( capacity ) );
+}
+
+
+StagingRing::Region StagingRing::reserve( const VkDeviceSize size, const VkDeviceSize alignment )
+{
+	assert( size > 0 && "Cannot reserve an empty region" );
+
+	Region region;
+	region.id = first_id + reservations.size();
+	region.offset = ( head + alignment - 1 ) / alignment * alignment;
+
+	if ( reservations.empty() || head > reservations.front().begin )
+	{
+		// Free space goes from the head to the end, then from the start to the oldest reservation
+		if ( region.offset + size > capacity )
+		{
+			auto tail = reservations.empty() ? capacity : reservations.front().begin;
+			region.offset = size <= tail ? 0 : invalid;
+		}
+	}
+	else if ( region.offset + size > reservations.front().begin )
+	{
+		// Wrapped around, free space goes from the head to the oldest reservation
+		region.offset = invalid;
+	}
+
+	if ( region.offset != invalid )
+	{
+		head = region.offset + size;
+		reservations.emplace_back( Reservation { region.offset, head } );
+	}
+
+	return region;
+}
+
+
+void StagingRing::release( const uint64_t id )
+{
+	assert( id >= first_id && id - first_id < reservations.size() && "Cannot release an unknown reservation" );
+	reservations[id - first_id].released = true;
+
+	while ( !reservations.empty() && reservations.front().released )
+	{
+		reservations.pop_front();
+		++first_id;
+	}
+
+	if ( reservations.empty() )
+	{
+		head = 0;
+	}
+}
+
+
+VkDeviceSize StagingRing::get_used_size() const
+{
+	if ( reservations.empty() )
+	{
+		return 0;
+	}
+
+	auto tail = reservations.front().begin;
+	return head > tail ? head - tail : capacity - tail + head;
+}
+
+
+UploadManager::UploadManager( Device& d, const VkDeviceSize staging_capacity )
+: device { d }
+, queue { d.find_transfer_queue() }
+, graphics_family { d.find_graphics_queue().family_index }
+, command_pool { d, queue.family_index }
+, graphics_pool { d, graphics_family }
+, ring { d, staging_capacity }
+{}
+
+
+UploadManager::~UploadManager()
+{
+	std::lock_guard<std::mutex> lock { mutex };
+
+	// Fences of submitted batches are waited upon when destroyed
+	in_flight.clear();
+}
+
+
+bool UploadManager::transfers_ownership() const
+{
+	return queue.family_index != graphics_family;
+}
+
+
+UploadManager::Batch& UploadManager::get_recording()
+{
+	if ( !recording )
+	{
+		if ( free_batches.empty() )
+		{
+			recording = std::make_unique<Batch>( device, command_pool );
+		}
+		else
+		{
+			recording = std::move( free_batches.back() );
+			free_batches.pop_back();
+		}
+		recording->command_buffer.begin( VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT );
+	}
+	return *recording;
+}
+
+
+Staging UploadManager::reserve( const VkDeviceSize size, const VkDeviceSize alignment )
+{
+	std::lock_guard<std::mutex> lock { mutex };
+
+	auto region = ring.reserve( size, alignment );
+
+	if ( region.offset == StagingRing::invalid && policy == StagingPolicy::BLOCK && size <= ring.capacity )
+	{
+		// Only submitted batches are waited upon, as the one being recorded may still grow
+		for ( auto& batch : in_flight )
+		{
+			if ( batch->staging.empty() )
+			{
+				continue;
+			}
+
+			++stall_count;
+			batch->fence.wait();
+			release_staging( *batch );
+
+			region = ring.reserve( size, alignment );
+			if ( region.offset != StagingRing::invalid )
+			{
+				break;
+			}
+		}
+	}
+
+	Staging staging;
+	staging.size = size;
+
+	if ( region.offset == StagingRing::invalid )
+	{
+		++spill_count;
+		staging.spill = std::make_unique<Buffer>( device, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, MemoryUsage::CPU_TO_GPU );
+		staging.data = reinterpret_cast<uint8_t*>( staging.spill->map( size ) );
+		staging.buffer = staging.spill.get();
+		return staging;
+	}
+
+	staging.data = ring.data + region.offset;
+	staging.buffer = &ring.buffer;
+	staging.offset = region.offset;
+	staging.reservation = region.id;
+	return staging;
+}
+
+
+void UploadManager::release_locked( Staging& staging )
+{
+	if ( staging.spill )
+	{
+		staging.spill.reset();
+	}
+	else if ( staging.buffer )
+	{
+		ring.release( staging.reservation );
+	}
+	staging = {};
+}
+
+
+void UploadManager::release( Staging& staging )
+{
+	std::lock_guard<std::mutex> lock { mutex };
+	release_locked( staging );
+}
+
+
+void UploadManager::release_staging( Batch& batch )
+{
+	for ( auto& staging : batch.staging )
+	{
+		release_locked( staging );
+	}
+	batch.staging.clear();
+}
+
+
+UploadTicket UploadManager::upload( const Buffer& dst, const VkDeviceSize offset, const uint8_t* data, const VkDeviceSize size )
+{
+	auto staging = reserve( size );
+	std::memcpy( staging.data, data, size );
+	return upload( std::move( staging ), dst, offset );
+}
+
+
+UploadTicket UploadManager::upload( Staging&& staging, const Buffer& dst, const VkDeviceSize offset )
+{
+	std::lock_guard<std::mutex> lock { mutex };
+
+	auto& batch = get_recording();
+	auto& cmd = batch.command_buffer;
+
+	VkBufferCopy region = {};
+	region.srcOffset = staging.offset;
+	region.dstOffset = offset;
+	region.size = staging.size;
+	cmd.copy( *staging.buffer, dst, region );
+
+	VkBufferMemoryBarrier barrier = {};
+	barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+	barrier.buffer = dst.handle;
+	barrier.offset = offset;
+	barrier.size = region.size;
+
+	auto read_stages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+	auto read_access = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+
+	if ( transfers_ownership() )
+	{
+		// Release, destination access is ignored as it is defined by the acquire
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.srcQueueFamilyIndex = queue.family_index;
+		barrier.dstQueueFamilyIndex = graphics_family;
+		cmd.barrier( VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, barrier );
+
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = read_access;
+		batch.buffer_acquires.emplace_back( barrier );
+	}
+	else
+	{
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask = read_access;
+		barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		cmd.barrier( VK_PIPELINE_STAGE_TRANSFER_BIT, read_stages, barrier );
+	}
+
+	batch.staging.emplace_back( std::move( staging ) );
+	batch.ticket = next_ticket++;
+	return batch.ticket;
+}
+
+
+UploadTicket UploadManager::upload( Staging&& staging, Image& image, const bool generate_mipmaps )
+{
+	std::lock_guard<std::mutex> lock { mutex };
+
+	auto& batch = get_recording();
+	auto& cmd = batch.command_buffer;
+
+	cmd.transition( image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL );
+	if ( generate_mipmaps )
+	{
+		cmd.copy( *staging.buffer, image, staging.offset );
+	}
+	else
+	{
+		auto offsets = image.get_level_offsets();
+		for ( uint32_t level = 0; level < image.mip_levels; ++level )
+		{
+			cmd.copy( *staging.buffer, image, staging.offset + offsets[level], level );
+		}
+	}
+
+	if ( transfers_ownership() )
+	{
+		// Release and acquire should specify the same layout transition,
+		// while blits need the graphics queue and the transfer dst layout
+		ImageAcquire acquire;
+		acquire.image = &image;
+		acquire.generate_mipmaps = generate_mipmaps;
+
+		auto& barrier = acquire.barrier;
+		barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout = generate_mipmaps ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcQueueFamilyIndex = queue.family_index;
+		barrier.dstQueueFamilyIndex = graphics_family;
+		barrier.image = image.handle;
+		barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		barrier.subresourceRange.levelCount = image.mip_levels;
+		barrier.subresourceRange.layerCount = 1;
+		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+		cmd.barrier( VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, barrier );
+
+		barrier.srcAccessMask = 0;
+		barrier.dstAccessMask = generate_mipmaps ? VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT : VK_ACCESS_SHADER_READ_BIT;
+		batch.image_acquires.emplace_back( acquire );
+	}
+	else if ( generate_mipmaps )
+	{
+		cmd.generate_mipmaps( image );
+	}
+	else
+	{
+		cmd.transition( image, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL );
+	}
+
+	batch.staging.emplace_back( std::move( staging ) );
+	batch.ticket = next_ticket++;
+	return batch.ticket;
+}
+
+
+void UploadManager::flush_locked()
+{
+	if ( !recording )
+	{
+		return;
+	}
+
+	recording->command_buffer.end();
+	recording->fence.reset();
+	queue.submit( recording->command_buffer, {}, {}, &recording->fence );
+
+	in_flight.emplace_back( std::move( recording ) );
+}
+
+
+void UploadManager::flush()
+{
+	std::lock_guard<std::mutex> lock { mutex };
+	flush_locked();
+}
+
+
+void UploadManager::poll( CommandBuffer& cmd )
+{
+	std::lock_guard<std::mutex> lock { mutex };
+
+	flush_locked();
+
+	// Batches are executed in submission order
+	while ( !in_flight.empty() && in_flight.front()->fence.is_signaled() )
+	{
+		retire_front( cmd );
+	}
+}
+
+
+void UploadManager::wait( const UploadTicket ticket )
+{
+	std::lock_guard<std::mutex> lock { mutex };
+
+	if ( ticket <= completed )
+	{
+		return;
+	}
+
+	flush_locked();
+
+	if ( !acquires )
+	{
+		acquires = std::make_unique<Batch>( device, graphics_pool );
+	}
+
+	// The previous submission was waited upon, so the command buffer can be recorded again
+	auto& cmd = acquires->command_buffer;
+	cmd.begin( VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT );
+
+	while ( completed < ticket && !in_flight.empty() )
+	{
+		in_flight.front()->fence.wait();
+		retire_front( cmd );
+	}
+
+	cmd.end();
+
+	acquires->fence.reset();
+	device.find_graphics_queue().submit( cmd, {}, {}, &acquires->fence );
+	acquires->fence.wait();
+}
+
+
+void UploadManager::retire_front( CommandBuffer& cmd )
+{
+	auto batch = std::move( in_flight.front() );
+	in_flight.pop_front();
+
+	for ( auto& barrier : batch->buffer_acquires )
+	{
+		cmd.barrier( VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			barrier );
+	}
+
+	for ( auto& acquire : batch->image_acquires )
+	{
+		auto dst_stage = acquire.generate_mipmaps ? VK_PIPELINE_STAGE_TRANSFER_BIT : VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		cmd.barrier( VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, dst_stage, acquire.barrier );
+		acquire.image->layout = acquire.barrier.newLayout;
+
+		if ( acquire.generate_mipmaps )
+		{
+			cmd.generate_mipmaps( *acquire.image );
+		}
+	}
+
+	completed = batch->ticket;
+
+	release_staging( *batch );
+	batch->buffer_acquires.clear();
+	batch->image_acquires.clear();
+	free_batches.emplace_back( std::move( batch ) );
+}
+
+
+UploadManager::Stats UploadManager::get_stats() const
+{
+	std::lock_guard<std::mutex> lock { mutex };
+
+	Stats stats;
+	stats.stall_count = stall_count;
+	stats.spill_count = spill_count;
+	stats.staging_used = ring.get_used_size();
+	stats.staging_capacity = ring.capacity;
+	return stats;
+}
+
+
+bool UploadManager::is_complete( const UploadTicket ticket ) const
+{
+	std::lock_guard<std::mutex> lock { mutex };
+	return ticket <= completed;
+}
+
+
+} // namespace spot::gfx
@@ -0,0 +1,155 @@
+#include "spot/gfx/workers.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+
+namespace spot::gfx
+{
+
+
+WorkerPool::WorkerPool( uint32_t count )
+{
+	if ( count == 0 )
+	{
+		// Leave a hardware thread to the one submitting frames
+		auto hardware_threads = std::thread::hardware_concurrency();
+		count = std::max( 1u, hardware_threads > 1 ? hardware_threads - 1 : 1u );
+	}
+
+	threads.reserve( count );
+	for ( uint32_t i = 0; i < count; ++i )
+	{
+		threads.emplace_back( &WorkerPool::work, this );
+	}
+}
+
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock { mutex };
+		stopping = true;
+		tasks.clear();
+	}
+	condition.notify_all();
+
+	for ( auto& thread : threads )
+	{
+		thread.join();
+	}
+}
+
+
+void WorkerPool::push( std::function<void()> task )
+{
+	{
+		std::lock_guard<std::mutex> lock { mutex };
+		tasks.emplace_back( std::move( task ) );
+	}
+	condition.notify_one();
+}
+
+
+void WorkerPool::parallel_for( const size_t count, std::function<void( size_t )> function )
+{
+	// Shared with helper tasks, which may start after this call returns
+	struct Loop
+	{
+		std::function<void( size_t )> function;
+		size_t count = 0;
+		std::atomic<size_t> next = 0;
+		size_t done = 0;
+		std::mutex mutex;
+		std::condition_variable condition;
+
+		/// First exception thrown by the function, rethrown on the calling thread
+		std::exception_ptr error;
+		std::atomic<bool> failed = false;
+
+		/// @brief Claims and runs indices until none is left
+		/// Once the function throws, indices left are claimed without running it
+		void run()
+		{
+			size_t ran = 0;
+			for ( auto i = next++; i < count; i = next++ )
+			{
+				if ( !failed )
+				{
+					try
+					{
+						function( i );
+					}
+					catch ( ... )
+					{
+						std::lock_guard<std::mutex> lock { mutex };
+						if ( !error )
+						{
+							error = std::current_exception();
+						}
+						failed = true;
+					}
+				}
+				++ran;
+			}
+
+			if ( ran > 0 )
+			{
+				std::lock_guard<std::mutex> lock { mutex };
+				done += ran;
+				if ( done == count )
+				{
+					condition.notify_all();
+				}
+			}
+		}
+	};
+
+	auto loop = std::make_shared<Loop>();
+	loop->function = std::move( function );
+	loop->count = count;
+
+	auto helpers = std::min<size_t>( threads.size(), count > 0 ? count - 1 : 0 );
+	for ( size_t i = 0; i < helpers; ++i )
+	{
+		push( [loop]() { loop->run(); } );
+	}
+
+	loop->run();
+
+	std::unique_lock<std::mutex> lock { loop->mutex };
+	loop->condition.wait( lock, [&loop] { return loop->done == loop->count; } );
+
+	if ( loop->error )
+	{
+		std::rethrow_exception( loop->error );
+	}
+}
+
+
+void WorkerPool::work()
+{
+	while ( true )
+	{
+		std::function<void()> task;
+
+		{
+			std::unique_lock<std::mutex> lock { mutex };
+			condition.wait( lock, [this] { return stopping || !tasks.empty(); } );
+			if ( stopping )
+			{
+				return;
+			}
+
+			task = std::move( tasks.front() );
+			tasks.pop_front();
+		}
+
+		task();
+	}
+}
+
+
+} // namespace spot::gfx
@@ -0,0 +1,110 @@
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+#include <spot/log.h>
+
+#include "spot/gltf/accessor.h"
+#include "spot/gltf/buffer.h"
+
+
+/// Measures how fast 16 bit indices are widened, by the SIMD kernel and by a scalar loop,
+/// then how fast vertex attributes are converted to floats, strided and normalized
+int main( const int argc, const char** argv )
+{
+	using namespace spot;
+	using Clock = std::chrono::steady_clock;
+
+	size_t count = argc > 1 ? std::atoll( argv[1] ) : 16 * 1024 * 1024;
+	auto iterations = argc > 2 ? std::atoi( argv[2] ) : 16;
+
+	std::vector<uint16_t> src( count );
+	for ( size_t i = 0; i < count; ++i )
+	{
+		src[i] = uint16_t( i * 7 );
+	}
+	std::vector<uint32_t> dst( count );
+
+	auto measure = [&]( const char* name, auto&& function )
+	{
+		auto start = Clock::now();
+		for ( int i = 0; i < iterations; ++i )
+		{
+			function();
+		}
+		auto seconds = std::chrono::duration<double>( Clock::now() - start ).count();
+		logi( "{}: {:.2f} M indices/s\n", name, count * double( iterations ) / seconds / 1e6 );
+	};
+
+	measure( "simd", [&]() { gfx::widen( src.data(), count, dst.data() ); } );
+
+	measure( "scalar", [&]() {
+		// Volatile keeps the compiler from vectorizing the reference loop
+		volatile uint32_t* out = dst.data();
+		for ( size_t i = 0; i < count; ++i )
+		{
+			out[i] = src[i];
+		}
+	} );
+
+	// Attributes of the same count, each in a buffer of its own
+	Uvec<gfx::ByteBuffer> buffers;
+	Uvec<gfx::BufferView> views;
+	Uvec<gfx::Accessor> accessors;
+
+	auto make_accessor = [&]( gfx::Accessor::ComponentType component_type, gfx::Accessor::Type type, bool normalized, size_t stride )
+	{
+		auto buffer = buffers.push();
+		buffer->byte_length = count * stride;
+		buffer->data.resize( buffer->byte_length );
+		for ( size_t i = 0; i < buffer->data.size(); ++i )
+		{
+			// Small values, which are valid floats as well
+			buffer->data[i] = char( i % 61 );
+		}
+
+		auto view = views.push();
+		view->buffer = buffer;
+		view->byte_length = buffer->byte_length;
+		view->byte_stride = stride;
+
+		auto accessor = accessors.push();
+		accessor->buffer_view = view;
+		accessor->component_type = component_type;
+		accessor->type = type;
+		accessor->normalized = normalized;
+		accessor->count = count;
+		return accessor;
+	};
+
+	std::vector<float> floats( count * 4 );
+
+	auto measure_read = [&]( const char* name, const gfx::Accessor& accessor )
+	{
+		auto view = gfx::AccessorView<float>( accessor );
+		auto start = Clock::now();
+		for ( int i = 0; i < iterations; ++i )
+		{
+			view.read( floats.data(), view.components * sizeof( float ), view.components );
+		}
+		auto seconds = std::chrono::duration<double>( Clock::now() - start ).count();
+		auto elements = count * double( iterations ) / seconds;
+		logi( "{}: {:.2f} M elements/s, {:.2f} GB/s written\n",
+			name,
+			elements / 1e6,
+			elements * view.components * sizeof( float ) / 1e9 );
+	};
+
+	using Component = gfx::Accessor::ComponentType;
+	using Type = gfx::Accessor::Type;
+
+	// Positions, tightly packed and interleaved with a normal and a texture coordinate
+	measure_read( "vec3 float packed", *make_accessor( Component::FLOAT, Type::VEC3, false, 12 ) );
+	measure_read( "vec3 float stride 32", *make_accessor( Component::FLOAT, Type::VEC3, false, 32 ) );
+
+	// Compressed texture coordinates and colors
+	measure_read( "vec2 unorm16", *make_accessor( Component::UNSIGNED_SHORT, Type::VEC2, true, 4 ) );
+	measure_read( "vec4 unorm8", *make_accessor( Component::UNSIGNED_BYTE, Type::VEC4, true, 4 ) );
+	measure_read( "vec4 unorm8 stride 16", *make_accessor( Component::UNSIGNED_BYTE, Type::VEC4, true, 16 ) );
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,63 @@
+#include <chrono>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <spot/log.h>
+
+#include "spot/gltf/buffer.h"
+
+
+/// Measures how fast base64 data URIs of glTF buffers are decoded, by the table loop and by vector instructions
+int main( const int argc, const char** argv )
+{
+	using namespace spot;
+	using Clock = std::chrono::steady_clock;
+
+	size_t megabytes = argc > 1 ? std::atoll( argv[1] ) : 64;
+	auto iterations = argc > 2 ? std::atoi( argv[2] ) : 8;
+
+	// Random characters of the alphabet, as decoding does not depend on their meaning
+	constexpr char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	auto encoded = std::string( megabytes * 1024 * 1024, 'A' );
+	auto random = std::mt19937();
+	for ( auto& c : encoded )
+	{
+		c = alphabet[random() % 64];
+	}
+
+	// Scalar first, as the baseline of the vector instructions
+	double scalar_rate = 0.0;
+	for ( auto decoder : { gfx::Base64Decoder::SCALAR, gfx::Base64Decoder::SIMD } )
+	{
+		size_t decoded = 0;
+		auto start = Clock::now();
+		for ( int i = 0; i < iterations; ++i )
+		{
+			decoded += gfx::base64_decode( encoded.data(), encoded.size(), decoder ).size();
+		}
+		auto seconds = std::chrono::duration<double>( Clock::now() - start ).count();
+		auto rate = megabytes * iterations / seconds;
+
+		if ( decoder == gfx::Base64Decoder::SCALAR )
+		{
+			scalar_rate = rate;
+			logi( "scalar: {} MB of base64 in {:.3f} ms, {:.2f} MB/s, {} bytes decoded\n",
+				megabytes,
+				seconds * 1000.0 / iterations,
+				rate,
+				decoded );
+		}
+		else
+		{
+			logi( "{}: {} MB of base64 in {:.3f} ms, {:.2f} MB/s, {} bytes decoded, {:.2f}x scalar\n",
+				gfx::get_base64_simd_name(),
+				megabytes,
+				seconds * 1000.0 / iterations,
+				rate,
+				decoded,
+				rate / scalar_rate );
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,68 @@
+#include <chrono>
+#include <cstdlib>
+#include <spot/log.h>
+
+#include "spot/gfx/graphics.h"
+
+
+/// Measures how recording draws scales with the number of recording threads
+int main( const int argc, const char** argv )
+{
+	using namespace spot;
+	using Clock = std::chrono::steady_clock;
+
+	auto side = argc > 1 ? std::atoi( argv[1] ) : 32;
+	auto frames = argc > 2 ? std::atoi( argv[2] ) : 256;
+
+	auto gfx = gfx::Graphics();
+	gfx.window.on_resize = [&gfx]( const VkExtent2D& extent ) { gfx.viewport.set_extent( extent ); };
+	gfx.camera.set_perspective( gfx.viewport, math::radians( 60.0f ) );
+	auto eye = math::Vec3::One * float( side );
+	gfx.camera.look_at( eye, math::Vec3::Zero, math::Vec3::Y );
+
+	// A grid of cubes, each with its own mesh so that none is merged into an instanced batch
+	auto model = gfx.models.push( gfx.device );
+	auto material = model->materials.push( gfx::Material( gfx::Color::Gray ) );
+	auto root = model->nodes.push();
+	for ( int x = 0; x < side; ++x )
+	{
+		for ( int z = 0; z < side; ++z )
+		{
+			auto cube = model->nodes.push( model->meshes.push( gfx::Mesh::create_cube( material ) ) );
+			cube->translation.x = 2.0f * ( x - side / 2 );
+			cube->translation.z = 2.0f * ( z - side / 2 );
+			root->add_child( cube );
+		}
+	}
+
+	// One more than the pool, as the calling thread records a range as well
+	for ( uint32_t threads = 1; threads <= gfx.workers.size() + 1 && gfx.window.is_alive(); threads *= 2 )
+	{
+		gfx.recording_threads = threads;
+
+		Clock::duration recording = {};
+		int recorded = 0;
+		for ( int i = 0; i < frames && gfx.window.is_alive(); ++i )
+		{
+			gfx.glfw.poll();
+			if ( gfx.render_begin() )
+			{
+				gfx.draw( root );
+
+				auto start = Clock::now();
+				gfx.render_end();
+				recording += Clock::now() - start;
+				++recorded;
+			}
+		}
+
+		if ( recorded > 0 )
+		{
+			auto ms = std::chrono::duration<double, std::milli>( recording ).count() / recorded;
+			logi( "{} draws, {} threads: {:.3f} ms per frame\n", side * side, threads, ms );
+		}
+	}
+
+	gfx.device.wait_idle();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,102 @@
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <spot/log.h>
+
+#include "spot/gfx/graphics.h"
+#include "spot/gltf/gltf.h"
+
+
+/// Writes a glTF with a node, a mesh, and two accessors for each triangle,
+/// all of them viewing one external binary buffer
+/// @return Path of the written glTF
+std::string write_triangles( const std::filesystem::path& dir, const size_t count )
+{
+	// Three u16 indices padded to 8 bytes, followed by three float positions
+	const uint16_t indices[4] = { 0, 1, 2, 0 };
+	const float positions[9] = { 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f };
+	const size_t stride = sizeof( indices ) + sizeof( positions );
+
+	std::ofstream bin( dir / "triangles.bin", std::ios::binary );
+	for ( size_t i = 0; i < count; ++i )
+	{
+		bin.write( reinterpret_cast<const char*>( indices ), sizeof( indices ) );
+		bin.write( reinterpret_cast<const char*>( positions ), sizeof( positions ) );
+	}
+
+	auto j = nlohmann::json::object();
+	j["asset"] = { { "version", "2.0" } };
+	j["buffers"] = { { { "uri", "triangles.bin" }, { "byteLength", stride * count } } };
+	j["bufferViews"] = {
+		{ { "buffer", 0 }, { "byteLength", stride * count }, { "target", 34963 } },
+		{ { "buffer", 0 }, { "byteLength", stride * count }, { "target", 34962 } },
+	};
+
+	auto& accessors = j["accessors"] = nlohmann::json::array();
+	auto& meshes = j["meshes"] = nlohmann::json::array();
+	auto& nodes = j["nodes"] = nlohmann::json::array();
+	auto roots = nlohmann::json::array();
+	for ( size_t i = 0; i < count; ++i )
+	{
+		auto offset = stride * i;
+		accessors.push_back( {
+			{ "bufferView", 0 }, { "byteOffset", offset },
+			{ "componentType", 5123 }, { "count", 3 }, { "type", "SCALAR" } } );
+		accessors.push_back( {
+			{ "bufferView", 1 }, { "byteOffset", offset + sizeof( indices ) },
+			{ "componentType", 5126 }, { "count", 3 }, { "type", "VEC3" },
+			{ "min", { 0.0f, 0.0f, 0.0f } }, { "max", { 1.0f, 1.0f, 0.0f } } } );
+		meshes.push_back( { { "primitives", { {
+			{ "attributes", { { "POSITION", 2 * i + 1 } } },
+			{ "indices", 2 * i } } } } } );
+		nodes.push_back( { { "mesh", i }, { "translation", { float( i % 64 ), float( i / 64 ), 0.0f } } } );
+		roots.push_back( i );
+	}
+	j["scenes"] = { { { "nodes", roots } } };
+	j["scene"] = 0;
+
+	auto path = ( dir / "triangles.gltf" ).string();
+	std::ofstream( path ) << j;
+	return path;
+}
+
+
+/// Measures how fast glTF files are parsed, both serially and with the worker pool
+/// Without a glTF argument, it measures a generated one with many small triangles
+int main( const int argc, const char** argv )
+{
+	using namespace spot;
+	using Clock = std::chrono::steady_clock;
+
+	auto path = argc > 1 ? std::string( argv[1] )
+		: write_triangles( std::filesystem::temp_directory_path(), 16384 );
+	auto iterations = argc > 2 ? std::atoi( argv[2] ) : 16;
+	auto megabytes = std::filesystem::file_size( path ) / ( 1024.0 * 1024.0 );
+
+	auto gfx = gfx::Graphics();
+
+	for ( auto workers : { static_cast<gfx::WorkerPool*>( nullptr ), &gfx.workers } )
+	{
+		auto start = Clock::now();
+		for ( int i = 0; i < iterations; ++i )
+		{
+			auto model = gfx::Gltf( gfx.device, path, workers );
+			if ( model.scenes.empty() || model.scenes[0].nodes.empty() )
+			{
+				loge( "No nodes loaded from {}\n", path );
+				return EXIT_FAILURE;
+			}
+		}
+		auto seconds = std::chrono::duration<double>( Clock::now() - start ).count();
+
+		logi( "{}: {:.2f} MB in {:.3f} ms, {:.2f} MB/s\n",
+			workers ? "workers" : "serial",
+			megabytes,
+			seconds * 1000.0 / iterations,
+			megabytes * iterations / seconds );
+	}
+
+	gfx.device.wait_idle();
+	return EXIT_SUCCESS;
+}
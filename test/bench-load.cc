@@ -0,0 +1,76 @@
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <sys/resource.h>
+#include <spot/log.h>
+
+#include "spot/gfx/graphics.h"
+#include "spot/gltf/gltf.h"
+
+
+/// @return Peak resident set size of the process in kilobytes
+long get_peak_rss()
+{
+	struct rusage usage;
+	getrusage( RUSAGE_SELF, &usage );
+	return usage.ru_maxrss;
+}
+
+
+/// Measures load time and peak memory of a glTF, either mapped and streamed by Gltf,
+/// or read through an ifstream into a whole JSON document first, as it used to be
+/// The peak only grows within a process, so run each mode in a process of its own
+int main( const int argc, const char** argv )
+{
+	using namespace spot;
+	using Clock = std::chrono::steady_clock;
+
+	auto mode = std::string( argc > 1 ? argv[1] : "" );
+	if ( argc < 3 || ( mode != "mapped" && mode != "document" ) )
+	{
+		loge( "Usage: {} <mapped|document> <gltf> [iterations]\n", argv[0] );
+		return EXIT_FAILURE;
+	}
+
+	auto path = std::string( argv[2] );
+	auto iterations = argc > 3 ? std::atoi( argv[3] ) : 16;
+
+	auto gfx = gfx::Graphics();
+
+	// Vulkan and the window are already there, so the growth is due to loading
+	auto rss_before = get_peak_rss();
+
+	auto start = Clock::now();
+	for ( int i = 0; i < iterations; ++i )
+	{
+		if ( mode == "mapped" )
+		{
+			auto model = gfx::Gltf( gfx.device, path );
+		}
+		else
+		{
+			// Binary glTF was not supported by this path
+			auto in = std::ifstream( path );
+			if ( !in.is_open() )
+			{
+				loge( "Cannot open {}\n", path );
+				return EXIT_FAILURE;
+			}
+			nlohmann::json js;
+			in >> js;
+			auto model = gfx::Gltf( gfx.device, js, path );
+		}
+	}
+	auto seconds = std::chrono::duration<double>( Clock::now() - start ).count();
+
+	auto rss_after = get_peak_rss();
+	logi( "{}: {:.3f} ms, peak RSS {} KB, {} KB over the {} KB before loading\n",
+		mode,
+		seconds * 1000.0 / iterations,
+		rss_after,
+		rss_after - rss_before,
+		rss_before );
+
+	gfx.device.wait_idle();
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,80 @@
+#include <chrono>
+#include <cstdlib>
+#include <spot/log.h>
+
+#include "spot/gfx/graphics.h"
+
+
+/// Measures frame time of a floor of textured quads, each a few pixels wide, with or without mipmaps
+/// Mipmaps are chosen when the texture is loaded, so run each mode in a process of its own.
+/// Frames are capped by the refresh rate when the swapchain cannot use mailbox presentation.
+int main( const int argc, const char** argv )
+{
+	using namespace spot;
+	using Clock = std::chrono::steady_clock;
+
+	auto mode = std::string( argc > 1 ? argv[1] : "" );
+	if ( mode != "on" && mode != "off" )
+	{
+		loge( "Usage: {} <on|off> [png] [side] [frames]\n", argv[0] );
+		return EXIT_FAILURE;
+	}
+
+	auto path = argc > 2 ? std::string( argv[2] ) : std::string( "img/lena.png" );
+	auto side = argc > 3 ? std::atoi( argv[3] ) : 64;
+	auto frames = argc > 4 ? std::atoi( argv[4] ) : 512;
+
+	auto gfx = gfx::Graphics();
+	gfx.window.on_resize = [&gfx]( const VkExtent2D& extent ) { gfx.viewport.set_extent( extent ); };
+	gfx.camera.set_perspective( gfx.viewport, math::radians( 60.0f ) );
+	gfx.camera.look_at( math::Vec3( 0.0f, float( side ) / 2.0f, float( side ) ), math::Vec3::Zero, math::Vec3::Y );
+
+	gfx.textures.mipmaps = mode == "on";
+
+	// Quads share their mesh, so they are drawn as instances and the texture dominates the frame
+	auto model = gfx.models.push( gfx.device );
+	auto material = model->materials.push( gfx::Material( gfx.textures.load( path ) ) );
+	auto quad = model->meshes.push( gfx::Mesh::create_quad( material ) );
+	auto root = model->nodes.push();
+	for ( int x = 0; x < side; ++x )
+	{
+		for ( int z = 0; z < side; ++z )
+		{
+			auto node = model->nodes.push( quad );
+			node->translation.x = float( x - side / 2 );
+			node->translation.z = float( z - side / 2 );
+			node->rotation = math::Quat( math::Vec3::X, math::radians( -90.0f ) );
+			root->add_child( node );
+		}
+	}
+
+	// Warm up until uploads and pipelines are ready
+	constexpr int warm_up = 16;
+
+	Clock::time_point start;
+	int rendered = 0;
+	for ( int i = 0; i < warm_up + frames && gfx.window.is_alive(); ++i )
+	{
+		if ( i == warm_up )
+		{
+			start = Clock::now();
+		}
+
+		gfx.glfw.poll();
+		if ( gfx.render_begin() )
+		{
+			gfx.draw( root );
+			gfx.render_end();
+			rendered += i >= warm_up;
+		}
+	}
+
+	if ( rendered > 0 )
+	{
+		auto ms = std::chrono::duration<double, std::milli>( Clock::now() - start ).count() / rendered;
+		logi( "mipmaps {}, {} quads: {:.3f} ms per frame\n", mode, side * side, ms );
+	}
+
+	gfx.device.wait_idle();
+	return EXIT_SUCCESS;
+}
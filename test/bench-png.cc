@@ -0,0 +1,43 @@
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+#include <spot/log.h>
+
+#include "spot/gfx/png.h"
+
+
+/// Measures how fast a png, preferably of a few megapixels, is decoded
+int main( const int argc, const char** argv )
+{
+	using namespace spot;
+	using Clock = std::chrono::steady_clock;
+
+	if ( argc < 2 )
+	{
+		loge( "Usage: {} <png> [iterations]\n", argv[0] );
+		return EXIT_FAILURE;
+	}
+
+	auto path = std::string( argv[1] );
+	auto iterations = argc > 2 ? std::atoi( argv[2] ) : 16;
+
+	std::vector<png_byte> bytes;
+	double megapixels = 0.0;
+
+	auto start = Clock::now();
+	for ( int i = 0; i < iterations; ++i )
+	{
+		auto png = gfx::Png( path );
+		bytes.resize( png.get_size() );
+		png.load( bytes.data() );
+		megapixels = png.width * double( png.height ) / 1e6;
+	}
+	auto seconds = std::chrono::duration<double>( Clock::now() - start ).count();
+
+	logi( "{:.2f} MP in {:.3f} ms, {:.2f} MP/s\n",
+		megapixels,
+		seconds * 1000.0 / iterations,
+		megapixels * iterations / seconds );
+
+	return EXIT_SUCCESS;
+}
@@ -43,7 +43,7 @@ int main()
 
 	auto quad = model->nodes.push( gfx::Node(
 		model->meshes.push( gfx::Mesh::create_quad(
-			model->materials.push( model->images.load( "img/lena.png" ) )
+			model->materials.push( gfx.textures.load( "img/lena.png" ) )
 		) )
 	) );
 
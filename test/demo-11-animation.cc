@@ -11,7 +11,7 @@ int main( const int argc, const char** argv )
 
 	auto quad = model->nodes.push( gfx::Node(
 			model->meshes.push( gfx::Mesh::create_quad(
-					model->materials.push( gfx::Material( model->images.load( "img/lena.png" ) ) )
+					model->materials.push( gfx::Material( gfx.textures.load( "img/lena.png" ) ) )
 			) )
 	) );
 
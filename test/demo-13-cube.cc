@@ -24,7 +24,7 @@ int main( const int argc, const char** argv )
 
 	auto cube = model->nodes.push(
 		model->meshes.push( gfx::Mesh::create_cube(
-			model->materials.push( model->images.load( "img/dice.png" ) )
+			model->materials.push( gfx.textures.load( "img/dice.png" ) )
 		) )
 	);
 
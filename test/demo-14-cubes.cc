@@ -27,7 +27,7 @@ int main( const int argc, const char** argv )
 	auto dice = model->nodes.push(
 		model->meshes.push( gfx::Mesh::create_cube(
 			model->materials.push(
-				model->images.load( "img/dice.png" )
+				gfx.textures.load( "img/dice.png" )
 			)
 		) )
 	);
@@ -23,7 +23,7 @@ void update( const double dt, Handle<Node>& node )
 }
 
 
-Handle<Node> create_card( const Handle<Gltf>& model )
+Handle<Node> create_card( const Handle<Gltf>& model, Images& textures )
 {
 	std::vector<Vertex> vertices = {
 		Vertex(
@@ -52,7 +52,7 @@ Handle<Node> create_card( const Handle<Gltf>& model )
 	std::vector<Index> indices = { 0, 2, 1, 1, 2, 3 };
 
 	auto material = model->materials.push(
-		Material( model->images.load( "img/card.png" ) )
+		Material( textures.load( "img/card.png" ) )
 	);
 
 	auto card = model->meshes.push( Mesh(
@@ -71,7 +71,7 @@ int main()
 
 	auto gfx = gfx::Graphics();
 
-	auto card = create_card( gfx.models.push( gfx::Gltf( gfx.device ) ) );
+	auto card = create_card( gfx.models.push( gfx::Gltf( gfx.device ) ), gfx.textures );
 
 	gfx.window.on_resize = [&gfx]( const VkExtent2D& extent ) { gfx.viewport.set_extent( extent ); };
 	gfx.camera.set_perspective( gfx.viewport );
@@ -18,23 +18,24 @@ Handle<Node> create_line( const Handle<Gltf>& model, gfx::Dot a, gfx::Dot b )
 	node->mesh = mesh;
 
 	auto& primitive = mesh->primitives.emplace_back();
-	primitive.vertices = {
-		gfx::Vertex( a.p, a.c ),
-		gfx::Vertex( b.p, b.c )
-	};
-
-	primitive.indices = { 0, 1 };
+	primitive.set_geometry(
+		{
+			gfx::Vertex( a.p, a.c ),
+			gfx::Vertex( b.p, b.c )
+		},
+		{ 0, 1 }
+	);
 
 	return node;
 }
 
 
-Handle<Node> create_lena( const Handle<Gltf>& model )
+Handle<Node> create_lena( const Handle<Gltf>& model, Images& textures )
 {
 	return model->nodes.push( Node(
 		model->meshes.push( Mesh::create_quad(
 			model->materials.push(
-				Material( model->images.load( "img/lena.png" ) )
+				Material( textures.load( "img/lena.png" ) )
 			)
 		) )
 	) );
@@ -78,7 +79,7 @@ int main( const int argc, const char** argv )
 		gfx::Dot( math::Vec3( 0.0f, 0.0f, 0.0f ), gfx::Color( 0.0f, 0.0f, 1.0f, 1.0f ) ),
 		gfx::Dot( math::Vec3( 0.0f, 0.0f, 1.0f ), gfx::Color( 0.0f, 0.0f, 1.0f, 1.0f ) ) );
 
-	auto triangle = create_lena( model );
+	auto triangle = create_lena( model, gfx.textures );
 	
 	gfx.camera.set_perspective( gfx.viewport, math::radians( 60.0f ) );
 	gfx.camera.look_at( math::Vec3::One, math::Vec3::Zero, math::Vec3::Y );
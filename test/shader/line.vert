@@ -1,11 +1,26 @@
 #version 450
 
-layout( binding = 0 ) uniform UniformBufferObject {
-	mat4 model;
+layout( set = 0, binding = 0 ) uniform View {
 	mat4 view;
 	mat4 proj;
 } ubo;
 
+struct Instance {
+	mat4 model;
+	uint material;
+};
+
+layout( set = 2, binding = 0 ) readonly buffer Instances {
+	Instance instances[];
+};
+
+// A single instance gets its data through push constants
+layout( push_constant ) uniform Object {
+	mat4 model;
+	uint material;
+	uint instanced;
+} object;
+
 layout( location = 0 ) in vec3 in_position;
 layout( location = 1 ) in vec4 in_color;
 
@@ -13,7 +28,15 @@ layout( location = 0 ) out vec4 out_color;
 
 void main()
 {
+	mat4 model = object.model;
+	uint material = object.material;
+	if ( object.instanced != 0 )
+	{
+		model = instances[gl_InstanceIndex].model;
+		material = instances[gl_InstanceIndex].material;
+	}
+
 	gl_PointSize = 8.0;
 	out_color = in_color;
-	gl_Position = ubo.proj * ubo.view * ubo.model * vec4(in_position, 1.0);
+	gl_Position = ubo.proj * ubo.view * model * vec4(in_position, 1.0);
 }
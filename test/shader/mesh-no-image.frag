@@ -1,29 +1,35 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout( binding = 1 ) uniform Ambient
+layout( set = 0, binding = 1 ) uniform Ambient
 {
 	vec3 color;
 	float strength;
 } ambient;
 
-layout( binding = 2 ) uniform Light
+layout( set = 0, binding = 2 ) uniform Light
 {
 	vec3 position;
 	vec3 color;
 } light;
 
-layout( binding = 3 ) uniform Material
+struct Material
 {
 	vec4 color;
 	float metallic;
 	float roughness;
 	float ambient_occlusion;
-} material;
+};
+
+layout( set = 1, binding = 0 ) readonly buffer Materials
+{
+	Material materials[];
+};
 
 layout( location = 0 ) in vec3 in_position;
 layout( location = 1 ) in vec3 in_normal;
 layout( location = 2 ) in vec4 in_color;
+layout( location = 3 ) flat in uint in_material;
 
 layout( location = 0 ) out vec4 out_color;
 
@@ -36,5 +42,5 @@ void main()
 	float diffuse_factor = max( dot( normal, light_direction ), 0.0 );
 	vec3 diffuse_color = diffuse_factor * light.color;
 	vec4 light_color = vec4( ambient_color + diffuse_color, 1.0 );
-	out_color = light_color * material.color;
+	out_color = light_color * materials[in_material].color;
 }
@@ -1,11 +1,26 @@
 #version 450
 
-layout( binding = 0 ) uniform Mvp {
-	mat4 model;
+layout( set = 0, binding = 0 ) uniform View {
 	mat4 view;
 	mat4 proj;
 } ubo;
 
+struct Instance {
+	mat4 model;
+	uint material;
+};
+
+layout( set = 2, binding = 0 ) readonly buffer Instances {
+	Instance instances[];
+};
+
+// A single instance gets its data through push constants
+layout( push_constant ) uniform Object {
+	mat4 model;
+	uint material;
+	uint instanced;
+} object;
+
 layout( location = 0 ) in vec3 in_position;
 layout( location = 1 ) in vec3 in_normal;
 layout( location = 2 ) in vec4 in_color;
@@ -14,12 +29,22 @@ layout( location = 3 ) in vec2 in_texcoord;
 layout( location = 0 ) out vec3 out_position;
 layout( location = 1 ) out vec3 out_normal;
 layout( location = 2 ) out vec4 out_color;
+layout( location = 3 ) flat out uint out_material;
 
 void main()
 {
+	mat4 model = object.model;
+	uint material = object.material;
+	if ( object.instanced != 0 )
+	{
+		model = instances[gl_InstanceIndex].model;
+		material = instances[gl_InstanceIndex].material;
+	}
+
 	gl_PointSize = 8.0;
-	out_position = vec3( ubo.model * vec4( in_position, 1.0 ) );
-	out_normal = mat3( transpose( inverse( ubo.model ) ) ) * in_normal;
+	out_position = vec3( model * vec4( in_position, 1.0 ) );
+	out_normal = mat3( transpose( inverse( model ) ) ) * in_normal;
 	out_color = in_color;
-	gl_Position = ubo.proj * ubo.view * ubo.model * vec4( in_position, 1.0 );
+	out_material = material;
+	gl_Position = ubo.proj * ubo.view * model * vec4( in_position, 1.0 );
 }